@@ -47,6 +47,31 @@ Cswrite(Cstring *iot, char *bfr, int size)
 }
 
 
+/* a sink that appends to a cstring
+ */
+int
+Cssink(const char *bfr, const int size, void *iot)
+{
+    return Cswrite((Cstring*)iot, (char*)bfr, size);
+}
+
+
+/* send the contents of a cstring to a sink, then empty it
+ */
+int
+___mkd_flush(Cstring *iot, struct mkd_sink *sink)
+{
+    if ( S(*iot) && !sink->error ) {
+	if ( (*sink->fn)(T(*iot), S(*iot), sink->ctx) == EOF )
+	    sink->error = 1;
+	else
+	    sink->written += S(*iot);
+    }
+    S(*iot) = 0;
+    return sink->error ? EOF : 0;
+}
+
+
 /* reparse() into a cstring
  */
 void
@@ -6,10 +6,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "config.h"
+#include "amalloc.h"
+
+/* (but this is where the real malloc & friends are called, and
+ * it can be built into a program that isn't using it everywhere)
+ */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef adump
 
 #define MAGIC 0x1f2e3d4c
 
-struct alist { int magic, size, index; int *end; struct alist *next, *last; };
+struct alist { int magic, size, index, tag; int *end; struct alist *next, *last; };
 
 static struct alist list =  { 0, 0, 0, 0 };
 
@@ -19,6 +29,92 @@ static int frees=0;
 
 static int index = 0;
 
+/* profiling:  memory is charged to whichever subsystem is on top of
+ * the tag stack when it is first allocated.
+ */
+#define NR_TAGSTACK	64
+#define NR_BUCKETS	20
+
+static int tagstack[NR_TAGSTACK];
+static int tagsp = 0;
+
+static struct {
+    long allocs;	/* mallocs & callocs */
+    long reallocs;
+    long current;	/* bytes in use now */
+    long peak;		/* most bytes ever in use */
+} usage[A_NR_TAGS], total;
+
+static long histogram[NR_BUCKETS];	/* realloc()s by new size */
+static long input = 0;
+
+#define A_TAG(tag,name)	name,
+static char *tagnames[A_NR_TAGS] = { A_TAGS } ;
+#undef A_TAG
+
+
+static int
+curtag()
+{
+    if ( tagsp > 0 && tagsp <= NR_TAGSTACK )
+	return tagstack[tagsp-1];
+    return A_OTHER;
+}
+
+
+/* start charging allocations to a subsystem
+ */
+void
+atag(int tag)
+{
+    if ( tagsp < NR_TAGSTACK )
+	tagstack[tagsp] = (tag >= 0 && tag < A_NR_TAGS) ? tag : A_OTHER;
+    ++tagsp;
+}
+
+
+/* go back to charging allocations to whatever subsystem was
+ * being charged before the last atag()
+ */
+void
+auntag()
+{
+    if ( tagsp > 0 )
+	--tagsp;
+}
+
+
+/* note how much input has been read, for allocations/kb
+ */
+void
+ainput(long size)
+{
+    input += size;
+}
+
+
+static void
+charge(int tag, long delta)
+{
+    usage[tag].current += delta;
+    if ( usage[tag].current > usage[tag].peak )
+	usage[tag].peak = usage[tag].current;
+    total.current += delta;
+    if ( total.current > total.peak )
+	total.peak = total.current;
+}
+
+
+static int
+bucket(int size)
+{
+    int i;
+
+    for ( i=0; (i < NR_BUCKETS-1) && (size > (16 << i)); i++ )
+	;
+    return i;
+}
+
 static void
 die(char *msg, int index)
 {
@@ -41,6 +137,7 @@ acalloc(int count, int size)
 	ret->magic = MAGIC;
 	ret->size = size * count;
 	ret->index = index ++;
+	ret->tag = curtag();
 	ret->end = (int*)(count + (char*) (ret + 1));
 	*(ret->end) = ~MAGIC;
 	if ( list.next ) {
@@ -54,6 +151,9 @@ acalloc(int count, int size)
 	    list.next = list.last = ret;
 	}
 	++mallocs;
+	usage[ret->tag].allocs++;
+	total.allocs++;
+	charge(ret->tag, ret->size);
 	return ret+1;
     }
     return 0;
@@ -78,6 +178,7 @@ afree(void *ptr)
 	p2->last->next = p2->next;
 	p2->next->last = p2->last;
 	++frees;
+	charge(p2->tag, -(long)p2->size);
 	free(p2);
     }
     else
@@ -90,15 +191,28 @@ arealloc(void *ptr, int size)
 {
     struct alist *p2 = ((struct alist*)ptr)-1;
     struct alist save;
+    int oldsize;
 
     if ( p2->magic == MAGIC ) {
 	if ( ! (p2->end && *(p2->end) == ~MAGIC) )
 	    die("goddam: corrupted memory block %d in realloc()!\n", p2->index);
 	save.next = p2->next;
 	save.last = p2->last;
+	oldsize = p2->size;
 	p2 = realloc(p2, sizeof(int) + sizeof(*p2) + size);
 
 	if ( p2 ) {
+	    if ( p2->tag == A_OTHER ) {
+		/* (and what it was charged to before goes with it)
+		 */
+		charge(A_OTHER, -(long)oldsize);
+		p2->tag = curtag();
+		charge(p2->tag, (long)oldsize);
+	    }
+	    charge(p2->tag, (long)size - oldsize);
+	    usage[p2->tag].reallocs++;
+	    total.reallocs++;
+	    histogram[bucket(size)]++;
 	    p2->size = size;
 	    p2->end = (int*)(size + (char*) (p2 + 1));
 	    *(p2->end) = ~MAGIC;
@@ -133,4 +247,32 @@ adump()
 	fprintf(stderr, "%d realloc%s\n", reallocs, (reallocs==1)?"":"s");
 	fprintf(stderr, "%d free%s\n", frees, (frees==1)?"":"s");
     }
+
+    if ( getenv("AMALLOC_PROFILE") ) {
+	int i;
+
+	fprintf(stderr, "%-12s %10s %10s %10s %10s\n",
+			"subsystem", "allocs", "reallocs", "current", "peak");
+	for ( i=0; i < A_NR_TAGS; i++ )
+	    fprintf(stderr, "%-12s %10ld %10ld %10ld %10ld\n", tagnames[i],
+			    usage[i].allocs, usage[i].reallocs,
+			    usage[i].current, usage[i].peak);
+	fprintf(stderr, "%-12s %10ld %10ld %10ld %10ld\n", "total",
+			total.allocs, total.reallocs,
+			total.current, total.peak);
+
+	fprintf(stderr, "realloc sizes:\n");
+	for ( i=0; i < NR_BUCKETS; i++ )
+	    if ( histogram[i] ) {
+		if ( i < NR_BUCKETS-1 )
+		    fprintf(stderr, "  <= %8d: %ld\n", 16 << i, histogram[i]);
+		else
+		    fprintf(stderr, "   > %8d: %ld\n", 16 << (i-1), histogram[i]);
+	    }
+
+	if ( input > 0 )
+	    fprintf(stderr, "%ld input byte%s, %.1f allocations/kb\n",
+			    input, (input==1) ? "" : "s",
+			    (total.allocs + total.reallocs) / (input / 1024.0));
+    }
 }
@@ -7,6 +7,22 @@
 
 #include "config.h"
 
+/* subsystems that the allocation profiler charges memory to, and
+ * what it calls them (amalloc.c makes its table of names out of
+ * this list, so a new subsystem only needs to be added here)
+ */
+#define A_TAGS \
+    A_TAG(A_OTHER,	"other") \
+    A_TAG(A_LINES,	"lines") \
+    A_TAG(A_PARAGRAPHS,	"paragraphs") \
+    A_TAG(A_QUEUE,	"queue") \
+    A_TAG(A_OUTPUT,	"output") \
+    A_TAG(A_FOOTNOTES,	"footnotes")
+
+#define A_TAG(tag,name)	tag,
+enum { A_TAGS A_NR_TAGS };
+#undef A_TAG
+
 #ifdef USE_AMALLOC
 
 extern void *amalloc(int);
@@ -14,6 +30,13 @@ extern void *acalloc(int,int);
 extern void *arealloc(void*,int);
 extern void afree(void*);
 extern void adump();
+extern void atag(int);
+extern void auntag();
+extern void ainput(long);
+
+#define ATAG(t)		atag(t)
+#define AUNTAG()	auntag()
+#define AINPUT(n)	ainput(n)
 
 #define malloc	amalloc
 #define	calloc	acalloc
@@ -23,6 +46,9 @@ extern void adump();
 #else
 
 #define adump()	(void)1
+#define ATAG(t)		(void)1
+#define AUNTAG()	(void)1
+#define AINPUT(n)	(void)1
 
 #endif
 
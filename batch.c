@@ -0,0 +1,112 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+typedef int (*getc_func)(void*);
+
+/* a batch of jobs being run by mkd_batch()
+ */
+struct batch {
+    struct mkd_job *jobs;
+    mkd_done_t done;
+    void *ctx;
+    Document **docs;		/* a reusable document for each thread */
+} ;
+
+
+/* read, compile, and render one job with this thread's document,
+ * then hand it to the completion function and clear it out for the
+ * next job.
+ */
+static void
+batch_job(void *ctx, int job, int thread)
+{
+    struct batch *b = ctx;
+    struct mkd_job *j = &b->jobs[job];
+    Document *doc = b->docs[thread];
+    struct string_stream about;
+    FILE *in;
+    char *html;
+
+    if ( !doc && !(doc = b->docs[thread] = __mkd_new_Document()) ) {
+	(*b->done)(j, 0, b->ctx);
+	return;
+    }
+
+    if ( j->file ) {
+	if ( !(in = fopen(j->file, "r")) ) {
+	    (*b->done)(j, 0, b->ctx);
+	    return;
+	}
+	__mkd_populate(doc, (getc_func)fgetc, in, j->flags);
+	fclose(in);
+    }
+    else {
+	about.data = j->text ? j->text : "";
+	about.size = j->text ? j->size : 0;
+	__mkd_populate(doc, (getc_func)__mkd_io_strget, &about, j->flags);
+    }
+
+    doc->cb.e_url = j->e_url;
+    doc->cb.e_flags = j->e_flags;
+    doc->cb.e_anchor = j->e_anchor;
+    doc->cb.e_codefmt = j->e_codefmt;
+    doc->cb.e_free = j->e_free;
+    doc->cb.e_data = j->e_data;
+
+    if ( mkd_compile(doc, j->flags) )
+	mkd_document(doc, &html);
+
+    (*b->done)(j, doc, b->ctx);
+    ___mkd_recycle(doc);
+}
+
+
+/* compile and render `count` jobs on up to `threads` threads, calling
+ * `done` with each job and its document (or 0 if the input couldn't be
+ * read) as it finishes.  The jobs finish in no particular order and
+ * `done` may be called from more than one thread at a time;  the
+ * document belongs to mkd_batch() and is only good until `done`
+ * returns.  Returns EOF if the batch is bad.
+ */
+int
+mkd_batch(struct mkd_job *jobs, int count, int threads, mkd_done_t done, void *ctx)
+{
+    struct batch b;
+    int i;
+
+    if ( !(jobs && done) || count < 0 || threads < 1 )
+	return EOF;
+    if ( count == 0 )
+	return 0;
+
+    if ( threads > count )
+	threads = count;
+
+    mkd_initialize();	/* before the threads race to do it */
+
+    b.jobs = jobs;
+    b.done = done;
+    b.ctx = ctx;
+    if ( !(b.docs = calloc(threads, sizeof b.docs[0])) )
+	return EOF;
+
+    ___mkd_parallel(threads, count, batch_job, &b);
+
+    for ( i=0; i < threads; i++ )
+	mkd_cleanup(b.docs[i]);
+    free(b.docs);
+    return 0;
+}
@@ -0,0 +1,353 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#if USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+typedef int (*stfu)(const void*,const void*);
+
+int __mkd_footsort(Footnote *, Footnote *);
+
+/* a block is looked for in this many slots, starting from the one
+ * its hash picks
+ */
+#define CACHE_WAYS	4
+
+/* the html for a block, and what it was rendered from
+ */
+struct cached {
+    struct mkd_hash key;	/* the block, and how it was rendered */
+    struct mkd_hash deps;	/* what the links it looked up pointed at */
+    Cstring refs;		/* and the tags of those links */
+    Cstring html;
+    char last;			/* the last character it wrote */
+    unsigned long used;		/* when it was last copied out */
+    int full;
+} ;
+
+struct mkd_cache {
+    struct cached *slot;
+    int size;
+    unsigned long clock;
+#if USE_THREADS
+    pthread_mutex_t lock;
+#endif
+} ;
+
+#if USE_THREADS
+# define LOCK(c)	pthread_mutex_lock(&(c)->lock)
+# define UNLOCK(c)	pthread_mutex_unlock(&(c)->lock)
+#else
+# define LOCK(c)	(void)0
+# define UNLOCK(c)	(void)0
+#endif
+
+
+/* a key is everything that went into rendering a block, written out
+ * into ->bytes, which is what's compared when a block is looked for;
+ * the hashes are only there to say where to look.
+ */
+static void
+mix(struct mkd_hash *h, const char *s, int size)
+{
+    if ( size > 0 )
+	SUFFIX(h->bytes, s, size);
+}
+
+
+/* two different string hashes (fnv-1a and sdbm) run side by side, so
+ * the key is still spread out well where a long is only 32 bits
+ */
+static void
+digest(struct mkd_hash *h)
+{
+    unsigned long a = 2166136261UL, b = 0;
+    unsigned char *s = (unsigned char *)T(h->bytes);
+    int i;
+
+    for ( i=0; i < S(h->bytes); i++ ) {
+	a = (a ^ s[i]) * 16777619UL;
+	b = s[i] + (b << 6) + (b << 16) - b;
+    }
+    h->a = a;
+    h->b = b;
+}
+
+
+static int
+samebytes(struct mkd_hash *x, struct mkd_hash *y)
+{
+    return (S(x->bytes) == S(y->bytes))
+	&& ((S(x->bytes) == 0) || (memcmp(T(x->bytes), T(y->bytes), S(x->bytes)) == 0));
+}
+
+
+static int
+samekey(struct mkd_hash *x, struct mkd_hash *y)
+{
+    return (x->a == y->a) && (x->b == y->b) && samebytes(x, y);
+}
+
+
+static void
+copykey(struct mkd_hash *to, struct mkd_hash *from)
+{
+    to->a = from->a;
+    to->b = from->b;
+    S(to->bytes) = 0;
+    if ( S(from->bytes) )
+	SUFFIX(to->bytes, T(from->bytes), S(from->bytes));
+}
+
+
+static void
+mixint(struct mkd_hash *h, long n)
+{
+    mix(h, (char*)&n, sizeof n);
+}
+
+
+static void
+mixstring(struct mkd_hash *h, char *s)
+{
+    if ( s )
+	mix(h, s, 1+strlen(s));
+    else
+	mixint(h, -1);
+}
+
+
+static void
+mixlines(struct mkd_hash *h, Line *t)
+{
+    for ( ; t; t = t->next ) {
+	mixint(h, S(t->text));
+	mix(h, T(t->text), S(t->text));
+	mixint(h, t->dle);
+	mixint(h, t->kind);
+	mixint(h, t->is_fenced);
+	mixint(h, t->is_checked);
+	mixint(h, t->has_pipechar);
+	mixint(h, t->count);
+	mixstring(h, t->fence_class);
+    }
+    mixint(h, -2);
+}
+
+
+static void
+mixblocks(struct mkd_hash *h, Paragraph *p, int siblings)
+{
+    for ( ; p; p = siblings ? p->next : 0 ) {
+	mixint(h, p->typ);
+	mixint(h, p->align);
+	mixint(h, p->hnumber);
+	mixint(h, p->para_flags);
+	mixstring(h, p->ident);
+	mixstring(h, p->lang);
+	mixstring(h, p->label);
+	mixlines(h, p->text);
+	mixblocks(h, p->down, 1);
+    }
+    mixint(h, -3);
+}
+
+
+/* write down what the links a block looked up point at now
+ */
+static void
+lookup(struct mkd_hash *h, Cstring *refs, MMIOT *f)
+{
+    Footnote key, *ref;
+    char *p, *end;
+    int size;
+
+    S(h->bytes) = 0;
+    memset(&key, 0, sizeof key);
+
+    for ( p = T(*refs), end = p + S(*refs); p < end; p += size+1 ) {
+	size = strlen(p);
+	T(key.tag) = p+1;
+	S(key.tag) = size-1;
+
+	if ( ref = bsearch(&key, T(f->footnotes->note), S(f->footnotes->note),
+				 sizeof key, (stfu)__mkd_footsort) ) {
+	    mixint(h, S(ref->link));
+	    mix(h, T(ref->link), S(ref->link));
+	    mixint(h, S(ref->title));
+	    mix(h, T(ref->title), S(ref->title));
+	    mixint(h, ref->height);
+	    mixint(h, ref->width);
+	    mixint(h, ref->fn_flags & EXTRA_FOOTNOTE);
+	}
+	else
+	    mixint(h, -4);
+    }
+}
+
+
+/* make a cache that holds the html for (about) `blocks` blocks
+ */
+struct mkd_cache *
+mkd_new_cache(int blocks)
+{
+    struct mkd_cache *c;
+
+    if ( blocks < CACHE_WAYS )
+	blocks = CACHE_WAYS;
+
+    if ( !(c = calloc(1, sizeof *c)) )
+	return 0;
+    if ( !(c->slot = calloc(blocks, sizeof c->slot[0])) ) {
+	free(c);
+	return 0;
+    }
+    c->size = blocks;
+#if USE_THREADS
+    pthread_mutex_init(&c->lock, 0);
+#endif
+    return c;
+}
+
+
+/* throw a cache away (none of the documents using it may be
+ * rendered after this)
+ */
+void
+mkd_free_cache(struct mkd_cache *c)
+{
+    int i;
+
+    if ( !c )
+	return;
+
+    for ( i=0; i < c->size; i++ ) {
+	DELETE(c->slot[i].key.bytes);
+	DELETE(c->slot[i].deps.bytes);
+	DELETE(c->slot[i].refs);
+	DELETE(c->slot[i].html);
+    }
+#if USE_THREADS
+    pthread_mutex_destroy(&c->lock);
+#endif
+    free(c->slot);
+    free(c);
+}
+
+
+/* render a document's blocks through a cache, or (with a null cache)
+ * stop doing that.  A cache can be shared by any number of documents
+ * (on any number of threads.)
+ */
+int
+mkd_use_cache(Document *doc, struct mkd_cache *c)
+{
+    if ( !doc )
+	return EOF;
+
+    doc->cache = c;
+    return 0;
+}
+
+
+/* look for the html for a block in a cache and (if it's there) write
+ * it out.  The block's key is left in `key` (whose ->bytes the caller
+ * CREATEs and DELETEs) so it can be put into the cache if it isn't
+ * there, and `deps` is used to check what its links point at.
+ */
+int
+___mkd_cache_get(struct mkd_cache *c, Paragraph *p, MMIOT *f,
+		 struct mkd_hash *key, struct mkd_hash *deps)
+{
+    struct cached *it;
+    int i, found = 0;
+
+    S(key->bytes) = 0;
+    mixblocks(key, p, 0);
+    mix(key, f->flags.bit, sizeof f->flags.bit);
+    mixstring(key, f->ref_prefix);
+    mixstring(key, f->protocols ? f->protocols->list : 0);
+    mixint(key, (unsigned char)f->last);
+    digest(key);
+
+    LOCK(c);
+    for ( i=0; (i < CACHE_WAYS) && !found; i++ ) {
+	it = &c->slot[(key->a + i) % c->size];
+
+	if ( !(it->full && samekey(&it->key, key)) )
+	    continue;
+
+	lookup(deps, &it->refs, f);
+	if ( samebytes(deps, &it->deps) ) {
+	    /* (most of the output is copied in large pieces when the
+	     * cache is working, so make room for it a lot at a time)
+	     */
+	    if ( S(f->out) + S(it->html) >= ALLOCATED(f->out) )
+		RESERVE(f->out, S(f->out) + S(it->html));
+	    SUFFIX(f->out, T(it->html), S(it->html));
+	    f->last = it->last;
+	    it->used = ++c->clock;
+	    found = 1;
+	}
+    }
+    UNLOCK(c);
+    return found;
+}
+
+
+/* put the html that a block was just rendered as (everything in
+ * f->out after `start`) into a cache, unless it referenced an extra
+ * footnote (which are numbered in the order they're referenced.)
+ * `refs` are the tags of the links it looked up, and `deps` is
+ * somewhere to write down what they point at.
+ */
+void
+___mkd_cache_put(struct mkd_cache *c, struct mkd_hash *key, MMIOT *f, int start,
+		 Cstring *refs, struct mkd_hash *deps)
+{
+    struct cached *it, *victim = 0;
+    int i;
+
+    for ( i=0; i < S(*refs); i += 1+strlen(T(*refs)+i) )
+	if ( T(*refs)[i] == '^' )
+	    return;
+
+    LOCK(c);
+    for ( i=0; i < CACHE_WAYS; i++ ) {
+	it = &c->slot[(key->a + i) % c->size];
+
+	if ( !it->full || samekey(&it->key, key) ) {
+	    victim = it;
+	    break;
+	}
+	if ( !victim || (it->used < victim->used) )
+	    victim = it;
+    }
+
+    copykey(&victim->key, key);
+    lookup(deps, refs, f);
+    copykey(&victim->deps, deps);
+    S(victim->refs) = 0;
+    if ( S(*refs) )
+	SUFFIX(victim->refs, T(*refs), S(*refs));
+    S(victim->html) = 0;
+    SUFFIX(victim->html, T(f->out)+start, S(f->out)-start);
+    victim->last = f->last;
+    victim->used = ++c->clock;
+    victim->full = 1;
+    UNLOCK(c);
+}
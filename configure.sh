@@ -8,6 +8,7 @@
 # load in the configuration file
 #
 ac_help='--enable-amalloc	Enable memory allocation debugging
+--enable-threads	Compile large documents on more than one thread
 --with-tabstops=N	Set tabstops to N characters (default is 4)
 --shared		Build shared libraries (default is static)
 --pkg-config		Install pkg-config(1) glue files
@@ -177,6 +178,11 @@ else
     AC_DEFINE 'COINTOSS()' '1'
 fi
 
+AC_CHECK_FUNCS 'clock_gettime(CLOCK_MONOTONIC,0)' 'time.h' || \
+	    AC_CHECK_FUNCS 'gettimeofday(0,0)' 'sys/time.h'
+
+AC_CHECK_HEADERS sys/uio.h
+
 if AC_CHECK_FUNCS strcasecmp; then
     :
 elif AC_CHECK_FUNCS stricmp; then
@@ -217,6 +223,15 @@ else
     AC_SUB	'AMALLOC'	''
 fi
 
+if [ "$WITH_THREADS" ]; then
+    test "$WITH_AMALLOC" && AC_FAIL "--enable-threads can't be used with --enable-amalloc"
+    if AC_CHECK_HEADERS pthread.h && AC_LIBRARY pthread_create -lpthread; then
+	AC_DEFINE	'USE_THREADS'	1
+    else
+	AC_FAIL "--enable-threads needs pthreads"
+    fi
+fi
+
 if [ "$H1TITLE" ]; then
     AC_SUB 'H1TITLE' h1title.o
     AC_DEFINE USE_H1TITLE 1
@@ -22,7 +22,7 @@
  * dump out stylesheet sections.
  */
 static void
-stylesheets(Paragraph *p, Cstring *f)
+stylesheets(Paragraph *p, Cstring *f, struct mkd_sink *out)
 {
     Line* q;
 
@@ -32,13 +32,34 @@ stylesheets(Paragraph *p, Cstring *f)
 		Cswrite(f, T(q->text), S(q->text));
 		Csputc('\n', f);
 	    }
+	    ___mkd_flush(f, out);
 	}
 	if ( p->down )
-	    stylesheets(p->down, f);
+	    stylesheets(p->down, f, out);
     }
 }
 
 
+/* dump any embedded styles to a sink
+ */
+int
+mkd_sink_css(Document *d, mkd_sink_t fn, void *ctx)
+{
+    Cstring f;
+    struct mkd_sink out;
+
+    if ( fn && d && d->compiled ) {
+	SINK_TO(out, fn, ctx);
+	CREATE(f);
+	RESERVE(f, 100);
+	stylesheets(d->code, &f, &out);
+	DELETE(f);
+	return out.error ? EOF : out.written;
+    }
+    return EOF;
+}
+
+
 /* dump any embedded styles to a string
  */
 int
@@ -51,8 +72,8 @@ mkd_css(Document *d, char **res)
 	*res = 0;
 	CREATE(f);
 	RESERVE(f, 100);
-	stylesheets(d->code, &f);
-			
+	mkd_sink_css(d, Cssink, &f);
+
 	if ( (size = S(f)) > 0 ) {
 	    /* null-terminate, then strdup() into a free()able memory
 	     * chunk
@@ -72,14 +93,5 @@ mkd_css(Document *d, char **res)
 int
 mkd_generatecss(Document *d, FILE *f)
 {
-    char *res;
-    int written;
-    int size = mkd_css(d, &res);
-
-    written = (size > 0) ? fwrite(res,1,size,f) : 0;
-    
-    if ( res )
-	free(res);
-    
-    return (written == size) ? size : EOF;
+    return mkd_sink_css(d, ___mkd_fsink, f);
 }
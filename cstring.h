@@ -37,10 +37,9 @@
 				? realloc(T(x), sizeof T(x)[0] * ((x).alloc = 100+(sz)+S(x))) \
 				: malloc(sizeof T(x)[0] * ((x).alloc = 100+(sz)+S(x))))
 #define SUFFIX(t,p,sz)	\
-	    memcpy(((S(t) += (sz)) - (sz)) + \
-		    (T(t) = T(t) ? realloc(T(t), sizeof T(t)[0] * ((t).alloc += sz)) \
-				 : malloc(sizeof T(t)[0] * ((t).alloc += sz))), \
-		    (p), sizeof(T(t)[0])*(sz))
+	    ( RESERVE( (t), (sz) ), \
+	      memcpy(T(t)+S(t), (p), sizeof(T(t)[0])*(sz)), \
+	      S(t) += (sz) )
 
 #define PREFIX(t,p,sz)	\
 	    RESERVE( (t), (sz) ); \
@@ -72,5 +71,6 @@ typedef STRING(char) Cstring;
 extern void Csputc(int, Cstring *);
 extern int Csprintf(Cstring *, char *, ...);
 extern int Cswrite(Cstring *, char *, int);
+extern int Cssink(const char *, const int, void *);
 
 #endif/*_CSTRING_D*/
@@ -152,6 +152,9 @@ mkd_dump(Document *doc, FILE *out, mkd_flag_t *flags, char *title)
 	dumptree(doc->code, &stack, out);
 	DELETE(stack);
 
+	if ( doc->collect_stats )
+	    mkd_generatestats(doc, out);
+
 	return 0;
     }
     return -1;
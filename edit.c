@@ -0,0 +1,695 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+typedef int (*getc_func)(void*);
+typedef int (*stfu)(const void*,const void*);
+
+int __mkd_footsort(Footnote *, Footnote *);
+
+/* an editable document is kept in pieces of at least this many lines
+ */
+#define EDIT_LINES	64
+
+/* a piece of the document that's being recompiled
+ */
+struct job {
+    Line *text;
+    MMIOT f;
+    struct mkd_budget budget;
+    struct mkd_piece *piece;
+} ;
+
+
+/* build a document that can be changed with mkd_update() after it's
+ * been compiled.
+ */
+Document *
+mkd_edit_string(const char *text, int size, mkd_flag_t *flags)
+{
+    Document *doc;
+    struct mkd_edit *e;
+    struct mkd_piece *p;
+
+    if ( size < 0 || (size && !text) )
+	return 0;
+
+    if ( (doc = mkd_string(text, size, flags)) == 0 )
+	return 0;
+    DELETE(doc->source);	/* (the pieces hold the text) */
+
+    if ( (e = doc->edit = calloc(1, sizeof *e)) == 0 ) {
+	mkd_cleanup(doc);
+	return 0;
+    }
+    if ( flags )
+	COPY_FLAGS(e->flags, *flags);
+    else
+	mkd_init_flags(&e->flags);
+    CREATE(e->pieces);
+    CREATE(e->links);
+
+    p = &EXPAND(e->pieces);
+    memset(p, 0, sizeof *p);
+    SUFFIX(p->text, (char*)text, size);
+
+    return doc;
+}
+
+
+/* undo the joins that put the pieces of a document together, so each
+ * piece is left with just its own blocks
+ */
+static void
+unjoin(struct mkd_edit *e)
+{
+    int i;
+
+    for ( i=0; i < S(e->links); i++ )
+	*T(e->links)[i] = 0;
+    S(e->links) = 0;
+}
+
+
+static void
+join(struct mkd_edit *e, Paragraph **at, Paragraph *p)
+{
+    *at = p;
+    EXPAND(e->links) = at;
+}
+
+
+/* put the pieces back together into one block list, carrying the
+ * source block at the end of one piece on into the source block that
+ * the next piece starts with (the way compile_pieces() does, only
+ * without freeing the second one, because it still belongs to its
+ * piece.)  An html block that isn't closed is compiled as source too,
+ * but compile_document() doesn't carry anything on into it.
+ */
+static Paragraph *
+link_pieces(struct mkd_edit *e)
+{
+    struct mkd_piece *p;
+    Paragraph *first = 0, *end = 0, *down = 0, *q;
+    int i;
+
+    for ( i=0; i < S(e->pieces); i++ ) {
+	p = &T(e->pieces)[i];
+
+	if ( (q = p->code) == 0 )
+	    continue;
+
+	if ( end && (end->typ == SOURCE) && (q->typ == SOURCE) && !p->opens ) {
+	    if ( q->down ) {
+		join(e, down ? &down->next : &end->down, q->down);
+		down = p->head;
+	    }
+	    if ( (q = q->next) == 0 )
+		continue;
+	}
+
+	if ( end )
+	    join(e, &end->next, q);
+	else
+	    first = q;
+	end = p->last;
+	down = p->tail;
+    }
+    return first;
+}
+
+
+static Paragraph *
+lastof(Paragraph *p)
+{
+    if ( p )
+	while ( p->next )
+	    p = p->next;
+    return p;
+}
+
+
+/* the first block in a list that htmlify() would display
+ */
+static Paragraph *
+firstunit(Paragraph *p)
+{
+    Paragraph *u;
+
+    for ( ; p; p = p->next )
+	if ( p->typ != SOURCE )
+	    return p;
+	else if ( (u = firstunit(p->down)) )
+	    return u;
+    return 0;
+}
+
+
+/* throw away what a piece compiled into, but keep its text
+ */
+static void
+forget(struct mkd_piece *p)
+{
+    int i;
+
+    if ( p->code )
+	___mkd_freeParagraph(p->code);
+    for ( i=0; i < S(p->notes.note); i++ )
+	___mkd_freefootnote(&T(p->notes.note)[i]);
+    DELETE(p->notes.note);
+    DELETE(p->html);
+    DELETE(p->labels);
+    CREATE(p->notes.note);
+    CREATE(p->html);
+    CREATE(p->labels);
+    p->code = p->last = p->head = p->tail = p->unit = 0;
+    p->fresh = 0;
+}
+
+
+static int
+samestring(Cstring *a, Cstring *b)
+{
+    return (S(*a) == S(*b)) && ( S(*a) == 0 || memcmp(T(*a), T(*b), S(*a)) == 0 );
+}
+
+
+/* are two footnotes the same?  (extra footnotes never are, because
+ * their text has been compiled.)
+ */
+static int
+samenote(Footnote *a, Footnote *b)
+{
+    return samestring(&a->tag, &b->tag) && samestring(&a->link, &b->link)
+				        && samestring(&a->title, &b->title)
+				        && (a->height == b->height)
+				        && (a->width == b->width)
+				        && (a->fn_flags == b->fn_flags)
+				        && !(a->text || b->text);
+}
+
+
+/* step through the footnotes defined in a run of pieces
+ */
+static Footnote *
+nextnote(struct mkd_piece *p, int count, int *i, int *j)
+{
+    while ( *i < count ) {
+	if ( *j < S(p[*i].notes.note) )
+	    return &T(p[*i].notes.note)[(*j)++];
+	++*i;
+	*j = 0;
+    }
+    return 0;
+}
+
+
+/* do the new pieces define exactly the same footnotes as the old ones
+ * they replace?  If they do, they take the old footnotes (which the
+ * document's footnote list points into) and hand theirs back to be
+ * thrown away.
+ */
+static int
+samenotes(struct mkd_piece *old, int count, struct mkd_piece *new, int newcount)
+{
+    Footnote *a, *b, tmp;
+    int i, j, k, l, total = 0;
+
+    for ( i=0; i < count; i++ )
+	total += S(old[i].notes.note);
+    for ( i=0; i < newcount; i++ )
+	total -= S(new[i].notes.note);
+    if ( total )
+	return 0;
+
+    for ( i=j=k=l=0; (a = nextnote(old, count, &i, &j)); )
+	if ( !samenote(a, nextnote(new, newcount, &k, &l)) )
+	    return 0;
+
+    for ( i=j=k=l=0; (a = nextnote(old, count, &i, &j)); ) {
+	b = nextnote(new, newcount, &k, &l);
+	tmp = *a;
+	*a = *b;
+	*b = tmp;
+    }
+    return 1;
+}
+
+
+static void
+compile_job(void *ctx, int job, int thread)
+{
+    struct job *j = (struct job *)ctx + job;
+
+    j->piece->code = ___mkd_compile_chunk(j->text, &j->f);
+}
+
+
+/* add the text of pieces `from` through `to` to the end of `text`
+ */
+static void
+gather(struct mkd_edit *e, int from, int to, Cstring *text)
+{
+    for ( ; from <= to; from++ )
+	SUFFIX(*text, T(T(e->pieces)[from].text), S(T(e->pieces)[from].text));
+}
+
+
+/* does the document get back in step with the chunker on the first
+ * line of the piece that follows the recompiled ones?
+ */
+static int
+insync(Document *doc, struct mkd_chunker *chunk, struct mkd_piece *next)
+{
+    Document first;
+    struct mkd_chunker probe = *chunk;
+    struct string_stream about;
+    mkd_flag_t noheader;
+    char *eol;
+    int ok;
+
+    COPY_FLAGS(noheader, doc->edit->flags);
+    set_mkd_flag(&noheader, MKD_NOHEADER);
+
+    if ( S(next->text) == 0 )
+	return 0;
+
+    memset(&first, 0, sizeof first);
+    about.data = T(next->text);
+    about.size = (eol = memchr(T(next->text), '\n', S(next->text)))
+		    ? (1 + eol - T(next->text))
+		    : S(next->text);
+    __mkd_populate(&first, (getc_func)__mkd_io_strget, &about, &noheader);
+
+    if ( T(first.content) == 0 )
+	return 0;
+
+    ___mkd_chunk(&probe, T(first.content), &doc->ctx->flags);
+    ok = (probe.cut == T(first.content));
+    ___mkd_freeLines(T(first.content));
+    return ok;
+}
+
+
+/* recompile pieces `first` through `last` of a document (their text
+ * has been changed), carrying on into the following pieces until the
+ * chunker gets back in step with the places the document was cut,
+ * then put the new pieces in their place.
+ */
+static void
+rebuild(Document *doc, int first, int last)
+{
+    struct mkd_edit *e = doc->edit;
+    MMIOT *f = doc->ctx;
+    Document text;
+    struct mkd_chunker chunk;
+    struct string_stream about;
+    mkd_flag_t flags;
+    Cstring raw;
+    STRING(struct mkd_piece) fresh;
+    STRING(struct job) jobs;
+    Istring cuts;
+    STRING(Line*) ends;
+    struct mkd_piece *p;
+    struct job *j;
+    Line *t, *next, *cut, *end;
+    int i, at, cutline, prevline, header, line, pos, threads, grow;
+
+    COPY_FLAGS(flags, e->flags);
+    if ( first > 0 )
+	set_mkd_flag(&flags, MKD_NOHEADER);
+
+    CREATE(raw);
+    CREATE(cuts);
+    CREATE(ends);
+    gather(e, first, last, &raw);
+
+    while ( 1 ) {
+	/* the pieces that follow have to start on a line of their own
+	 */
+	while ( (last+1 < S(e->pieces)) && (S(raw) == 0 || T(raw)[S(raw)-1] != '\n') )
+	    gather(e, last+1, last+1, &raw), ++last;
+
+	memset(&text, 0, sizeof text);
+	about.data = T(raw);
+	about.size = S(raw);
+	__mkd_populate(&text, (getc_func)__mkd_io_strget, &about, &flags);
+
+	S(cuts) = S(ends) = 0;
+	memset(&chunk, 0, sizeof chunk);
+	cutline = 0;
+	for ( at=0, t = T(text.content); t; t = t->next ) {
+	    cut = chunk.cut;
+	    prevline = cutline;
+	    end = ___mkd_chunk(&chunk, t, &f->flags);
+	    if ( chunk.cut != cut )
+		cutline = chunk.lines;
+	    if ( end && (prevline - 1 - at >= EDIT_LINES) ) {
+		EXPAND(ends) = end;
+		EXPAND(cuts) = at = prevline - 1;
+	    }
+	}
+
+	if ( (last+1 >= S(e->pieces)) || insync(doc, &chunk, &T(e->pieces)[last+1]) )
+	    break;
+
+	/* not yet;  try again with (twice) as many pieces
+	 */
+	if ( T(text.content) ) ___mkd_freeLines(T(text.content));
+	if ( text.title ) ___mkd_freeLine(text.title);
+	if ( text.author ) ___mkd_freeLine(text.author);
+	if ( text.date ) ___mkd_freeLine(text.date);
+	at = last;
+	last += (last - first) + 1;
+	if ( last >= S(e->pieces) )
+	    last = S(e->pieces) - 1;
+	gather(e, at+1, last, &raw);
+    }
+
+    /* don't leave a runt at the end of a long stretch
+     */
+    if ( S(cuts) && (chunk.lines - T(cuts)[S(cuts)-1] < EDIT_LINES) ) {
+	--S(cuts);
+	--S(ends);
+    }
+
+    if ( first == 0 ) {
+	if ( doc->title ) ___mkd_freeLine(doc->title);
+	if ( doc->author ) ___mkd_freeLine(doc->author);
+	if ( doc->date ) ___mkd_freeLine(doc->date);
+	doc->title = text.title;
+	doc->author = text.author;
+	doc->date = text.date;
+    }
+    header = text.title ? 3 : 0;
+
+    /* cut the new text into pieces
+     */
+    CREATE(fresh);
+    CREATE(jobs);
+    t = T(text.content);
+    for ( pos = line = i = 0; i <= S(cuts); i++ ) {
+	p = &EXPAND(fresh);
+	memset(p, 0, sizeof *p);
+	j = &EXPAND(jobs);
+	j->text = t;
+
+	at = pos;
+	if ( i < S(cuts) ) {
+	    for ( ; line < T(cuts)[i] + header; line++ )
+		pos = 1 + ((char*)memchr(T(raw)+pos, '\n', S(raw)-pos) - T(raw));
+	    next = T(ends)[i]->next;
+	    T(ends)[i]->next = 0;
+	    t = next;
+	}
+	else
+	    pos = S(raw);
+	SUFFIX(p->text, T(raw)+at, pos-at);
+    }
+
+    /* (step & time limits count across the whole update, so the pieces
+     * share the document's budget and are compiled one at a time)
+     */
+    threads = doc->budget.armed ? 1 : doc->threads;
+    for ( i=0; i < S(jobs); i++ ) {
+	j = &T(jobs)[i];
+	p = j->piece = &T(fresh)[i];
+
+	if ( j->text ) {
+	    memset(&chunk, 0, sizeof chunk);
+	    ___mkd_chunk(&chunk, j->text, &f->flags);
+	    p->opens = (chunk.tag != 0);
+	}
+
+	memset(&j->f, 0, sizeof j->f);
+	j->f.ref_prefix = f->ref_prefix;
+	j->f.protocols = f->protocols;
+	j->f.cb = f->cb;
+	COPY_FLAGS(j->f.flags, f->flags);
+	clear_mkd_flag(&j->f.flags, MKD_TOC);
+	if ( doc->budget.armed )
+	    j->f.budget = &doc->budget;
+	else {
+	    j->budget = doc->budget;
+	    j->f.budget = &j->budget;
+	}
+	CREATE(p->notes.note);
+	j->f.footnotes = &p->notes;
+    }
+
+    ___mkd_parallel(threads, S(jobs), compile_job, T(jobs));
+
+    for ( i=0; i < S(jobs); i++ ) {
+	j = &T(jobs)[i];
+	p = j->piece;
+
+	if ( !doc->budget.armed && j->budget.error && !doc->budget.error ) {
+	    doc->budget.error = j->budget.error;
+	    doc->budget.armed = 1;
+	}
+	p->last = lastof(p->code);
+	p->head = (p->code && p->code->typ == SOURCE) ? lastof(p->code->down) : 0;
+	p->tail = (p->last && p->last->typ == SOURCE) ? lastof(p->last->down) : 0;
+	p->unit = firstunit(p->code);
+    }
+
+    if ( !samenotes(T(e->pieces)+first, 1+last-first, T(fresh), S(fresh)) )
+	e->stale = 1;
+
+    /* and put them in place of the old ones
+     */
+    for ( i=first; i <= last; i++ ) {
+	forget(&T(e->pieces)[i]);
+	DELETE(T(e->pieces)[i].text);
+    }
+    if ( (grow = S(fresh) - (1+last-first)) > 0 )
+	RESERVE(e->pieces, grow);
+    memmove(T(e->pieces) + first + S(fresh), T(e->pieces) + last + 1,
+	    (S(e->pieces) - (last+1)) * sizeof T(e->pieces)[0]);
+    memcpy(T(e->pieces) + first, T(fresh), S(fresh) * sizeof T(fresh)[0]);
+    S(e->pieces) += grow;
+
+    DELETE(fresh);
+    DELETE(jobs);
+    DELETE(cuts);
+    DELETE(ends);
+    DELETE(raw);
+}
+
+
+/* clear out the header labels so ___mkd_uniquify() can give them out
+ * again
+ */
+static void
+unlabel(Paragraph *p)
+{
+    for ( ; p; p = p->next )
+	if ( p->typ == SOURCE )
+	    unlabel(p->down);
+	else if ( (p->typ == HDR) && p->label ) {
+	    free(p->label);
+	    p->label = 0;
+	}
+}
+
+
+/* put the pieces of the document back together
+ */
+static void
+assemble(Document *doc)
+{
+    struct mkd_edit *e = doc->edit;
+    MMIOT *f = doc->ctx;
+    ParagraphRoot d = { 0, 0 };
+    int i, j;
+
+    doc->code = T(d) = link_pieces(e);
+
+    if ( e->stale ) {
+	S(f->footnotes->note) = 0;
+	for ( i=0; i < S(e->pieces); i++ )
+	    for ( j=0; j < S(T(e->pieces)[i].notes.note); j++ )
+		EXPAND(f->footnotes->note) = T(T(e->pieces)[i].notes.note)[j];
+	qsort(T(f->footnotes->note), S(f->footnotes->note),
+			sizeof T(f->footnotes->note)[0],
+			(stfu)__mkd_footsort);
+    }
+
+    if ( is_flag_set(&(f->flags), MKD_TOC) && !is_flag_set(&(f->flags), MKD_STRICT) ) {
+	unlabel(doc->code);
+	___mkd_uniquify(&d, T(d));
+    }
+}
+
+
+/* compile an editable document in pieces (for mkd_compile())
+ */
+Paragraph *
+___mkd_edit_compile(Document *doc)
+{
+    struct mkd_edit *e = doc->edit;
+    int i;
+
+    /* the text is kept in the pieces, so the lines that were read
+     * in when the document was created aren't needed
+     */
+    if ( T(doc->content) )
+	___mkd_freeLines(T(doc->content));
+    T(doc->content) = E(doc->content) = 0;
+
+    for ( i=1; i < S(e->pieces); i++ ) {
+	gather(e, i, i, &T(e->pieces)[0].text);
+	DELETE(T(e->pieces)[i].text);
+    }
+    S(e->pieces) = 1;
+
+    e->stale = 1;
+    rebuild(doc, 0, 0);
+    assemble(doc);
+    return doc->code;
+}
+
+
+/* throw away the compiled document, but keep the text (for
+ * mkd_compile() when the flags change)
+ */
+void
+___mkd_edit_reset(Document *doc)
+{
+    struct mkd_edit *e = doc->edit;
+    int i;
+
+    unjoin(e);
+    for ( i=0; i < S(e->pieces); i++ )
+	forget(&T(e->pieces)[i]);
+    doc->code = 0;
+
+    /* (the document's footnotes belonged to the pieces)
+     */
+    if ( doc->ctx->footnotes )
+	S(doc->ctx->footnotes->note) = 0;
+}
+
+
+/* throw away everything (for mkd_cleanup())
+ */
+void
+___mkd_edit_free(Document *doc)
+{
+    struct mkd_edit *e = doc->edit;
+    int i;
+
+    ___mkd_edit_reset(doc);
+    for ( i=0; i < S(e->pieces); i++ )
+	DELETE(T(e->pieces)[i].text);
+    DELETE(e->pieces);
+    DELETE(e->links);
+    free(e);
+    doc->edit = 0;
+}
+
+
+/* replace `size` bytes at `offset` in a document made by mkd_edit_string()
+ * with `length` bytes of `text`.  If the document has been compiled, only
+ * the blocks around the change are compiled again, and the next
+ * mkd_document() only generates html for them.  Returns 0, or EOF if the
+ * document can't be edited, the change doesn't fit in it, or compiling
+ * it ran into one of its resource limits.
+ */
+int
+mkd_update(Document *doc, int offset, int size, const char *text, int length)
+{
+    struct mkd_edit *e;
+    struct mkd_piece *p;
+    struct string_stream about;
+    Cstring new;
+    double start = ___mkd_clock();
+    int first, last, at, end, total, i;
+    char *eol;
+
+    if ( !(doc && (e = doc->edit)) || (offset < 0) || (size < 0)
+				   || (length < 0) || (length && !text) )
+	return EOF;
+
+    for ( total=i=0; i < S(e->pieces); i++ )
+	total += S(T(e->pieces)[i].text);
+    if ( size > total - offset )
+	return EOF;
+
+    /* find the pieces the change falls in.  If it touches the first
+     * line of a piece, the piece before it is done again too, because
+     * the change might make that line carry on with it.
+     */
+    for ( at=first=0; (first < S(e->pieces)-1)
+		      && (at + S(T(e->pieces)[first].text) <= offset); first++ )
+	at += S(T(e->pieces)[first].text);
+
+    p = &T(e->pieces)[first];
+    eol = S(p->text) ? memchr(T(p->text), '\n', S(p->text)) : 0;
+    if ( (first > 0) && (!eol || offset <= at + (eol - T(p->text))) ) {
+	--first;
+	at -= S(T(e->pieces)[first].text);
+    }
+
+    for ( end = at + S(T(e->pieces)[last=first].text);
+		(last < S(e->pieces)-1) && (end < offset + size || end == offset); )
+	end += S(T(e->pieces)[++last].text);
+
+    CREATE(new);
+    gather(e, first, last, &new);
+    CLIP(new, offset-at, size);
+    if ( length ) {
+	RESERVE(new, length);
+	memmove(T(new) + (offset-at) + length, T(new) + (offset-at), S(new) - (offset-at));
+	memcpy(T(new) + (offset-at), text, length);
+	S(new) += length;
+    }
+    for ( i=first; i <= last; i++ )
+	S(T(e->pieces)[i].text) = 0;
+    DELETE(T(e->pieces)[first].text);
+    T(e->pieces)[first].text = new;
+
+    DELETE(doc->toc);
+    CREATE(doc->toc);
+    doc->html = 0;
+
+    if ( !doc->compiled ) {
+	/* just read it in again */
+	if ( T(doc->content) ) ___mkd_freeLines(T(doc->content));
+	if ( doc->title ) ___mkd_freeLine(doc->title);
+	if ( doc->author ) ___mkd_freeLine(doc->author);
+	if ( doc->date ) ___mkd_freeLine(doc->date);
+	T(doc->content) = E(doc->content) = 0;
+	doc->title = doc->author = doc->date = 0;
+
+	for ( i=1; i < S(e->pieces); i++ ) {
+	    gather(e, i, i, &T(e->pieces)[0].text);
+	    DELETE(T(e->pieces)[i].text);
+	}
+	S(e->pieces) = 1;
+	about.data = T(T(e->pieces)[0].text);
+	about.size = S(T(e->pieces)[0].text);
+	__mkd_populate(doc, (getc_func)__mkd_io_strget, &about, &e->flags);
+	return 0;
+    }
+
+    ___mkd_budget(&doc->budget);
+    unjoin(e);
+    rebuild(doc, first, last);
+    assemble(doc);
+    doc->stats.compile_time = ___mkd_clock() - start;
+
+    return doc->budget.error ? EOF : 0;
+}
@@ -27,10 +27,10 @@
  *          when someone attempts to feed it junk.
  *
  *          Emmatching is done after the input has been 
- *          processed into a STRING (f->Q) of text and
- *          emphasis blocks.   After ___mkd_emblock() finishes,
- *          it truncates f->Q and leaves the rendered paragraph
- *          if f->out.
+ *          processed into a run of text (f->Q) and a list
+ *          of the emphasis tokens in it (f->tokens).  After
+ *          ___mkd_emblock() finishes, it empties the queue
+ *          and leaves the rendered paragraph in f->out.
  */
 
 
@@ -42,21 +42,21 @@ empair(MMIOT *f, int first, int last, int match)
 {
     
     int i;
-    block *begin, *p;
+    emtoken *begin, *p;
 
-    begin = &T(f->Q)[first];
+    begin = &T(f->tokens)[first];
 
     for (i=first+1; i <= last; i++) {
-	p = &T(f->Q)[i];
+	p = &T(f->tokens)[i];
 
-	if ( (p->b_type != bTEXT) && (p->b_count <= 0) )
+	if ( p->count <= 0 )
 	    continue; /* break? */
 	
-	if ( p->b_type == begin->b_type ) {
-	    if ( p->b_count == match )	/* exact match */
+	if ( p->c == begin->c ) {
+	    if ( p->count == match )	/* exact match */
 		return i;
 
-	    if ( p->b_count > 2 )	/* fuzzy match */
+	    if ( p->count > 2 )		/* fuzzy match */
 		return i;
 	}
     }
@@ -65,19 +65,13 @@ empair(MMIOT *f, int first, int last, int match)
 
 
 /* emfill() -- if an emphasis token has leftover stars or underscores,
- *             convert them back into character and append them to b_text.
+ *             give up on them;  they'll be written out as characters.
  */
 static void
-emfill(block *p)
+emfill(emtoken *p)
 {
-    int j;
-
-    if ( p->b_type == bTEXT )
-	return;
-	
-    for (j=0; j < p->b_count; j++)
-	  EXPAND(p->b_text) = p->b_char;
-    p->b_count = 0;
+    p->fill += p->count;
+    p->count = 0;
 } /* emfill */
 
 
@@ -86,8 +80,8 @@ emclose(MMIOT *f, int first, int last)
 {
     int j;
 
-    for (j=first+1; j<last-1; j++)
-	emfill(&T(f->Q)[j]);
+    for (j=first+1; j<last; j++)
+	emfill(&T(f->tokens)[j]);
 }
 
 
@@ -106,10 +100,10 @@ static void emblock(MMIOT*,int,int);
 static void
 emmatch(MMIOT *f, int first, int last)
 {
-    block *start = &T(f->Q)[first];
+    emtoken *start = &T(f->tokens)[first];
     int e, e2, match;
 
-    switch (start->b_count) {
+    switch (start->count) {
     case 2: if ( e = empair(f,first,last,match=2) )
 		break;
     case 1: e = empair(f,first,last,match=1);
@@ -134,22 +128,25 @@ emmatch(MMIOT *f, int first, int last)
 	 * the emphasis markers for the block, then (tail) recursively
 	 * call ourself to match any remaining emphasis on this token.
 	 */
-	block *end = &T(f->Q)[e];
+	emtoken *end = &T(f->tokens)[e];
 
-	end->b_count -= match;
-	start->b_count -= match;
+	end->count -= match;
+	start->count -= match;
 
 	emblock(f, first, e);
 
-	PREFIX(start->b_text, emtags[match-1].open, emtags[match-1].size-1);
-	SUFFIX(end->b_post, emtags[match-1].close, emtags[match-1].size);
+	/* (the outermost tag is the last one opened, so opening tags
+	 * are put in from the back)
+	 */
+	T(f->tags)[start->tags + start->size - ++start->opened] = match;
+	T(f->tags)[end->tags + end->closed++] = match;
 
 	emmatch(f, first, last);
     }
 } /* emmatch */
 
 
-/* emblock() -- walk a blocklist, attempting to match emphasis
+/* emblock() -- walk a list of tokens, attempting to match emphasis
  */
 static void
 emblock(MMIOT *f, int first, int last)
@@ -157,32 +154,48 @@ emblock(MMIOT *f, int first, int last)
     int i;
     
     for ( i = first; i <= last; i++ )
-	if ( T(f->Q)[i].b_type != bTEXT )
-	    emmatch(f, i, last);
+	emmatch(f, i, last);
     emclose(f, first, last);
 } /* emblock */
 
 
-/* ___mkd_emblock() -- emblock a string of blocks, then concatenate the
- *                     resulting text onto f->out.
+/* ___mkd_emblock() -- emblock the queue, then write its text, with
+ *                     the tags put in, onto f->out.
  */
 void
 ___mkd_emblock(MMIOT *f)
 {
-    int i;
-    block *p;
+    int i, j, at;
+    emtoken *p;
+    struct emtags *tag;
 
-    emblock(f, 0, S(f->Q)-1);
-    
-    for (i=0; i < S(f->Q); i++) {
-	p = &T(f->Q)[i];
-	emfill(p);
-	
-	if ( S(p->b_post) ) { SUFFIX(f->out, T(p->b_post), S(p->b_post));
-			      DELETE(p->b_post); }
-	if ( S(p->b_text) ) { SUFFIX(f->out, T(p->b_text), S(p->b_text));
-			      DELETE(p->b_text); }
+    emblock(f, 0, S(f->tokens)-1);
+
+    ATAG(A_OUTPUT);
+    if ( S(f->out) + S(f->Q) >= ALLOCATED(f->out) )
+	RESERVE(f->out, S(f->out) + S(f->Q));
+
+    for (at=i=0; i < S(f->tokens); i++) {
+	p = &T(f->tokens)[i];
+
+	if ( p->at > at )
+	    SUFFIX(f->out, T(f->Q)+at, p->at-at);
+	at = p->at;
+
+	for (j=0; j < p->closed; j++) {
+	    tag = &emtags[T(f->tags)[p->tags+j]-1];
+	    SUFFIX(f->out, tag->close, tag->size);
+	}
+	for (j=p->size-p->opened; j < p->size; j++) {
+	    tag = &emtags[T(f->tags)[p->tags+j]-1];
+	    SUFFIX(f->out, tag->open, tag->size-1);
+	}
+	for (j=p->fill+p->count; j > 0; --j)
+	    EXPAND(f->out) = p->c;
     }
-    
-    S(f->Q) = 0;
+    if ( S(f->Q) > at )
+	SUFFIX(f->out, T(f->Q)+at, S(f->Q)-at);
+    AUNTAG();
+
+    S(f->Q) = S(f->tokens) = S(f->tags) = 0;
 } /* ___mkd_emblock */
@@ -33,8 +33,12 @@ int __mkd_footsort(Footnote *, Footnote *);
 static void
 push(char *bfr, int size, MMIOT *f)
 {
-    while ( size-- > 0 )
-	EXPAND(f->in) = *bfr++;
+    if ( size <= 0 )
+	return;
+
+    if ( S(f->in) + size >= ALLOCATED(f->in) )
+	RESERVE(f->in, S(f->in) + size);
+    SUFFIX(f->in, bfr, size);
 }
 
 
@@ -130,38 +134,39 @@ shift(MMIOT *f, int i)
 static void
 Qchar(int c, MMIOT *f)
 {
-    block *cur;
-
-    if ( S(f->Q) == 0 ) {
-	cur = &EXPAND(f->Q);
-	memset(cur, 0, sizeof *cur);
-	cur->b_type = bTEXT;
-    }
-    else
-	cur = &T(f->Q)[S(f->Q)-1];
-
-    EXPAND(cur->b_text) = c;
-
+    ATAG(A_QUEUE);
+    if ( S(f->Q) >= ALLOCATED(f->Q) )
+	RESERVE(f->Q, S(f->Q));
+    EXPAND(f->Q) = c;
+    AUNTAG();
 }
 
 
-/* Qstring()
+/* Qwrite()
  */
 static void
-Qstring(char *s, MMIOT *f)
+Qwrite(char *s, int size, MMIOT *f)
 {
-    while (*s)
-	Qchar(*s++, f);
+    if ( size <= 0 )
+	return;
+
+    /* (long runs of code come through here, so make room for them
+     * a lot at a time)
+     */
+    ATAG(A_QUEUE);
+    if ( S(f->Q) + size >= ALLOCATED(f->Q) )
+	RESERVE(f->Q, S(f->Q) + size);
+    SUFFIX(f->Q, s, size);
+    AUNTAG();
 }
 
 
-/* Qwrite()
+/* Qstring()
  */
 static void
-Qwrite(char *s, int size, MMIOT *f)
+Qstring(char *s, MMIOT *f)
 {
-    while (size-- > 0)
-	Qchar(*s++, f);
+    Qwrite(s, strlen(s), f);
 }
 
 
@@ -180,6 +185,44 @@ Qprintf(MMIOT *f, char *fmt, ...)
 }
 
 
+/* Vwrite() -- write text that can't have any emphasis in it (html
+ * blocks, code, and what the code formatter hands back.)  Unless there
+ * is emphasis in the queue waiting to be matched, it goes straight to
+ * the output instead of being copied into the queue and out again.
+ */
+static void
+Vwrite(char *s, int size, MMIOT *f)
+{
+    if ( size <= 0 )
+	return;
+
+    if ( S(f->tokens) ) {
+	Qwrite(s, size, f);
+	return;
+    }
+
+    /* (push out any text that's waiting in front of it first)
+     */
+    if ( S(f->Q) )
+	___mkd_emblock(f);
+
+    ATAG(A_OUTPUT);
+    if ( S(f->out) + size >= ALLOCATED(f->out) )
+	RESERVE(f->out, S(f->out) + size);
+    SUFFIX(f->out, s, size);
+    AUNTAG();
+}
+
+
+/* Vstring()
+ */
+static void
+Vstring(char *s, MMIOT *f)
+{
+    Vwrite(s, strlen(s), f);
+}
+
+
 /* Qanchor() prints out a suitable-for-id-tag version of a string
  */
 static void
@@ -194,14 +237,33 @@ Qanchor(char *name, MMIOT *f)
 static void
 Qem(MMIOT *f, char c, int count)
 {
-    block *p = &EXPAND(f->Q);
+    emtoken *p;
 
-    memset(p, 0, sizeof *p);
-    p->b_type = (c == '*') ? bSTAR : bUNDER;
-    p->b_char = c;
-    p->b_count = count;
+    /* emmatch() is quadratic in the number of tokens in a block
+     */
+    if ( LIMIT_OF(f, MKD_LIMIT_EMPHASIS)
+	    && (S(f->tokens) >= LIMIT_OF(f, MKD_LIMIT_EMPHASIS)) ) {
+	___mkd_overlimit(f, MKD_LIMIT_EMPHASIS);
+	return;
+    }
 
-    memset(&EXPAND(f->Q), 0, sizeof(block));
+    ATAG(A_QUEUE);
+    if ( S(f->tokens) >= ALLOCATED(f->tokens) )
+	RESERVE(f->tokens, S(f->tokens));
+    p = &EXPAND(f->tokens);
+    p->at = S(f->Q);
+    p->c = c;
+    p->size = p->count = count;
+    p->fill = p->closed = p->opened = 0;
+    p->tags = S(f->tags);
+
+    if ( S(f->tags) + count >= ALLOCATED(f->tags) )
+	RESERVE(f->tags, S(f->tags) + count);
+    S(f->tags) += count;
+    AUNTAG();
+
+    if ( f->stats )
+	f->stats->emphasis++;
 }
 
 
@@ -213,6 +275,15 @@ ___mkd_reparse(char *bfr, int size, mkd_flag_t* flags, MMIOT *f, char *esc)
     MMIOT sub;
     struct escaped e;
 
+    if ( f->budget ) {
+	if ( LIMIT_OF(f, MKD_LIMIT_REPARSE)
+		&& (f->budget->reparse >= LIMIT_OF(f, MKD_LIMIT_REPARSE)) )
+	    ___mkd_overlimit(f, MKD_LIMIT_REPARSE);
+	if ( f->budget->error )
+	    return;
+	f->budget->reparse++;
+    }
+
     ___mkd_initmmiot(&sub, f->footnotes);
 
     COPY_FLAGS(sub.flags, f->flags);
@@ -220,6 +291,11 @@ ___mkd_reparse(char *bfr, int size, mkd_flag_t* flags, MMIOT *f, char *esc)
 	ADD_FLAGS(&sub.flags, flags);
     sub.cb = f->cb;
     sub.ref_prefix = f->ref_prefix;
+    sub.protocols = f->protocols;
+    if ( sub.stats = f->stats )
+	sub.stats->reparses++;
+    sub.budget = f->budget;
+    sub.refs = f->refs;
 
     if ( esc ) {
 	sub.esc = &e;
@@ -236,7 +312,11 @@ ___mkd_reparse(char *bfr, int size, mkd_flag_t* flags, MMIOT *f, char *esc)
     text(&sub);
     ___mkd_emblock(&sub);
 
-    Qwrite(T(sub.out), S(sub.out), f);
+    if ( LIMIT_OF(f, MKD_LIMIT_OUTPUT)
+	    && (S(sub.out) > LIMIT_OF(f, MKD_LIMIT_OUTPUT)) )
+	___mkd_overlimit(f, MKD_LIMIT_OUTPUT);
+    else
+	Vwrite(T(sub.out), S(sub.out), f);
     /* inherit the last character printed from the reparsed
      * text;  this way superscripts can work when they're
      * applied to something embedded in a link
@@ -244,6 +324,8 @@ ___mkd_reparse(char *bfr, int size, mkd_flag_t* flags, MMIOT *f, char *esc)
     f->last = sub.last;
 
     ___mkd_freemmiot(&sub, f->footnotes);
+    if ( f->budget )
+	f->budget->reparse--;
 }
 
 
@@ -271,6 +353,7 @@ static void
 puturl(char *s, int size, MMIOT *f, int display)
 {
     unsigned char c;
+    int run;
 
     if ( size && s[0] == '<' && s[size-1] == '>' ) {
 	/* urls encased in <> need to have the <>'s removed */
@@ -279,6 +362,14 @@ puturl(char *s, int size, MMIOT *f, int display)
     }
 
     while ( size-- > 0 ) {
+	/* copy out the characters that don't need escaping in one piece
+	 */
+	if ( (run = ___mkd_clean(s, size+1, display ? ESC_URL : ESC_URL|ESC_SPACE)) ) {
+	    Qwrite(s, run, f);
+	    s += run;
+	    if ( (size -= run) < 0 )
+		break;
+	}
 	c = *s++;
 
 	if ( c == '\\' && size-- > 0 ) {
@@ -317,12 +408,92 @@ eatspace(MMIOT *f)
 }
 
 
+/* find where every [ and ( in the input is closed (or -1 if it
+ * isn't), all in one pass, so a bracket that's never closed doesn't
+ * send parenthetical() to the end of the input every time it's
+ * tried.  A bracket with a \ in front of it doesn't count.
+ */
+static void
+brackets(MMIOT *f)
+{
+    int *match, i, up;
+    int square = -1, round = -1;	/* the innermost open ones */
+
+    S(f->brackets) = 0;
+    RESERVE(f->brackets, S(f->in));
+    S(f->brackets) = S(f->in);
+    match = T(f->brackets);
+    f->lastparen = -1;
+
+    /* (the brackets that are still open are chained together through
+     * match[] until they're closed)
+     */
+    for ( i=0; i < S(f->in); i++ ) {
+	match[i] = -1;
+	if ( (i > 0) && (T(f->in)[i-1] == '\\') )
+	    continue;
+
+	switch ( T(f->in)[i] ) {
+	case '[':   match[i] = square;
+		    square = i;
+		    break;
+	case '(':   match[i] = round;
+		    round = i;
+		    break;
+	case ']':   if ( square >= 0 ) {
+			up = match[square];
+			match[square] = i;
+			square = up;
+		    }
+		    break;
+	case ')':   if ( round >= 0 ) {
+			up = match[round];
+			match[round] = i;
+			round = up;
+		    }
+		    break;
+	}
+    }
+    for ( ; square >= 0; square = up ) {
+	up = match[square];
+	match[square] = -1;
+    }
+    for ( ; round >= 0; round = up ) {
+	up = match[round];
+	match[round] = -1;
+    }
+
+    for ( i = S(f->in)-1; i >= 0; --i )
+	if ( T(f->in)[i] == ')' ) {
+	    f->lastparen = i;
+	    break;
+	}
+}
+
+
 /* (match (a (nested (parenthetical (string.)))))
  */
 static int
 parenthetical(int in, int out, MMIOT *f)
 {
     int size, indent, c;
+    int open = mmiottell(f) - 1;
+
+    /* the [ or ( that was just read can be looked up
+     */
+    if ( ((in == '[' && out == ']') || (in == '(' && out == ')'))
+	    && (open >= 0) && (T(f->in)[open] == in)
+	    && !((open > 0) && (T(f->in)[open-1] == '\\')) ) {
+	if ( S(f->brackets) != S(f->in) )
+	    brackets(f);
+
+	if ( T(f->brackets)[open] < 0 ) {
+	    f->isp = S(f->in);
+	    return EOF;
+	}
+	f->isp = T(f->brackets)[open] + 1;
+	return f->isp - open - 2;
+    }
 
     for ( indent=1,size=0; indent; size++ ) {
 	if ( (c = pull(f)) == EOF )
@@ -512,35 +683,6 @@ linkyurl(MMIOT *f, int image, Footnote *p)
 
 
 
-/* prefixes for <automatic links>
- */
-static struct _protocol {
-    char *name;
-    int   nlen;
-} protocol[] = { 
-#define _aprotocol(x)	{ x, (sizeof x)-1 }
-    _aprotocol( "https:" ), 
-    _aprotocol( "http:" ), 
-    _aprotocol( "news:" ),
-    _aprotocol( "ftp:" ), 
-#undef _aprotocol
-};
-#define NRPROTOCOLS	(sizeof protocol / sizeof protocol[0])
-
-
-static int
-isautoprefix(char *text, int size)
-{
-    int i;
-    struct _protocol *p;
-
-    for (i=0, p=protocol; i < NRPROTOCOLS; i++, p++)
-	if ( (size >= p->nlen) && strncasecmp(text, p->name, p->nlen) == 0 )
-	    return 1;
-    return 0;
-}
-
-
 /*
  * all the tag types that linkylinky can produce are
  * defined by this structure. 
@@ -611,7 +753,7 @@ printlinkyref(MMIOT *f, linkytype *tag, char *link, int size)
     Qstring(tag->link_pfx, f);
 
     if ( tag->kind & IS_URL ) {
-	if ( f->cb && f->cb->e_url && (edit = (*f->cb->e_url)(link, size, f->cb->e_data)) ) {
+	if ( f->cb && f->cb->e_url && (edit = ___mkd_callback(f, f->cb->e_url, link, size, f->cb->e_data)) ) {
 
 	    puturl(edit, strlen(edit), f, 0);
 	    if ( f->cb->e_free ) (*f->cb->e_free)(edit, f->cb->e_data);
@@ -628,7 +770,7 @@ printlinkyref(MMIOT *f, linkytype *tag, char *link, int size)
 
     Qstring(tag->link_sfx, f);
 
-    if ( f->cb && f->cb->e_flags && (edit = (*f->cb->e_flags)(link, size, f->cb->e_data)) ) {
+    if ( f->cb && f->cb->e_flags && (edit = ___mkd_callback(f, f->cb->e_flags, link, size, f->cb->e_data)) ) {
 	Qchar(' ', f);
 	Qstring(edit, f);
 	if ( f->cb->e_free ) (*f->cb->e_free)(edit, f->cb->e_data);
@@ -646,11 +788,21 @@ p_or_nothing(MMIOT *p)
 }
 
 
+/* while a document is being rendered in parallel, footnote numbers
+ * are written out as placeholders and filled in when the pieces are
+ * put back together (anything that only looks like one is left alone)
+ */
+#define FN_OPEN		'\001'
+#define FN_CLOSE	'\002'
+
+
 /* php markdown extra/daring fireball style print footnotes
  */
 static int
 extra_linky(MMIOT *f, Cstring text, Footnote *ref)
 {
+    char number[24];
+
     if ( ref->fn_flags & REFERENCED )
 	return 0;
 
@@ -659,9 +811,18 @@ extra_linky(MMIOT *f, Cstring text, Footnote *ref)
     else {
 	ref->fn_flags |= REFERENCED;
 	ref->refnumber = ++ f->footnotes->reference;
-	Qprintf(f, "<sup id=\"%sref:%d\"><a href=\"#%s:%d\" rel=\"footnote\">%d</a></sup>",
-		p_or_nothing(f), ref->refnumber,
-		p_or_nothing(f), ref->refnumber, ref->refnumber);
+	if ( f->footnotes->deferred )
+	    snprintf(number, sizeof number, "%c%d%c", FN_OPEN, ref->refnumber, FN_CLOSE);
+	else
+	    snprintf(number, sizeof number, "%d", ref->refnumber);
+	/* (written in pieces so a long prefix won't be cut off by
+	 * Qprintf())
+	 */
+	Qstring("<sup id=\"", f);
+	Qstring(p_or_nothing(f), f);
+	Qprintf(f, "ref:%s\"><a href=\"#", number);
+	Qstring(p_or_nothing(f), f);
+	Qprintf(f, ":%s\" rel=\"footnote\">%s</a></sup>", number, number);
     }
     return 1;
 } /* extra_linky */
@@ -672,7 +833,7 @@ extra_linky(MMIOT *f, Cstring text, Footnote *ref)
  * protocol (or no protocol at all)
  */
 static int
-safelink(Cstring link)
+safelink(Cstring link, MMIOT *f)
 {
     char *p, *colon;
 
@@ -689,7 +850,7 @@ safelink(Cstring link)
 	if ( !(isalnum(*p) || *p == '.' || *p == '+' || *p == '-') )
 	    return 1;
 
-    return isautoprefix(T(link), S(link));
+    return ___mkd_isprotocol(f, T(link), S(link));
 }
 
 
@@ -709,7 +870,7 @@ linkyformat(MMIOT *f, Cstring text, int image, Footnote *ref)
 	    return 0;
     }
     else if ( is_flag_set(&f->flags, MKD_SAFELINK) && !is_flag_set(&f->flags, MKD_STRICT)
-						   && !safelink(ref->link) )
+						   && !safelink(ref->link, f) )
 	/* if MKD_SAFELINK, only accept links that are local or
 	 * a well-known protocol
 	 */
@@ -746,6 +907,8 @@ linkyformat(MMIOT *f, Cstring text, int image, Footnote *ref)
     else
 	Qwrite(T(ref->link) + tag->szpat, S(ref->link) - tag->szpat, f);
 
+    if ( f->stats )
+	f->stats->links++;
     return 1;
 } /* linkyformat */
 
@@ -769,7 +932,11 @@ linkylinky(int image, MMIOT *f)
     if ( linkylabel(f, &name) ) {
 	if ( peek(f,1) == '(' ) {
 	    pull(f);
-	    if ( linkyurl(f, image, &key) )
+	    /* (a url can't end without a ) somewhere after it)
+	     */
+	    if ( S(f->brackets) != S(f->in) )
+		brackets(f);
+	    if ( (mmiottell(f) <= f->lastparen) && linkyurl(f, image, &key) )
 		status = linkyformat(f, name, image, &key);
 	}
 	else {
@@ -804,6 +971,15 @@ linkylinky(int image, MMIOT *f)
 		    S(key.tag) = S(name);
 		}
 
+		if ( f->refs ) {
+		    /* (remember what was looked up, so a cached copy of
+		     * this block can tell if the link has changed)
+		     */
+		    EXPAND(*f->refs) = extra_footnote ? '^' : '[';
+		    SUFFIX(*f->refs, T(key.tag), S(key.tag));
+		    EXPAND(*f->refs) = 0;
+		}
+
 		if ( ref = bsearch(&key, T(f->footnotes->note),
 					 S(f->footnotes->note),
 					 sizeof key, (stfu)__mkd_footsort) ) {
@@ -871,6 +1047,91 @@ nrticks(int offset, int tickchar, MMIOT *f)
 } /* nrticks */
 
 
+/* the two-character latex delimiters that close what mathhandler()
+ * opens, in the order of ->lastmath[]
+ */
+static char *mathends[] = { "$$", "\\)", "\\]" };
+#define NRMATHENDS	(sizeof mathends / sizeof mathends[0])
+
+
+static int
+runorder(struct run *a, struct run *b)
+{
+    if ( a->c != b->c )
+	return a->c - b->c;
+    if ( a->size != b->size )
+	return a->size - b->size;
+    return a->at - b->at;
+}
+
+
+/* find every run of ` and ~ in the input (and sort a copy of them by
+ * character and size), and the last of each closing latex delimiter,
+ * so tickhandler() and mathhandler() don't have to look through the
+ * rest of the block every time they're tried
+ */
+static void
+runs(MMIOT *f)
+{
+    struct run *r;
+    int i, j, c;
+
+    S(f->runs) = 0;
+    for ( i=0; i < S(f->in); i = j ) {
+	c = T(f->in)[i];
+	for ( j=i+1; (j < S(f->in)) && (T(f->in)[j] == c); j++ )
+	    ;
+	if ( (c == '`') || (c == '~') ) {
+	    if ( S(f->runs) >= ALLOCATED(f->runs) )
+		RESERVE(f->runs, S(f->runs));
+	    r = &EXPAND(f->runs);
+	    r->at = i;
+	    r->size = j-i;
+	    r->c = c;
+	}
+    }
+
+    S(f->bysize) = 0;
+    if ( S(f->runs) ) {
+	SUFFIX(f->bysize, T(f->runs), S(f->runs));
+	qsort(T(f->bysize), S(f->bysize), sizeof T(f->bysize)[0], (stfu)runorder);
+    }
+
+    for ( j=0; j < NRMATHENDS; j++ ) {
+	f->lastmath[j] = -1;
+	for ( i = S(f->in)-2; i >= 0; --i )
+	    if ( (T(f->in)[i] == mathends[j][0]) && (T(f->in)[i+1] == mathends[j][1]) ) {
+		f->lastmath[j] = i;
+		break;
+	    }
+    }
+    f->indexed = S(f->in) + 1;
+}
+
+
+/* where the first run in ->bysize that sorts after a run of `size`
+ * `c`s at `at` is
+ */
+static int
+runafter(MMIOT *f, int c, int size, int at)
+{
+    struct run key;
+    int lo = 0, hi = S(f->bysize), mid;
+
+    key.c = c;
+    key.size = size;
+    key.at = at;
+    while ( lo < hi ) {
+	mid = (lo + hi) / 2;
+	if ( runorder(&T(f->bysize)[mid], &key) <= 0 )
+	    lo = mid+1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+
 /* matchticks() -- match a certain # of ticks, and if that fails
  *                 match the largest subset of those ticks.
  *
@@ -880,27 +1141,36 @@ nrticks(int offset, int tickchar, MMIOT *f)
 static int
 matchticks(MMIOT *f, int tickchar, int ticks, int *endticks)
 {
-    int size, count, c;
-    int subsize=0, subtick=0;
+    int open = mmiottell(f) - 1;
+    int i, size;
+    struct run *r;
 
-    *endticks = ticks;
-    for (size = 0; (c=peek(f,size+ticks)) != EOF; size ++) {
-	if ( (c == tickchar) && ( count = nrticks(size+ticks,tickchar,f)) ) {
-	    if ( count == ticks )
-		return size;
-	    else if ( count ) {
-		if ( (count > subtick) && (count < ticks) ) {
-		    subsize = size;
-		    subtick = count;
-		}
-		size += count;
+    if ( f->indexed != S(f->in) + 1 )
+	runs(f);
+
+    /* the first run of the same size after this one, or (if there
+     * isn't one) the first of the longest shorter runs after it.
+     * (This run starts at or before `open`, so the runs after it are
+     * the ones that sort after a run at `open`.)
+     */
+    for ( size = ticks; size > 0; size = r->size ) {
+	i = runafter(f, tickchar, size, open);
+	if ( i < S(f->bysize) ) {
+	    r = &T(f->bysize)[i];
+	    if ( (r->c == tickchar) && (r->size == size) ) {
+		*endticks = size;
+		return r->at - (open + ticks);
 	    }
 	}
+	/* (on to the longest size that's shorter than this one)
+	 */
+	if ( (i = runafter(f, tickchar, size, -1) - 1) < 0 )
+	    break;
+	r = &T(f->bysize)[i];
+	if ( r->c != tickchar )
+	    break;
     }
-    if ( subsize ) {
-	*endticks = subtick;
-	return subsize;
-    }
+    *endticks = ticks;
     return 0;
 } /* matchticks */
 
@@ -912,15 +1182,30 @@ matchticks(MMIOT *f, int tickchar, int ticks, int *endticks)
 static void
 code(MMIOT *f, char *s, int length)
 {
-    int i,c;
+    int i,c,run;
+
+    for ( i=0; i < length; i++ ) {
+	/* copy out the characters that don't need escaping in one piece
+	 */
+	if ( (run = ___mkd_clean(s+i, length-i, ESC_CODE)) ) {
+	    Vwrite(s+i, run, f);
+	    if ( (i += run) >= length )
+		break;
+	}
 
-    for ( i=0; i < length; i++ )
 	if ( (c = s[i]) == MKD_EOLN)  /* expand back to 2 spaces */
-	    Qstring("  ", f);
-	else if ( c == '\\' && (i < length-1) && escaped(f, s[i+1]) )
-	    cputc(s[++i], f);
-	else
-	    cputc(c, f);
+	    Vstring("  ", f);
+	else {
+	    if ( c == '\\' && (i < length-1) && escaped(f, s[i+1]) )
+		c = s[++i];
+	    switch (c) {
+	    case '&':   Vstring("&amp;", f); break;
+	    case '>':   Vstring("&gt;", f); break;
+	    case '<':   Vstring("&lt;", f); break;
+	    default :   Vwrite(s+i, 1, f); break;
+	    }
+	}
+    }
 } /* code */
 
 
@@ -1034,13 +1319,17 @@ process_possible_link(MMIOT *f, int size)
 	Qstring("\">", f);
 	mangle(text+mailto, size-mailto, f);
 	Qstring("</a>", f);
+	if ( f->stats )
+	    f->stats->links++;
 	return 1;
     }
-    else if ( isautoprefix(text, size) ) {
+    else if ( ___mkd_isprotocol(f, text, size) ) {
 	printlinkyref(f, &linkt, text, size);
 	Qchar('>', f);
 	puturl(text,size,f, 1);
 	Qstring("</a>", f);
+	if ( f->stats )
+	    f->stats->links++;
 	return 1;
     }
     return 0;
@@ -1123,12 +1412,36 @@ maybe_tag_or_link(MMIOT *f)
 /* autolinking means that all inline html is <a href'ified>.   A
  * autolink url is alphanumerics, slashes, periods, underscores,
  * the at sign, colon, and the % character.
+ *
+ * Most words can't be links, so they're turned away before looking
+ * for where a link would end:  a link starts with a protocol (or
+ * mailto:) or it's an address, where the run of characters that can
+ * come before the @ in an address is followed by one.  `plain` is
+ * the last run that wasn't, so it isn't looked at again for every
+ * character in it.
  */
 static int
-maybe_autolink(MMIOT *f)
+maybe_autolink(MMIOT *f, int plain[2])
 {
     register int c;
-    int size;
+    int size, here = mmiottell(f);
+    int left = S(f->in) - here;
+    char *text = cursor(f);
+
+    if ( !___mkd_isprotocol(f, text, left)
+	    && !((left > 7) && strncasecmp(text, "mailto:", 7) == 0) ) {
+	if ( (here >= plain[0]) && (here < plain[1]) )
+	    return 0;
+
+	for ( size=0; (c=peek(f, size+1)) != EOF; size++ )
+	    if ( !(isalnum(c) || strchr("._-+*", c)) )
+		break;
+	if ( c != '@' ) {
+	    plain[0] = here;
+	    plain[1] = here + size;
+	    return 0;
+	}
+    }
 
     /* greedily scan forward for the end of a legitimate link.
      */
@@ -1231,6 +1544,33 @@ static struct smarties {
 } ;
 #define NRSMART ( sizeof smarties / sizeof smarties[0] )
 
+/* where the smarties[] that start with each character start (plus one,
+ * so 0 means no pattern starts with it), or NOQUOTE for the quotes that
+ * aren't the first character of any pattern.  This has to be kept in
+ * step with smarties[], where all of the patterns that start with the
+ * same character are next to each other.
+ */
+#define NOQUOTE	255
+
+static const unsigned char smartstart[256] = {
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 00 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 10 */
+      0,   0, 255,   0,   0,   0,  20,   1,  12,   0,   0,   0,   0,   8,  10,   0,	/* 20 */
+      0,  17,   0,  15,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 30 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 40 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 50 */
+    255,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 60 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 70 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 80 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* 90 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* a0 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* b0 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* c0 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* d0 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* e0 */
+      0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,	/* f0 */
+} ;
+
 
 /* Smarty-pants-style chrome for quotes, -, ellipses, and (r)(c)(tm)
  */
@@ -1239,13 +1579,11 @@ smartypants(int c, int *flags, MMIOT *f)
 {
     int i;
 
-    if ( is_flag_set(&f->flags, MKD_NOPANTS) 
-      || is_flag_set(&f->flags, MKD_TAGTEXT)
-      || is_flag_set(&f->flags, IS_LABEL) )
+    if ( !smartstart[c] || DEGRADED(f) )
 	return 0;
 
-    for ( i=0; i < NRSMART; i++)
-	if ( (c == smarties[i].c0) && islike(f, smarties[i].pat) ) {
+    for ( i=smartstart[c]-1; (i < NRSMART) && (c == smarties[i].c0); i++)
+	if ( islike(f, smarties[i].pat) ) {
 	    if ( smarties[i].entity )
 		Qprintf(f, "&%s;", smarties[i].entity);
 	    shift(f, smarties[i].shift);
@@ -1253,7 +1591,6 @@ smartypants(int c, int *flags, MMIOT *f)
 	}
 
     switch (c) {
-    case '<' :  return 0;
     case '\'':  if ( smartyquote(flags, 's', f) ) return 1;
 		break;
 
@@ -1293,6 +1630,13 @@ mathhandler(MMIOT *f, int e1, int e2)
 {
     int i = 0;
 
+    /* (there's no point in looking if it isn't closed after here)
+     */
+    if ( f->indexed != S(f->in) + 1 )
+	runs(f);
+    if ( f->lastmath[(e2 == '$') ? 0 : (e2 == ')') ? 1 : 2] < mmiottell(f) )
+	return 0;
+
     while(peek(f, ++i) != EOF) {
 	if (peek(f, i) == e1 && peek(f, i+1) == e2) {
 	    cputc(peek(f,-1), f);
@@ -1342,20 +1686,27 @@ text(MMIOT *f)
     int c, j;
     int rep;
     int smartyflags = 0;
-
+    int pants = !( is_flag_set(&f->flags, MKD_NOPANTS)
+		|| is_flag_set(&f->flags, MKD_TAGTEXT)
+		|| is_flag_set(&f->flags, IS_LABEL) );
+    int autolink = is_flag_set(&f->flags, MKD_AUTOLINK)
+		&& !is_flag_set(&f->flags, MKD_STRICT)
+		&& !is_flag_set(&f->flags, MKD_NOLINKS);
+    int plain[2] = { 0, 0 };	/* (see maybe_autolink()) */
 
     while (1) {
-	if ( is_flag_set(&f->flags, MKD_AUTOLINK) && !is_flag_set(&f->flags, MKD_STRICT)
-						  && isalpha(peek(f,1))
-						  && !tag_text(f) )
-	    maybe_autolink(f);
+	if ( OUT_OF_BUDGET(f) )
+	    break;
+
+	if ( autolink && isalpha(peek(f,1)) && !tag_text(f) && !DEGRADED(f) )
+	    maybe_autolink(f, plain);
 
 	c = pull(f);
 
 	if (c == EOF)
 	    break;
 
-	if ( smartypants(c, &smartyflags, f) )
+	if ( pants && smartypants(c, &smartyflags, f) )
 	    continue;
 	switch (c) {
 	case 0:     break;
@@ -1554,6 +1905,8 @@ text(MMIOT *f)
     }
     /* truncate the input string after we've finished processing it */
     S(f->in) = f->isp = 0;
+    S(f->brackets) = 0;
+    f->indexed = 0;
 } /* text */
 
 
@@ -1590,27 +1943,42 @@ static char* alignments[] = { "", " style=\"text-align:center;\"",
 				  " style=\"text-align:left;\"",
 				  " style=\"text-align:right;\"" };
 
-typedef STRING(int) Istring;
 
+/* how long a line is without its trailing whitespace (it's not
+ * trimmed off with ___mkd_tidy() because the compiled document can
+ * be being rendered on other threads)
+ */
 static int
-splat(Line *p, char *block, Istring align, int force, MMIOT *f)
+tidied(Line *t)
+{
+    int size = S(t->text);
+
+    while ( size && isspace(T(t->text)[size-1]) )
+	--size;
+    return size;
+}
+
+
+static int
+splat(Line *p, int lead, char *block, Istring align, int force, MMIOT *f)
 {
     int first,
-	idx = p->dle,
-	colno = 0;
+	idx = p->dle + lead,
+	colno = 0,
+	end;
 
 
-    ___mkd_tidy(&p->text);
-    if ( T(p->text)[S(p->text)-1] == '|' )
-	--S(p->text);
+    end = tidied(p);
+    if ( T(p->text)[end-1] == '|' )
+	--end;
 
     Qstring("<tr>\n", f);
-    while ( idx < S(p->text) ) {
+    while ( idx < end ) {
 	first = idx;
 	if ( force && (colno >= S(align)-1) )
-	    idx = S(p->text);
+	    idx = end;
 	else
-	    while ( (idx < S(p->text)) && (T(p->text)[idx] != '|') ) {
+	    while ( (idx < end) && (T(p->text)[idx] != '|') ) {
 		if ( T(p->text)[idx] == '\\' )
 		    ++idx;
 		++idx;
@@ -1642,6 +2010,7 @@ printtable(Paragraph *pp, MMIOT *f)
     Line *hdr, *dash, *body;
     Istring align;
     int hcols,start;
+    int lead;
     char *p;
     enum e_alignments it;
 
@@ -1649,19 +2018,16 @@ printtable(Paragraph *pp, MMIOT *f)
     dash= hdr->next;
     body= dash->next;
 
-    if ( T(hdr->text)[hdr->dle] == '|' ) {
-	/* trim leading pipe off all lines
-	 */
-	Line *r;
-	for ( r = pp->text; r; r = r->next )
-	    r->dle ++;
-    }
+    /* skip over the leading pipe on every line (without touching
+     * the lines, so the table can be generated again)
+     */
+    lead = (T(hdr->text)[hdr->dle] == '|');
 
     /* figure out cell alignments */
 
     CREATE(align);
 
-    for (p=T(dash->text), start=dash->dle; start < S(dash->text); ) {
+    for (p=T(dash->text), start=dash->dle+lead; start < S(dash->text); ) {
 	char first, last;
 	int end;
 
@@ -1683,7 +2049,7 @@ printtable(Paragraph *pp, MMIOT *f)
 
     Qstring("<table>\n", f);
     Qstring("<thead>\n", f);
-    hcols = splat(hdr, "th", align, 0, f);
+    hcols = splat(hdr, lead, "th", align, 0, f);
     Qstring("</thead>\n", f);
 
     if ( hcols < S(align) )
@@ -1694,7 +2060,7 @@ printtable(Paragraph *pp, MMIOT *f)
 
     Qstring("<tbody>\n", f);
     for ( ; body; body = body->next)
-	splat(body, "td", align, 1, f);
+	splat(body, lead, "td", align, 1, f);
     Qstring("</tbody>\n", f);
     Qstring("</table>\n", f);
 
@@ -1710,7 +2076,7 @@ code_callback(Line *t, char *lang, int fenced, Line **ret, MMIOT *f)
     if ( f->cb->e_codefmt ) {
 	/* external code block formatter;  copy the text into a buffer,
 	 * call the formatter to style it, then dump that styled text
-	 * directly to the queue
+	 * directly to the output
 	 */
 	char *text;
 	char *fmt;
@@ -1730,11 +2096,11 @@ code_callback(Line *t, char *lang, int fenced, Line **ret, MMIOT *f)
 	text[copy_p] = 0;
 
 
-	fmt = (*(f->cb->e_codefmt))(text, copy_p, (lang && lang[0]) ? lang : 0);
+	fmt = ___mkd_callback(f, f->cb->e_codefmt, text, copy_p, (lang && lang[0]) ? lang : 0);
 	free(text);
 
 	if ( fmt ) {
-	    Qwrite(fmt, strlen(fmt), f);
+	    Vstring(fmt, f);
 	    if ( f->cb->e_free )
 		(*(f->cb->e_free))(fmt, f->cb->e_data);
 	    *ret = t;
@@ -1764,7 +2130,7 @@ printfenced(Line *t, MMIOT *f)
     if ( !code_callback(t, t->fence_class, 1, &ret, f) ) {
 	while ( (t = t->next) && t->is_fenced ) {
 	    code(f, T(t->text), S(t->text));
-	    Qchar('\n', f);
+	    Vstring("\n", f);
 	}
 	ret = t;
     }
@@ -1781,6 +2147,16 @@ printblock(Paragraph *pp, MMIOT *f)
     static char *End[]   = { "", "</p>","</div>" };
     Line *t = pp->text;
     int align = pp->align;
+    int size;
+
+    /* make room for the whole paragraph (and the newlines between its
+     * lines) at once
+     */
+    for ( size=0; t; t = t->next )
+	size += S(t->text) + 1;
+    if ( S(f->in) + size >= ALLOCATED(f->in) )
+	RESERVE(f->in, size);
+    t = pp->text;
 
     Qstring(Begin[align], f);
     do {
@@ -1797,8 +2173,7 @@ printblock(Paragraph *pp, MMIOT *f)
 		pushc('\n', f);
 	    }
 	    else {
-		___mkd_tidy(&t->text);
-		push(T(t->text), S(t->text), f);
+		push(T(t->text), tidied(t), f);
 		if ( t->next )
 		    pushc('\n', f);
 	    }
@@ -1830,11 +2205,11 @@ printcode(Line *t, char *lang, MMIOT *f)
 	for ( blanks = 0; t ; t = t->next ) {
 	    if ( S(t->text) > t->dle ) {
 		while ( blanks ) {
-		    Qchar('\n', f);
+		    Vstring("\n", f);
 		    --blanks;
 		}
 		code(f, T(t->text), S(t->text));
-		Qchar('\n', f);
+		Vstring("\n", f);
 	    }
 	    else blanks++;
 	}
@@ -1851,23 +2226,64 @@ printhtml(Line *t, MMIOT *f)
     for ( blanks=0; t ; t = t->next )
 	if ( S(t->text) ) {
 	    for ( ; blanks; --blanks ) 
-		Qchar('\n', f);
+		Vstring("\n", f);
 
-	    Qwrite(T(t->text), S(t->text), f);
-	    Qchar('\n', f);
+	    Vwrite(T(t->text), S(t->text), f);
+	    Vstring("\n", f);
 	}
 	else
 	    blanks++;
 }
 
 
+/* should we stop generating html?  (because the output has grown
+ * past its limit, or some other limit has been exceeded, or because
+ * the sink we're writing to has failed.)
+ */
+static int
+halted(MMIOT *f)
+{
+    long size = S(f->out) + (f->sink ? f->sink->written : 0);
+
+    if ( LIMIT_OF(f, MKD_LIMIT_OUTPUT) && (size > LIMIT_OF(f, MKD_LIMIT_OUTPUT)) )
+	return ___mkd_overlimit(f, MKD_LIMIT_OUTPUT);
+    return FAILED(f) || (f->sink && f->sink->error);
+}
+
+
+/* blocks are gathered into chunks of at least this size for mkd_iovec()
+ */
+#define MKD_IOV_CHUNK	4096
+
+/* pass the finished html along to the sink if there is one, or
+ * note where the block ended if we're keeping track of that
+ */
+static void
+flush(MMIOT *f)
+{
+    int last;
+
+    if ( halted(f) )
+	return;
+
+    if ( f->sink )
+	___mkd_flush(&f->out, f->sink);
+    else if ( f->blocks ) {
+	last = S(*f->blocks) ? T(*f->blocks)[S(*f->blocks)-1] : 0;
+	if ( S(f->out) - last >= MKD_IOV_CHUNK )
+	    EXPAND(*f->blocks) = S(f->out);
+    }
+}
+
+
 static void
 htmlify_paragraphs(Paragraph *p, MMIOT *f)
 {
     ___mkd_emblock(f);
 
-    while (( p = display(p, f) )) {
+    while ( !halted(f) && (p = display(p, f)) ) {
 	___mkd_emblock(f);
+	flush(f);
 	Qstring("\n\n", f);
     }
 }
@@ -1926,7 +2342,7 @@ definitionlist(Paragraph *p, MMIOT *f)
     if ( p ) {
 	Qstring("<dl>\n", f);
 
-	for ( ; p ; p = p->next) {
+	for ( ; p && !FAILED(f); p = p->next) {
 	    for ( tag = p->text; tag; tag = tag->next ) {
 		Qstring("<dt>", f);
 		___mkd_reparse(T(tag->text), S(tag->text), NULL, f, 0);
@@ -1951,7 +2367,7 @@ listdisplay(int typ, Paragraph *p, MMIOT* f)
 	    Qprintf(f, " type=\"a\"");
 	Qprintf(f, ">\n");
 
-	for ( ; p ; p = p->next ) {
+	for ( ; p && !FAILED(f); p = p->next ) {
 	    li_htmlify(p->down, p->ident, p->para_flags, f);
 	    Qchar('\n', f);
 	}
@@ -2049,30 +2465,585 @@ mkd_extra_footnotes(MMIOT *m)
 }
 
 
+/* a document isn't rendered in pieces with fewer blocks than this
+ */
+#define PIECE_BLOCKS	64
+
+/* a block to be displayed, and how many paragraph separators
+ * htmlify() would write in front of it
+ */
+struct unit {
+    Paragraph *p;
+    int seps;
+} ;
+
+typedef STRING(struct unit) Units;
+
+/* where a block ends in the html of a slice, and what state it
+ * leaves behind for the blocks after it
+ */
+struct unitend {
+    int end;			/* offset in the slice's ->out */
+    char last;			/* the last text character written */
+    int notes;			/* footnotes referenced so far */
+    long reparses, emphasis, links;	/* and statistics so far */
+} ;
+
+/* a run of blocks that's rendered on its own thread, with its own
+ * copy of the footnotes so it can number the ones it references
+ */
+struct slice {
+    struct unit *unit;
+    int count;
+    STRING(struct unitend) ends;
+    MMIOT f;
+    struct footnote_list notes;
+    struct mkd_budget budget;
+    struct mkd_stats stats;
+} ;
+
+
+/* list the blocks of a document in the order htmlify() would display
+ * them (looking inside source blocks) and count the separators between
+ * them; returns the number of separators left over at the end.
+ */
+static int
+units(Paragraph *p, Units *u, int seps)
+{
+    struct unit *it;
+
+    for ( ; p; p = p->next ) {
+	if ( p->typ == SOURCE )
+	    seps = units(p->down, u, seps);
+	else {
+	    it = &EXPAND(*u);
+	    it->p = p;
+	    it->seps = seps;
+	    seps = 0;
+	}
+	if ( p->next )
+	    ++seps;
+    }
+    return seps;
+}
+
+
+static void
+display_units(struct unit *u, int count, MMIOT *f)
+{
+    int i, j;
+
+    for ( i=0; (i < count) && !halted(f); i++ ) {
+	for ( j=0; j < u[i].seps; j++ )
+	    Qstring("\n\n", f);
+	display(u[i].p, f);
+	___mkd_emblock(f);
+    }
+}
+
+
+/* display a slice as if nothing came before it, remembering where
+ * each block ends
+ */
+static void
+render_slice(void *ctx, int job, int thread)
+{
+    struct slice *s = (struct slice *)ctx + job;
+    struct unitend *e;
+    int i;
+
+    for ( i=0; (i < s->count) && !halted(&s->f); i++ ) {
+	display_units(s->unit+i, 1, &s->f);
+	e = &EXPAND(s->ends);
+	e->end = S(s->f.out);
+	e->last = s->f.last;
+	e->notes = s->notes.reference;
+	e->reparses = s->stats.reparses;
+	e->emphasis = s->stats.emphasis;
+	e->links = s->stats.links;
+    }
+}
+
+
+/* have the blocks of a slice that were just displayed again left
+ * the document where the slice was when it displayed them?  They
+ * need to have left the same last character behind and referenced
+ * the same footnotes (`before` is how many the document had
+ * referenced before them.)
+ */
+static int
+caughtup(struct slice *s, struct unitend *e, MMIOT *f, int before)
+{
+    int i;
+
+    if ( (f->last != e->last) || (f->footnotes->reference - before != e->notes) )
+	return 0;
+
+    for ( i=0; i < S(s->notes.note); i++ )
+	if ( (T(s->notes.note)[i].fn_flags & REFERENCED)
+		    && (T(s->notes.note)[i].refnumber <= e->notes)
+		    && !(T(f->footnotes->note)[i].fn_flags & REFERENCED) )
+	    return 0;
+    return 1;
+}
+
+
+/* add a slice to the document, filling in its footnote numbers.  If
+ * it referenced a footnote that an earlier slice had already used, it
+ * would have been written differently, so it's displayed again here.
+ * And since the slice was displayed as if nothing came before it, its
+ * first blocks are displayed again (until they catch up with it) if
+ * the last character written before it changes how they come out.
+ */
+static void
+stitch_slice(struct slice *s, MMIOT *f)
+{
+    Footnote *mine;
+    struct unitend start, *from = &start;
+    int *number, i, n, before, done = 0;
+    char *p, *q, *r, *end;
+
+    if ( s->budget.error ) {
+	___mkd_overlimit(f, s->budget.error);
+	return;
+    }
+    for ( i=0; i < S(s->notes.note); i++ )
+	if ( (T(s->notes.note)[i].fn_flags & REFERENCED)
+		    && (T(f->footnotes->note)[i].fn_flags & REFERENCED) ) {
+	    display_units(s->unit, s->count, f);
+	    flush(f);
+	    return;
+	}
+
+    memset(&start, 0, sizeof start);
+    if ( f->last ) {
+	before = f->footnotes->reference;
+	for ( i=0; i < s->count; i++ ) {
+	    display_units(s->unit+i, 1, f);
+	    if ( caughtup(s, &T(s->ends)[i], f, before) )
+		break;
+	}
+	if ( i >= s->count - 1 ) {
+	    flush(f);
+	    return;
+	}
+	from = &T(s->ends)[i];
+	done = i+1;
+    }
+
+    if ( !(number = calloc(s->notes.reference+1, sizeof number[0])) ) {
+	/* (no room to renumber the footnotes, so display the rest of
+	 * the slice again instead)
+	 */
+	display_units(s->unit+done, s->count-done, f);
+	flush(f);
+	return;
+    }
+
+    if ( f->stats ) {
+	f->stats->reparses += s->stats.reparses - from->reparses;
+	f->stats->emphasis += s->stats.emphasis - from->emphasis;
+	f->stats->links += s->stats.links - from->links;
+    }
+
+    /* number the footnotes in the order the slice referenced them
+     * (the ones the blocks displayed again referenced already have
+     * their numbers.)
+     */
+    for ( n=1; n <= s->notes.reference; n++ )
+	for ( i=0; i < S(s->notes.note); i++ ) {
+	    mine = &T(s->notes.note)[i];
+	    if ( (mine->fn_flags & REFERENCED) && (mine->refnumber == n) ) {
+		if ( n <= from->notes )
+		    number[n] = T(f->footnotes->note)[i].refnumber;
+		else {
+		    T(f->footnotes->note)[i].fn_flags |= REFERENCED;
+		    T(f->footnotes->note)[i].refnumber = number[n] = ++f->footnotes->reference;
+		}
+		break;
+	    }
+	}
+
+    for ( p = T(s->f.out) + from->end, end = T(s->f.out) + S(s->f.out); p < end; p = q ) {
+	if ( (q = memchr(p, FN_OPEN, end-p)) == 0 )
+	    q = end;
+	SUFFIX(f->out, p, q-p);
+	if ( q < end ) {
+	    for ( n=0, r=q+1; (r < end) && isdigit((unsigned char)*r) && (n <= s->notes.reference); r++ )
+		n = (10 * n) + (*r - '0');
+
+	    if ( (r > q+1) && (r < end) && (*r == FN_CLOSE)
+			   && (n >= 1) && (n <= s->notes.reference) ) {
+		Csprintf(&f->out, "%d", number[n]);
+		q = r+1;
+	    }
+	    else
+		SUFFIX(f->out, q++, 1);
+	}
+    }
+    free(number);
+    f->last = s->f.last;
+    flush(f);
+}
+
+
+/* display the blocks of a document on up to doc->threads threads,
+ * then put the pieces together in order.
+ */
+static void
+htmlify_slices(Document *doc)
+{
+    MMIOT *f = doc->ctx;
+    Units u;
+    STRING(struct slice) slices;
+    struct slice *s;
+    int i, j, seps, size;
+
+    CREATE(u);
+    seps = units(doc->code, &u, 0);
+
+    if ( S(u) < 2 * PIECE_BLOCKS ) {
+	DELETE(u);
+	htmlify(doc->code, 0, 0, f);
+	return;
+    }
+
+    size = S(u) / (4 * doc->threads);
+    if ( size < PIECE_BLOCKS )
+	size = PIECE_BLOCKS;
+
+    CREATE(slices);
+    for ( i=0; i < S(u); i += size ) {
+	s = &EXPAND(slices);
+	s->unit = T(u) + i;
+	s->count = (S(u) - i < size) ? (S(u) - i) : size;
+	CREATE(s->ends);
+	RESERVE(s->ends, s->count);
+    }
+
+    for ( i=0; i < S(slices); i++ ) {
+	s = &T(slices)[i];
+
+	___mkd_initmmiot(&s->f, &s->notes);
+	COPY_FLAGS(s->f.flags, f->flags);
+	s->f.cb = f->cb;
+	s->f.ref_prefix = f->ref_prefix;
+	s->f.protocols = f->protocols;
+	s->budget = *f->budget;
+	s->f.budget = &s->budget;
+	memset(&s->stats, 0, sizeof s->stats);
+	if ( f->stats )
+	    s->f.stats = &s->stats;
+	s->notes.reference = 0;
+	s->notes.deferred = 1;
+	CREATE(s->notes.note);
+	for ( j=0; j < S(f->footnotes->note); j++ )
+	    EXPAND(s->notes.note) = T(f->footnotes->note)[j];
+    }
+
+    ___mkd_emblock(f);
+    ___mkd_parallel(doc->threads, S(slices), render_slice, T(slices));
+
+    for ( i=0; i < S(slices); i++ ) {
+	s = &T(slices)[i];
+
+	if ( !halted(f) )
+	    stitch_slice(s, f);
+	DELETE(s->notes.note);
+	DELETE(s->ends);
+	___mkd_freemmiot(&s->f, &s->notes);
+    }
+
+    while ( seps-- > 0 )
+	Qstring("\n\n", f);
+    ___mkd_emblock(f);
+
+    DELETE(slices);
+    DELETE(u);
+}
+
+
+/* the labels of the headers in a run of blocks (what their html
+ * depends on besides the blocks themselves)
+ */
+static void
+labels(struct unit *u, int count, Cstring *res)
+{
+    int i;
+
+    S(*res) = 0;
+    for ( i=0; i < count; i++ )
+	if ( (u[i].p->typ == HDR) && u[i].p->label )
+	    SUFFIX(*res, u[i].p->label, 1+strlen(u[i].p->label));
+}
+
+
+/* display a document that mkd_update() keeps in pieces, only
+ * generating html for the pieces that have changed since the last
+ * time and copying the rest from what they were rendered as then.
+ */
+static void
+htmlify_pieces(Document *doc)
+{
+    MMIOT *f = doc->ctx;
+    struct mkd_edit *e = doc->edit;
+    struct mkd_piece *p;
+    Units u;
+    Cstring now;
+    struct mkd_sink *sink;
+    int i, k, at, next, j, seps, start;
+
+    CREATE(u);
+    CREATE(now);
+    seps = units(doc->code, &u, 0);
+
+    ___mkd_emblock(f);
+    for ( at=i=0; (i < S(e->pieces)) && !halted(f); i = k ) {
+	p = &T(e->pieces)[i];
+
+	/* find the piece after this one that has something to display
+	 */
+	for ( k=i+1; (k < S(e->pieces)) && !T(e->pieces)[k].unit; k++ )
+	    ;
+	if ( !p->unit )
+	    continue;
+	if ( k < S(e->pieces) )
+	    for ( next=at+1; T(u)[next].p != T(e->pieces)[k].unit; next++ )
+		;
+	else
+	    next = S(u);
+
+	for ( j=0; j < T(u)[at].seps; j++ )
+	    Qstring("\n\n", f);
+	___mkd_emblock(f);
+	T(u)[at].seps = 0;
+
+	/* (what a piece is rendered as also depends on the last
+	 * character written before it; see the superscript code in
+	 * text())
+	 */
+	labels(T(u)+at, next-at, &now);
+	if ( p->fresh && !e->stale && (p->before == f->last)
+		      && (S(now) == S(p->labels))
+		      && (S(now) == 0 || memcmp(T(now), T(p->labels), S(now)) == 0) ) {
+	    SUFFIX(f->out, T(p->html), S(p->html));
+	    f->last = p->after;
+	}
+	else {
+	    sink = f->sink;
+	    f->sink = 0;
+	    start = S(f->out);
+	    p->before = f->last;
+	    display_units(T(u)+at, next-at, f);
+	    p->after = f->last;
+	    f->sink = sink;
+	    S(p->html) = 0;
+	    SUFFIX(p->html, T(f->out)+start, S(f->out)-start);
+	    S(p->labels) = 0;
+	    SUFFIX(p->labels, T(now), S(now));
+	    p->fresh = !halted(f);
+	}
+	flush(f);
+	at = next;
+    }
+    e->stale = 0;
+
+    while ( seps-- > 0 )
+	Qstring("\n\n", f);
+    ___mkd_emblock(f);
+
+    DELETE(now);
+    DELETE(u);
+}
+
+
+/* display a document a block at a time, copying the blocks that
+ * are in its cache and putting the ones that aren't there into it.
+ */
+static void
+htmlify_cached(Document *doc)
+{
+    MMIOT *f = doc->ctx;
+    Units u;
+    Cstring refs;
+    struct mkd_hash key, deps;
+    struct mkd_sink *sink;
+    int i, j, seps, start;
+
+    CREATE(u);
+    CREATE(refs);
+    CREATE(key.bytes);
+    CREATE(deps.bytes);
+    seps = units(doc->code, &u, 0);
+
+    ___mkd_emblock(f);
+    for ( i=0; (i < S(u)) && !halted(f); i++ ) {
+	for ( j=0; j < T(u)[i].seps; j++ )
+	    Qstring("\n\n", f);
+	___mkd_emblock(f);
+
+	if ( ___mkd_cache_get(doc->cache, T(u)[i].p, f, &key, &deps) ) {
+	    if ( f->stats )
+		f->stats->cached++;
+	}
+	else {
+	    /* (the block is held back from the sink until it's been
+	     * copied into the cache)
+	     */
+	    sink = f->sink;
+	    f->sink = 0;
+	    start = S(f->out);
+	    S(refs) = 0;
+	    f->refs = &refs;
+	    display(T(u)[i].p, f);
+	    ___mkd_emblock(f);
+	    f->refs = 0;
+	    f->sink = sink;
+	    if ( !halted(f) )
+		___mkd_cache_put(doc->cache, &key, f, start, &refs, &deps);
+	}
+	flush(f);
+    }
+
+    while ( seps-- > 0 )
+	Qstring("\n\n", f);
+    ___mkd_emblock(f);
+
+    DELETE(deps.bytes);
+    DELETE(key.bytes);
+    DELETE(refs);
+    DELETE(u);
+}
+
+
+/* can the html for a document that mkd_update() is keeping up to date
+ * be put together from what its pieces were rendered as last time?  Not
+ * if it has limits that count across the whole document, or extra
+ * footnotes (which are numbered in the order they're referenced.)
+ */
+static int
+incremental(Document *p)
+{
+    MMIOT *f = p->ctx;
+
+    if ( !p->edit || p->budget.armed || p->budget.limit[MKD_LIMIT_OUTPUT] )
+	return 0;
+
+    return !( is_flag_set(&f->flags, MKD_EXTRA_FOOTNOTE)
+		&& !is_flag_set(&f->flags, MKD_STRICT) );
+}
+
+
+/* can a document be rendered on more than one thread?  Not if it has
+ * limits that count across the whole document, or callbacks (which
+ * might not expect to be called from more than one thread at a time.)
+ */
+static int
+parallel(Document *p)
+{
+    Callback_data *cb = p->ctx->cb;
+
+    if ( p->threads < 2 || p->budget.armed || p->budget.limit[MKD_LIMIT_OUTPUT] )
+	return 0;
+
+    return !(cb && (cb->e_url || cb->e_flags || cb->e_anchor || cb->e_codefmt));
+}
+
+
+/* can a document be rendered through its cache?  Not if it has limits
+ * (which count across the whole document) or callbacks (which might
+ * not write a block the same way twice.)
+ */
+static int
+cacheable(Document *p)
+{
+    Callback_data *cb = p->ctx->cb;
+
+    if ( !p->cache || p->budget.armed || p->budget.limit[MKD_LIMIT_OUTPUT] )
+	return 0;
+
+    return !(cb && (cb->e_url || cb->e_flags || cb->e_anchor || cb->e_codefmt));
+}
+
+
+/* generate the html for a compiled document, either into ->out
+ * or (if there is a sink) a block at a time into the sink.
+ */
+static int
+render(Document *p, struct mkd_sink *sink)
+{
+    MMIOT *f = p->ctx;
+    double start = ___mkd_clock();
+    int i, size;
+
+    /* footnotes are numbered in the order they're referenced, so
+     * forget the numbering from the last time around.
+     */
+    f->footnotes->reference = 0;
+    for ( i=0; i < S(f->footnotes->note); i++ ) {
+	T(f->footnotes->note)[i].fn_flags &= ~REFERENCED;
+	T(f->footnotes->note)[i].refnumber = 0;
+    }
+    f->last = 0;
+    S(f->out) = 0;
+    f->sink = sink;
+    if ( !sink ) {
+	S(p->blocks) = 0;
+	f->blocks = &p->blocks;
+    }
+    ___mkd_budget(&p->budget);
+
+    ATAG(A_OUTPUT);
+    if ( incremental(p) )
+	htmlify_pieces(p);
+    else if ( cacheable(p) )
+	htmlify_cached(p);
+    else if ( parallel(p) )
+	htmlify_slices(p);
+    else
+	htmlify(p->code, 0, 0, f);
+    p->footnotes = S(f->out);
+    if ( is_flag_set(&f->flags, MKD_EXTRA_FOOTNOTE)
+	     && !is_flag_set(&f->flags, MKD_STRICT)
+	     && !halted(f) )
+	mkd_extra_footnotes(f);
+
+    if ( sink )
+	flush(f);
+    else if ( !halted(f) ) {
+	size = S(f->out);
+
+	if ( (size == 0) || T(f->out)[size-1] ) {
+	    /* Add a null byte at the end of the generated html,
+	     * but pretend it doesn't exist.
+	     */
+	    EXPAND(f->out) = 0;
+	    --S(f->out);
+	}
+    }
+    AUNTAG();
+
+    p->stats.output_bytes = S(f->out) + (sink ? sink->written : 0);
+    p->stats.render_time = ___mkd_clock() - start;
+    f->sink = 0;
+    f->blocks = 0;
+
+    return (p->budget.error || (sink && sink->error)) ? EOF : 0;
+}
+
+
 /* return a pointer to the compiled markdown
- * document.
+ * document (or EOF if generating it ran into
+ * one of the document's resource limits)
  */
 int
 mkd_document(Document *p, char **res)
 {
-    int size;
-
-    if ( p && p->compiled ) {
+    if ( p && p->compiled && !p->budget.error ) {
 	if ( ! p->html ) {
-	    htmlify(p->code, 0, 0, p->ctx);
-	    if ( is_flag_set(&p->ctx->flags, MKD_EXTRA_FOOTNOTE)
-		     && !is_flag_set(&p->ctx->flags, MKD_STRICT) )
-		mkd_extra_footnotes(p->ctx);
+	    if ( render(p, 0) == EOF )
+		return EOF;
 	    p->html = 1;
-	    size = S(p->ctx->out);
-
-	    if ( (size == 0) || T(p->ctx->out)[size-1] ) {
-		/* Add a null byte at the end of the generated html,
-		 * but pretend it doesn't exist.
-		 */
-		EXPAND(p->ctx->out) = 0;
-		--S(p->ctx->out);
-	    }
 	}
 
 	*res = T(p->ctx->out);
@@ -2080,3 +3051,195 @@ mkd_document(Document *p, char **res)
     }
     return EOF;
 }
+
+
+/* render a compiled document into a caller's buffer, with the
+ * caller's callbacks, footnote prefix, and (display) flags.  Everything that changes
+ * while the html is being generated (the output, the footnote
+ * numbers, the limits) is kept here instead of in the document, so
+ * any number of threads can render the same document at once (as
+ * long as nothing is changing or rendering it the usual way.)
+ */
+int
+mkd_render(Document *doc, struct mkd_render *r)
+{
+    MMIOT f;
+    struct footnote_list notes;
+    struct mkd_budget budget;
+    Callback_data cb;
+    Footnote *t;
+    int i, ret;
+
+    if ( !(doc && doc->compiled && r) || doc->budget.error || doc->stream )
+	return EOF;
+
+    /* (flags that would have compiled the document differently can't
+     * be displayed from the blocks it has)
+     */
+    if ( r->flags && RECOMPILE(r->flags, &doc->ctx->flags) )
+	return EOF;
+
+    ___mkd_initmmiot(&f, &notes);
+    if ( r->flags )
+	COPY_FLAGS(f.flags, *r->flags);
+    else
+	COPY_FLAGS(f.flags, doc->ctx->flags);
+
+    cb.e_url = r->e_url;
+    cb.e_flags = r->e_flags;
+    cb.e_anchor = r->e_anchor;
+    cb.e_codefmt = r->e_codefmt;
+    cb.e_free = r->e_free;
+    cb.e_data = r->e_data;
+    f.cb = &cb;
+    f.ref_prefix = r->ref_prefix;
+    f.protocols = doc->ctx->protocols;
+
+    budget = doc->budget;
+    ___mkd_budget(&budget);
+    f.budget = &budget;
+
+    notes.reference = notes.deferred = 0;
+    CREATE(notes.note);
+    for ( i=0; i < S(doc->ctx->footnotes->note); i++ ) {
+	t = &EXPAND(notes.note);
+	*t = T(doc->ctx->footnotes->note)[i];
+	t->fn_flags &= ~REFERENCED;
+	t->refnumber = 0;
+    }
+
+    /* (the html goes into whatever buffer was left from last time)
+     */
+    T(f.out) = r->html;
+    ALLOCATED(f.out) = r->alloc;
+
+    htmlify(doc->code, 0, 0, &f);
+    if ( is_flag_set(&f.flags, MKD_EXTRA_FOOTNOTE)
+	     && !is_flag_set(&f.flags, MKD_STRICT)
+	     && !halted(&f) )
+	mkd_extra_footnotes(&f);
+
+    ret = halted(&f) ? EOF : S(f.out);
+    EXPAND(f.out) = 0;
+
+    r->html = T(f.out);
+    r->size = (ret == EOF) ? 0 : ret;
+    r->alloc = ALLOCATED(f.out);
+    CREATE(f.out);
+
+    DELETE(notes.note);
+    ___mkd_freemmiot(&f, &notes);
+    return ret;
+}
+
+
+/* throw away the buffer that mkd_render() left in a mkd_render
+ */
+void
+mkd_free_render(struct mkd_render *r)
+{
+    if ( r ) {
+	if ( r->alloc )
+	    free(r->html);
+	r->html = 0;
+	r->size = r->alloc = 0;
+    }
+}
+
+
+/* send a compiled markdown document to a sink
+ */
+int
+___mkd_sink_document(Document *p, struct mkd_sink *sink)
+{
+    int ret;
+
+    if ( !(p && p->compiled && sink) || p->budget.error )
+	return EOF;
+
+    if ( p->html ) {
+	/* already generated by mkd_document(), so send that */
+	if ( S(p->ctx->out) ) {
+	    if ( (*sink->fn)(T(p->ctx->out), S(p->ctx->out), sink->ctx) == EOF ) {
+		sink->error = 1;
+		return EOF;
+	    }
+	    sink->written += S(p->ctx->out);
+	}
+	return 0;
+    }
+
+    ret = render(p, sink);
+    S(p->ctx->out) = 0;
+    return ret;
+}
+
+
+/* mkd_stream() state between pieces of a document
+ */
+#define STREAM_SEEN	0x01	/* some blocks have been written */
+#define STREAM_HELD	0x02	/* an empty source block is being held back */
+
+
+/* write out a source block that was held back because it might
+ * have been part of the one at the start of the next piece
+ */
+static void
+unhold(MMIOT *f, int *state)
+{
+    if ( *state & STREAM_HELD ) {
+	if ( *state & STREAM_SEEN )
+	    Qstring("\n\n", f);
+	*state = STREAM_SEEN;
+    }
+}
+
+
+/* generate the html for one piece of a document that's being
+ * streamed.  The pieces are cut where compile_document() would
+ * have cached up source blocks, so a source block at the start
+ * of a piece is the continuation of one at the end of the last
+ * piece and the separators need to be written as if it was.
+ */
+void
+___mkd_stream_blocks(Paragraph *p, MMIOT *f, int *state)
+{
+    int first;
+
+    ATAG(A_OUTPUT);
+    for ( first=1; p && !halted(f); p = p->next, first=0 ) {
+	if ( first && (p->typ == SOURCE) && (*state & STREAM_HELD) )
+	    *state &= ~STREAM_HELD;
+	else
+	    unhold(f, state);
+
+	if ( (p->typ == SOURCE) && !(p->down || p->next) ) {
+	    *state |= STREAM_HELD;
+	    break;
+	}
+	if ( *state & STREAM_SEEN )
+	    Qstring("\n\n", f);
+	display(p, f);
+	___mkd_emblock(f);
+	flush(f);
+	*state |= STREAM_SEEN;
+    }
+    AUNTAG();
+}
+
+
+/* finish off a streamed document by writing out the footnotes
+ */
+void
+___mkd_stream_end(MMIOT *f, int *state)
+{
+    ATAG(A_OUTPUT);
+    unhold(f, state);
+    ___mkd_emblock(f);
+    if ( is_flag_set(&f->flags, MKD_EXTRA_FOOTNOTE)
+	     && !is_flag_set(&f->flags, MKD_STRICT)
+	     && !halted(f) )
+	mkd_extra_footnotes(f);
+    flush(f);
+    AUNTAG();
+}
@@ -0,0 +1,85 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+} ;
+#endif
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+
+/* add a piece of the document to the iovec list
+ */
+static void
+gather(Document *doc, char *text, int size)
+{
+    if ( size > 0 ) {
+	doc->iov[doc->nr_iov].iov_base = text;
+	doc->iov[doc->nr_iov].iov_len = size;
+	doc->nr_iov++;
+    }
+}
+
+
+/* return the generated html as a list of iovecs pointing at the
+ * table of contents, the body of the document (in chunks that end
+ * on block boundaries), and the footnotes, so the pieces can be
+ * written out with writev() without being copied together first.
+ * The iovecs stay good until mkd_cleanup();  the list itself is
+ * rebuilt each time mkd_iovec() is called.
+ */
+int
+mkd_iovec(Document *doc, int parts, struct iovec **res)
+{
+    char *html;
+    int size, i, start;
+
+    if ( !(doc && res) )
+	return EOF;
+
+    DO_OR_DIE( size = mkd_document(doc, &html) );
+
+    if ( (parts & MKD_IOV_TOC) && (T(doc->toc) == 0) ) {
+	DO_OR_DIE( mkd_sink_toc(doc, Cssink, &doc->toc) );
+    }
+
+    if ( doc->iov )
+	free(doc->iov);
+    doc->nr_iov = 0;
+    if ( (doc->iov = malloc((3 + S(doc->blocks)) * sizeof doc->iov[0])) == 0 )
+	return EOF;
+
+    if ( parts & MKD_IOV_TOC )
+	gather(doc, T(doc->toc), S(doc->toc));
+
+    if ( parts & MKD_IOV_BODY ) {
+	for ( start = i = 0; i < S(doc->blocks); i++ )
+	    if ( T(doc->blocks)[i] <= doc->footnotes ) {
+		gather(doc, html + start, T(doc->blocks)[i] - start);
+		start = T(doc->blocks)[i];
+	    }
+	gather(doc, html + start, doc->footnotes - start);
+    }
+
+    if ( parts & MKD_IOV_FOOTNOTES )
+	gather(doc, html + doc->footnotes, size - doc->footnotes);
+
+    *res = doc->iov;
+    return doc->nr_iov;
+}
@@ -0,0 +1,100 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+/* how many steps to take between looks at the clock
+ */
+#define CLOCKCHECK	256
+
+
+/* set (or, with a limit of 0, remove) a resource limit on a document
+ */
+int
+mkd_set_limit(Document *doc, int which, long limit)
+{
+    if ( !doc || which <= MKD_LIMIT_NONE || which >= MKD_NR_LIMITS || limit < 0 )
+	return EOF;
+
+    doc->budget.limit[which] = limit;
+    return 0;
+}
+
+
+/* which limit (if any) stopped the last compile or render
+ */
+int
+mkd_error(Document *doc)
+{
+    return doc ? doc->budget.error : MKD_LIMIT_NONE;
+}
+
+
+/* start a compile or render pass; the step and time budgets are
+ * per-pass, but once a limit is exceeded the document stays that way.
+ */
+void
+___mkd_budget(struct mkd_budget *b)
+{
+    b->steps = 0;
+    b->depth = b->reparse = 0;
+    b->degraded = 0;
+    b->deadline = b->limit[MKD_LIMIT_TIME]
+		? ___mkd_clock() + (b->limit[MKD_LIMIT_TIME] / 1000.0)
+		: 0;
+    b->armed = b->error || b->limit[MKD_LIMIT_STEPS]
+			|| b->limit[MKD_LIMIT_TIME]
+			|| b->limit[MKD_LIMIT_DEGRADE];
+}
+
+
+/* note that a limit has been exceeded
+ */
+int
+___mkd_overlimit(MMIOT *f, int which)
+{
+    if ( f->budget ) {
+	if ( !f->budget->error )
+	    f->budget->error = which;
+	f->budget->armed = 1;
+    }
+    return 1;
+}
+
+
+/* take a step (a block compiled or a character rendered); returns
+ * nonzero if the document has run out of resources.
+ */
+int
+___mkd_step(MMIOT *f)
+{
+    struct mkd_budget *b = f->budget;
+
+    if ( b->error )
+	return 1;
+
+    ++b->steps;
+
+    if ( b->limit[MKD_LIMIT_STEPS] && (b->steps > b->limit[MKD_LIMIT_STEPS]) )
+	return ___mkd_overlimit(f, MKD_LIMIT_STEPS);
+
+    if ( b->deadline && (b->steps % CLOCKCHECK == 0)
+		     && (___mkd_clock() > b->deadline) )
+	return ___mkd_overlimit(f, MKD_LIMIT_TIME);
+
+    if ( b->limit[MKD_LIMIT_DEGRADE] && (b->steps > b->limit[MKD_LIMIT_DEGRADE]) )
+	b->degraded = 1;
+
+    return 0;
+}
@@ -15,9 +15,13 @@
 #include <stdarg.h>
 #include <ctype.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "config.h"
+#include "cstring.h"
 #include "amalloc.h"
 #include "pgm_options.h"
 #include "tags.h"
@@ -167,6 +171,388 @@ external_codefmt(char *src, int len, char *lang)
 }
 
 
+/* names for the resource limits that -limit can set
+ */
+static struct {
+    char *name;
+    int limit;
+} limits[] = {
+    { "depth",    MKD_LIMIT_DEPTH },
+    { "reparse",  MKD_LIMIT_REPARSE },
+    { "output",   MKD_LIMIT_OUTPUT },
+    { "emphasis", MKD_LIMIT_EMPHASIS },
+    { "steps",    MKD_LIMIT_STEPS },
+    { "time",     MKD_LIMIT_TIME },
+    { "degrade",  MKD_LIMIT_DEGRADE },
+};
+#define NRLIMITS (sizeof limits/sizeof limits[0])
+
+
+/* parse a name=value limit
+ */
+static int
+set_limit(long *limit, char *arg)
+{
+    char *eq = strchr(arg, '=');
+    int i;
+
+    if ( eq == 0 )
+	return 0;
+
+    for ( i=0; i < NRLIMITS; i++ )
+	if ( (strlen(limits[i].name) == eq-arg)
+			&& (strncasecmp(limits[i].name, arg, eq-arg) == 0) ) {
+	    limit[limits[i].limit] = strtol(eq+1, 0, 0);
+	    return 1;
+	}
+    return 0;
+}
+
+
+static char *
+limit_name(int limit)
+{
+    int i;
+
+    for ( i=0; i < NRLIMITS; i++ )
+	if ( limits[i].limit == limit )
+	    return limits[i].name;
+    return "unknown";
+}
+
+
+/* mkd_stream() sink for the generated html (or, with -n,
+ * nowhere at all)
+ */
+static int
+write_html(const char *bfr, const int size, void *out)
+{
+    if ( out == 0 )
+	return size;
+    return (fwrite(bfr, 1, size, (FILE*)out) == size) ? size : EOF;
+}
+
+
+/* -load: read a compiled document that was written with -save
+ */
+static MMIOT *
+load(FILE *in)
+{
+    Cstring image;
+    MMIOT *doc;
+    int c;
+
+    CREATE(image);
+    while ( (c = getc(in)) != EOF )
+	EXPAND(image) = c;
+
+    doc = mkd_load_compiled(T(image), S(image));
+    DELETE(image);
+    return doc;
+}
+
+
+/* -save: write the compiled document to a file
+ */
+static int
+save(MMIOT *doc, char *file)
+{
+    FILE *out = fopen(file, "w");
+    int rc;
+
+    if ( !out ) {
+	perror(file);
+	return EOF;
+    }
+    rc = mkd_save_compiled(doc, out);
+    if ( fclose(out) == EOF )
+	rc = EOF;
+    if ( rc == EOF )
+	complain("can't save the document to %s", file);
+    return rc;
+}
+
+
+/* what -j needs to know about writing each file
+ */
+struct batch_opts {
+    int styles;
+    int toc;
+    int content;
+    int squash;
+    char *urlflags;
+} ;
+
+/* the html for one -j file, held until the files before it are written
+ */
+struct batch_out {
+    int ok;
+    Cstring html;
+} ;
+
+
+static int
+save_html(const char *bfr, const int size, void *out)
+{
+    SUFFIX(*(Cstring*)out, bfr, size);
+    return size;
+}
+
+
+/* mkd_batch() completion function
+ */
+static void
+batch_done(struct mkd_job *job, MMIOT *doc, void *ctx)
+{
+    struct batch_opts *o = ctx;
+    struct batch_out *out = job->ctx;
+
+    if ( !doc )
+	return;
+
+    out->ok = 1;
+    if ( o->styles )
+	mkd_sink_css(doc, save_html, &out->html);
+    if ( o->toc )
+	mkd_sink_toc(doc, save_html, &out->html);
+    if ( o->content )
+	mkd_sink_html(doc, save_html, &out->html);
+}
+
+
+/* -j: compile and render a pile of files on up to `threads` threads,
+ * then write them out in the order they were given
+ */
+static int
+batch(int count, char **files, int threads, mkd_flag_t *flags,
+					   struct batch_opts *o)
+{
+    struct mkd_job *jobs = calloc(count, sizeof jobs[0]);
+    struct batch_out *out = calloc(count, sizeof out[0]);
+    int i, rc = 0;
+
+    if ( !(jobs && out) ) {
+	complain("out of memory");
+	exit(1);
+    }
+
+    for ( i=0; i < count; i++ ) {
+	jobs[i].file = files[i];
+	jobs[i].flags = flags;
+	if ( o->urlflags ) {
+	    jobs[i].e_data = o->urlflags;
+	    jobs[i].e_flags = e_flags;
+	}
+	if ( o->squash ) {
+	    jobs[i].e_anchor = (mkd_callback_t)anchor_format;
+	    jobs[i].e_free = free_it;
+	}
+	jobs[i].ctx = &out[i];
+	CREATE(out[i].html);
+    }
+
+    if ( mkd_batch(jobs, count, threads, batch_done, o) == EOF ) {
+	complain("can't start the batch");
+	rc = 1;
+    }
+    else
+	for ( i=0; i < count; i++ ) {
+	    if ( !out[i].ok ) {
+		complain("can't read %s", files[i]);
+		rc = 1;
+	    }
+	    else if ( fwrite(T(out[i].html), 1, S(out[i].html), stdout) != S(out[i].html) )
+		rc = 1;
+	}
+
+    for ( i=0; i < count; i++ )
+	DELETE(out[i].html);
+    free(out);
+    free(jobs);
+    return rc;
+}
+
+
+/* -serve: read requests of the form
+
+	flags-size body-size\n
+	flags body
+
+ * (flags are a -f style flag string, added to the ones on the
+ * command line) and answer them with
+
+	status css-size toc-size html-size\n
+	css toc html
+
+ * until the input runs out.  If the status isn't 0, the html is an
+ * error message instead.  The buffers are kept from one request to
+ * the next, and so is the html for the blocks of the documents (so a
+ * document that's sent again after a small change only has the blocks
+ * that changed formatted again.)
+ */
+#define SERVE_CACHE	8192
+
+/* the longest flag string and the biggest document a request can have
+ */
+#define SERVE_FLAGS	4096
+#define SERVE_SIZE	(256*1024*1024)
+
+struct server {
+    mkd_flag_t *flags;		/* from the command line */
+    Cstring request;
+    Cstring css, toc, html;
+    struct mkd_cache *cache;
+} ;
+
+
+static int
+answer(FILE *out, struct server *srv, int status)
+{
+    fprintf(out, "%d %d %d %d\n", status, S(srv->css), S(srv->toc), S(srv->html));
+    fwrite(T(srv->css), 1, S(srv->css), out);
+    fwrite(T(srv->toc), 1, S(srv->toc), out);
+    fwrite(T(srv->html), 1, S(srv->html), out);
+    return (fflush(out) == EOF) ? EOF : 0;
+}
+
+
+/* answer a request that can't be read (there's no telling where the
+ * next one starts after it, so that's the end of the requests)
+ */
+static int
+refuse(FILE *out, struct server *srv, char *why)
+{
+    S(srv->css) = S(srv->toc) = S(srv->html) = 0;
+    SUFFIX(srv->html, why, strlen(why));
+    answer(out, srv, 1);
+    return EOF;
+}
+
+
+static int
+serve(FILE *in, FILE *out, struct server *srv)
+{
+    char header[80], *mid, *end;
+    long flagsize, size;
+    char *bad;
+    mkd_flag_t *flags;
+    MMIOT *doc;
+
+    while ( fgets(header, sizeof header, in) ) {
+	flagsize = strtol(header, &mid, 10);
+	size = strtol(mid, &end, 10);
+
+	if ( (mid == header) || (end == mid) || (*end != '\n')
+			  || (flagsize < 0) || (flagsize > SERVE_FLAGS)
+			  || (size < 0) || (size > SERVE_SIZE) )
+	    return refuse(out, srv, "malformed request");
+
+	S(srv->request) = 0;
+	RESERVE(srv->request, flagsize+size+1);
+	if ( !T(srv->request) ) {
+	    ALLOCATED(srv->request) = 0;
+	    return refuse(out, srv, "out of memory");
+	}
+	if ( fread(T(srv->request), 1, flagsize+size, in) != flagsize+size )
+	    return EOF;
+	T(srv->request)[flagsize+size] = 0;
+
+	S(srv->css) = S(srv->toc) = S(srv->html) = 0;
+
+	if ( !(flags = mkd_copy_flags(srv->flags)) )
+	    return EOF;
+
+	if ( flagsize ) {
+	    /* (the flags are nul-terminated for a moment so strtok()
+	     * can find their end)
+	     */
+	    char c = T(srv->request)[flagsize];
+
+	    T(srv->request)[flagsize] = 0;
+	    if ( bad = mkd_set_flag_string(flags, T(srv->request)) ) {
+		SUFFIX(srv->html, "unknown option ", 15);
+		SUFFIX(srv->html, bad, strlen(bad));
+	    }
+	    T(srv->request)[flagsize] = c;
+
+	    if ( bad ) {
+		mkd_free_flags(flags);
+		if ( answer(out, srv, 1) == EOF )
+		    return EOF;
+		continue;
+	    }
+	}
+
+	if ( doc = mkd_string(T(srv->request)+flagsize, size, flags) ) {
+	    mkd_use_cache(doc, srv->cache);
+	    if ( mkd_compile(doc, flags) ) {
+		mkd_sink_css(doc, save_html, &srv->css);
+		if ( mkd_flag_isset(flags, MKD_TOC) )
+		    mkd_sink_toc(doc, save_html, &srv->toc);
+		mkd_sink_html(doc, save_html, &srv->html);
+	    }
+	    mkd_cleanup(doc);
+	}
+	mkd_free_flags(flags);
+
+	if ( !doc )
+	    SUFFIX(srv->html, "out of memory", 13);
+
+	if ( answer(out, srv, doc ? 0 : 1) == EOF )
+	    return EOF;
+    }
+    return 0;
+}
+
+
+/* -serve on a unix-domain socket, one connection at a time
+ */
+static int
+serve_socket(char *path, struct server *srv)
+{
+    struct sockaddr_un addr;
+    int s, c;
+    FILE *in, *out;
+
+    if ( strlen(path) >= sizeof addr.sun_path ) {
+	complain("socket name %s is too long", path);
+	return 1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    unlink(path);
+    if ( (s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	   || bind(s, (struct sockaddr*)&addr, sizeof addr) < 0
+	   || listen(s, 5) < 0 ) {
+	perror(path);
+	return 1;
+    }
+
+    /* a client that goes away shouldn't take the server with it */
+    signal(SIGPIPE, SIG_IGN);
+
+    while ( (c = accept(s, 0, 0)) >= 0 ) {
+	if ( !(in = fdopen(c, "r")) ) {
+	    close(c);
+	    continue;
+	}
+	if ( out = fdopen(dup(c), "w") ) {
+	    serve(in, out, srv);
+	    fclose(out);
+	}
+	fclose(in);
+    }
+    perror(path);
+    return 1;
+}
+
+
+/* options that don't have a single-character flag
+ */
+enum { A_STATS=1, A_LIMIT, A_STREAM, A_THREADS, A_SERVE, A_SAVE, A_LOAD, A_PROTOCOLS };
+
 struct h_opt opts[] = {
     { 0, "html5",  '5', 0,           "recognise html5 block elements" },
     { 0, "base",   'b', "url-base",  "URL prefix" },
@@ -176,6 +562,7 @@ struct h_opt opts[] = {
     { 0, 0,        'F', "bitmap",    "set/show hex flags" },
     { 0, 0,        'f', "{+-}flags", "set/show named flags" },
     { 0, 0,        'G', 0,           "github flavoured markdown" },
+    { 0, 0,        'j', "count",     "render files with up to `count` threads" },
     { 0, 0,        'n', 0,           "don't write generated html" },
     { 0, 0,        's', "text",      "format `text`" },
     { 0, "style",  'S', 0,           "output <style> blocks" },
@@ -185,6 +572,14 @@ struct h_opt opts[] = {
     { 0, 0,        'o', "file",      "write output to file" },
     { 0, "squash", 'x', 0,           "squash toc labels to be more like github" },
     { 0, "codefmt",'X', "command",   "use an external code formatter" },
+    { A_STATS, "stats", 0, 0,        "print document statistics" },
+    { A_LIMIT, "limit", 0, "name=value", "set a resource limit" },
+    { A_STREAM,"stream",0, 0,        "compile and write the document a piece at a time" },
+    { A_THREADS,"threads",0, "count", "compile with up to `count` threads" },
+    { A_SERVE, "serve", 0, 0,        "answer requests on stdin (or a socket)" },
+    { A_SAVE,  "save",  0, "file",   "save the compiled document to `file`" },
+    { A_LOAD,  "load",  0, 0,        "read a document saved with -save" },
+    { A_PROTOCOLS,"protocols",0, "list", "url protocols that links may use" },
     { 0, "help",   '?', 0,           "print a detailed usage message" },
 };
 #define NROPTS (sizeof opts/sizeof opts[0])
@@ -204,11 +599,22 @@ main(int argc, char **argv)
     int use_e_codefmt = 0;
     int github_flavoured = 0;
     int squash = 0;
+    int stats = 0;
+    int stream = 0;
+    int threads = 0;
+    int jobs = 0;
+    int server = 0;
+    int loaded = 0;
+    int overlimit = 0;
+    int i;
+    long limit[MKD_NR_LIMITS];
     char *extra_footnote_prefix = 0;
     char *urlflags = 0;
     char *text = 0;
     char *ofile = 0;
     char *urlbase = 0;
+    char *savefile = 0;
+    char *protocols = 0;
     char *q;
     MMIOT *doc;
     struct h_context blob;
@@ -218,6 +624,8 @@ main(int argc, char **argv)
     if ( !flags )
 	perror("new_flags");
 
+    memset(limit, 0, sizeof limit);
+
     hoptset(&blob, argc, argv);
     hopterr(&blob, 1);
 
@@ -268,6 +676,12 @@ main(int argc, char **argv)
 		    break;
 	case 'G':   github_flavoured = 1;
 		    break;
+	case 'j':   jobs = atoi(hoptarg(&blob));
+		    if ( jobs < 1 ) {
+			complain("-j needs a count of at least 1");
+			exit(1);
+		    }
+		    break;
 	case 'n':   content = 0;
 		    break;
 	case 's':   text = hoptarg(&blob);
@@ -300,6 +714,40 @@ main(int argc, char **argv)
 		    break;
 	case '?':   hoptdescribe(pgm, opts, NROPTS, "[file]", 1);
 		    return 0;
+	case 0:     switch ( opt->option ) {
+		    case A_STATS:
+			stats = 1;
+			break;
+		    case A_LIMIT:
+			if ( !set_limit(limit, hoptarg(&blob)) ) {
+			    complain("unknown limit <%s>", hoptarg(&blob));
+			    exit(1);
+			}
+			break;
+		    case A_STREAM:
+			stream = 1;
+			break;
+		    case A_SERVE:
+			server = 1;
+			break;
+		    case A_SAVE:
+			savefile = hoptarg(&blob);
+			break;
+		    case A_LOAD:
+			loaded = 1;
+			break;
+		    case A_PROTOCOLS:
+			protocols = hoptarg(&blob);
+			break;
+		    case A_THREADS:
+			threads = atoi(hoptarg(&blob));
+			if ( threads < 1 ) {
+			    complain("-threads needs a count of at least 1");
+			    exit(1);
+			}
+			break;
+		    }
+		    break;
 	}
     }
 
@@ -319,6 +767,75 @@ main(int argc, char **argv)
     if ( with_html5 )
 	mkd_with_html5_tags();
 
+    if ( stream && (text || debug || toc || styles || github_flavoured) ) {
+	complain("-stream can't be used with -s, -t, -d, -T, -S, or -G");
+	exit(1);
+    }
+
+    if ( loaded && (text || stream || github_flavoured || savefile || threads) ) {
+	complain("-load can't be used with -s, -t, -G, -stream, -save, or -threads");
+	exit(1);
+    }
+
+    if ( server ) {
+	struct server srv;
+
+	for ( i=1; i < MKD_NR_LIMITS && !limit[i]; i++ )
+	    ;
+	if ( text || debug || stream || github_flavoured || urlbase || urlflags
+		  || squash || use_e_codefmt || extra_footnote_prefix || stats
+		  || threads || jobs || toc || styles || !content || ofile
+		  || savefile || loaded || protocols || (i < MKD_NR_LIMITS) ) {
+	    complain("-serve can only be used with -5, -f, and -F");
+	    exit(1);
+	}
+
+	memset(&srv, 0, sizeof srv);
+	srv.flags = flags;
+	srv.cache = mkd_new_cache(SERVE_CACHE);
+	rc = argc ? serve_socket(argv[0], &srv) : (serve(stdin, stdout, &srv) != 0);
+
+	DELETE(srv.request);
+	DELETE(srv.css);
+	DELETE(srv.toc);
+	DELETE(srv.html);
+	mkd_free_cache(srv.cache);
+	mkd_deallocate_tags();
+	mkd_free_flags(flags);
+	adump();
+	exit(rc);
+    }
+
+    if ( jobs ) {
+	struct batch_opts o;
+
+	for ( i=1; i < MKD_NR_LIMITS && !limit[i]; i++ )
+	    ;
+	if ( text || debug || stream || github_flavoured || urlbase || use_e_codefmt
+		  || extra_footnote_prefix || stats || threads || savefile || loaded
+		  || protocols || (i < MKD_NR_LIMITS) ) {
+	    complain("-j can't be used with -s, -t, -d, -G, -b, -C, -X, -stream,"
+		     " -stats, -limit, -threads, -save, -load, or -protocols");
+	    exit(1);
+	}
+	if ( argc == 0 ) {
+	    complain("-j needs files to read");
+	    exit(1);
+	}
+
+	o.styles = styles;
+	o.toc = toc;
+	o.content = content;
+	o.squash = squash;
+	o.urlflags = urlflags;
+	rc = batch(argc, argv, jobs, flags, &o);
+
+	mkd_deallocate_tags();
+	mkd_free_flags(flags);
+	adump();
+	exit(rc);
+    }
+
     if ( use_mkd_line )
 	rc = mkd_generateline( text, strlen(text), stdout, flags);
     else {
@@ -337,8 +854,17 @@ main(int argc, char **argv)
 		exit(1);
 	    }
 
-	    doc = github_flavoured ? gfm_in(stdin,flags)
-				   : mkd_in(stdin,flags);
+	    if ( stream )
+		doc = mkd_stream_in(stdin, flags);
+	    else if ( loaded )
+		doc = load(stdin);
+	    else
+		doc = github_flavoured ? gfm_in(stdin,flags)
+				       : mkd_in(stdin,flags);
+	    if ( !doc && loaded ) {
+		complain("%s is not a saved document", argc ? argv[0] : "stdin");
+		exit(1);
+	    }
 	    if ( !doc ) {
 		perror(argc ? argv[0] : "stdin");
 		exit(1);
@@ -362,18 +888,51 @@ main(int argc, char **argv)
 	if ( extra_footnote_prefix )
 	    mkd_ref_prefix(doc, extra_footnote_prefix);
 
+	if ( protocols && (mkd_protocols(doc, protocols) == EOF) ) {
+	    complain("bad protocol list <%s>", protocols);
+	    exit(1);
+	}
+
+	if ( stats )
+	    mkd_collect_stats(doc, 1);
+
+	for ( i=1; i < MKD_NR_LIMITS; i++ )
+	    if ( limit[i] )
+		mkd_set_limit(doc, i, limit[i]);
+
+	if ( threads && (mkd_set_threads(doc, threads) == EOF) )
+	    complain("can't use %d threads; compiling with one", threads);
+
 	if ( debug )
 	    rc = mkd_dump(doc, stdout, flags, argc ? basename(argv[0]) : "stdin");
 	else {
 	    rc = 1;
-	    if ( mkd_compile(doc, flags) ) {
+	    if ( stream ) {
+		if ( mkd_stream(doc, flags, write_html, content ? stdout : 0) != EOF ) {
+		    rc = 0;
+		    if ( stats )
+			mkd_generatestats(doc, stderr);
+		}
+	    }
+	    /* (a saved document is already compiled, with the flags it
+	     * was saved with)
+	     */
+	    else if ( loaded || mkd_compile(doc, flags) ) {
 		rc = 0;
+		if ( savefile && (save(doc, savefile) == EOF) )
+		    rc = 1;
 		if ( styles )
 		    mkd_generatecss(doc, stdout);
 		if ( toc )
 		    mkd_generatetoc(doc, stdout);
 		if ( content )
 		    mkd_generatehtml(doc, stdout);
+		if ( stats )
+		    mkd_generatestats(doc, stderr);
+	    }
+	    if ( i = mkd_error(doc) ) {
+		complain("%s limit exceeded", limit_name(i));
+		overlimit = 1;
 	    }
 	}
 	mkd_cleanup(doc);
@@ -381,5 +940,7 @@ main(int argc, char **argv)
     mkd_deallocate_tags();
     mkd_free_flags(flags);
     adump();
+    if ( overlimit )
+	exit(2);
     exit( (rc == 0) ? 0 : errno );
 }
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <time.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "cstring.h"
 #include "markdown.h"
@@ -23,6 +24,44 @@ typedef int (*stfu)(const void*,const void*);
 static Paragraph *Pp(ParagraphRoot *, Line *, int);
 static Paragraph *compile(Line *, int, MMIOT *);
 
+/* what the characters that block detection looks at are, so a line
+ * can be classified with one lookup per character (and without the
+ * ctype functions, which are called a lot here)
+ */
+#define L_BLANK		0x001	/* isspace() */
+#define L_DIGIT		0x002
+#define L_ALPHA		0x004
+#define L_BULLET	0x008	/* *, -, or + (or the nul strchr() finds) */
+#define L_DASH		0x010	/* the characters rules and setext headers */
+#define L_EQUAL		0x020	/* are made of */
+#define L_UNDER		0x040
+#define L_STAR		0x080
+#define L_OTHER		0x100	/* anything but one of them or a space */
+
+#define L_RULE		(L_DASH|L_EQUAL|L_UNDER|L_STAR)
+
+static const unsigned short lineclass[256] = {
+    0x108, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x101, 0x101, 0x101, 0x101, 0x101, 0x100, 0x100,	/* 00 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* 10 */
+    0x001, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x088, 0x108, 0x100, 0x018, 0x100, 0x100,	/* 20 */
+    0x102, 0x102, 0x102, 0x102, 0x102, 0x102, 0x102, 0x102, 0x102, 0x102, 0x100, 0x100, 0x100, 0x020, 0x100, 0x100,	/* 30 */
+    0x100, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104,	/* 40 */
+    0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x100, 0x100, 0x100, 0x100, 0x040,	/* 50 */
+    0x100, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104,	/* 60 */
+    0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x104, 0x100, 0x100, 0x100, 0x100, 0x100,	/* 70 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* 80 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* 90 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* a0 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* b0 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* c0 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* d0 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* e0 */
+    0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100,	/* f0 */
+} ;
+
+#define L_IS(c,k)	(lineclass[(unsigned char)(c)] & (k))
+
+
 /* case insensitive string sort for Footnote tags.
  */
 int
@@ -52,7 +91,7 @@ __mkd_footsort(Footnote *a, Footnote *b)
 static int
 nextblank(Line *t, int i)
 {
-    while ( (i < S(t->text)) && !isspace(T(t->text)[i]) )
+    while ( (i < S(t->text)) && !L_IS(T(t->text)[i], L_BLANK) )
 	++i;
     return i;
 }
@@ -63,7 +102,7 @@ nextblank(Line *t, int i)
 static int
 nextnonblank(Line *t, int i)
 {
-    while ( (i < S(t->text)) && isspace(T(t->text)[i]) )
+    while ( (i < S(t->text)) && L_IS(T(t->text)[i], L_BLANK) )
 	++i;
     return i;
 }
@@ -129,7 +168,7 @@ isopentag(Line *p)
      */
     for ( i=1; i < len && T(p->text)[i] != '>' 
 		       && T(p->text)[i] != '/'
-		       && !isspace(T(p->text)[i]); ++i )
+		       && !L_IS(T(p->text)[i], L_BLANK); ++i )
 	;
 
 
@@ -137,28 +176,6 @@ isopentag(Line *p)
 }
 
 
-typedef struct _flo {
-    Line *t;
-    int i;
-} FLO;
-
-#define floindex(x) (x.i)
-
-
-static unsigned int
-flogetc(FLO *f)
-{
-    if ( f && f->t ) {
-	if ( f->i < S(f->t->text) )
-	    return (unsigned char)T(f->t->text)[f->i++];
-	f->t = f->t->next;
-	f->i = 0;
-	return flogetc(f);
-    }
-    return EOF;
-}
-
-
 static void
 splitline(Line *t, int cutpoint)
 {
@@ -185,11 +202,7 @@ splitline(Line *t, int cutpoint)
 static void
 checkline(Line *l, mkd_flag_t *flags)
 {
-    int eol, i;
-    int dashes = 0, spaces = 0,
-	equals = 0, underscores = 0,
-	stars = 0, tildes = 0, other = 0,
-	backticks = 0;
+    int eol, i, seen = 0, rule;
     register int c,  first;
 
     l->is_checked = 1;
@@ -199,7 +212,7 @@ checkline(Line *l, mkd_flag_t *flags)
 
     if (l->dle >= 4) { l->kind=chk_code; return; }
 
-    for ( eol = S(l->text); eol > l->dle && isspace(T(l->text)[eol-1]); --eol )
+    for ( eol = S(l->text); eol > l->dle && L_IS(T(l->text)[eol-1], L_BLANK); --eol )
 	;
 
     if ( is_flag_set(flags, MKD_FENCEDCODE) && !is_flag_set(flags, MKD_STRICT) ) {
@@ -226,124 +239,267 @@ checkline(Line *l, mkd_flag_t *flags)
 
 	if ( (c = T(l->text)[i]) != ' ' ) l->count++;
 
-	switch (c) {
-	case '-':  dashes = 1; break;
-	case ' ':  spaces = 1; break;
-	case '=':  equals = 1; break;
-	case '_':  underscores = 1; break;
-	case '*':  stars = 1; break;
-	default:   other = 1; break;
-	}
+	seen |= lineclass[(unsigned char)c];
     }
 
-    if ( dashes + equals + underscores + stars + tildes + backticks > 1 )
+    /* it's a rule or the underline of a header if it's made of only
+     * one of the characters they're made of (and spaces)
+     */
+    rule = seen & L_RULE;
+    if ( rule & (rule-1) )
 	return;
 
-    if ( !other ) {
-	if (underscores || stars )
+    if ( !(seen & L_OTHER) ) {
+	if ( rule & (L_UNDER|L_STAR) )
 	    l->kind = chk_hr;
-	else if ( dashes )
+	else if ( rule & L_DASH )
 	    l->kind = chk_dash;
-	else if ( equals )
+	else if ( rule & L_EQUAL )
 	    l->kind = chk_equal;
-	return;
     }
-
-    if ( tildes ) { l->kind = chk_tilde; }
-    else if ( backticks ) { l->kind = chk_backtick; }
 }
 
 
 
-/* markdown only does special handling of comments if the comment end
- * is at the end of a line
+/* where htmlscan() is in a tag
  */
-static Line *
-commentblock(Paragraph *p, int *unclosed)
+enum { H_TEXT=0, H_LT, H_BANG, H_DASH, H_COMMENT, H_CDASH, H_CDASH2, H_TAG, H_GUNK };
+
+
+/*
+ * walk through an html block a line at a time (for htmlblock(), and
+ * as the lines come in from mkd_stream());  returns where the block
+ * ends in this line, or -1 if it hasn't ended yet.
+ */
+static int
+htmlscan(struct mkd_chunker *s, Line *t)
 {
-    Line *t, *ret;
+    struct kw *tag = s->tag;
     char *end;
+    int i, c;
 
-       for ( t = p->text; t ; t = t->next) {
-	   if ( end = strstr(T(t->text), "-->") ) {
-	       if ( nextnonblank(t, 3 + (end - T(t->text))) < S(t->text) )
-		   continue;
-	       /*splitline(t, 3 + (end - T(t->text)) );*/
-	       ret = t->next;
-	       t->next = 0;
-	       return ret;
-	   }
+    if ( tag == &comment ) {
+	if ( (end = strstr(T(t->text), "-->"))
+		  && nextnonblank(t, 3 + (end - T(t->text))) >= S(t->text) )
+	    return S(t->text);
+	return -1;
     }
 
-    *unclosed = 1;
-    return t;
+    if ( tag->selfclose )
+	return S(t->text);
 
-}
+    for ( i=0; i < S(t->text); i++ ) {
+	c = (unsigned char)T(t->text)[i];
 
+	switch ( s->scan ) {
+	case H_TEXT:	if ( c == '<' )
+			    s->scan = H_LT;
+			break;
 
-static Line *
-htmlblock(Paragraph *p, struct kw *tag, int *unclosed)
-{
-    Line *ret;
-    FLO f = { p->text, 0 };
-    int c;
-    int i, closing, depth=0;
+	case H_LT:	s->i = 0;
+			if ( c == '!' )
+			    s->scan = H_BANG;
+			else if ( s->closing = (c == '/') )
+			    s->scan = H_TAG;
+			else {
+			    s->scan = H_TAG;
+			    goto tagname;
+			}
+			break;
 
-    *unclosed = 0;
+	case H_BANG:	s->scan = (c == '-') ? H_DASH : H_TEXT;
+			break;
 
-    if ( tag == &comment )
-	return commentblock(p, unclosed);
+	case H_DASH:	s->scan = (c == '-') ? H_COMMENT : H_TEXT;
+			break;
 
-    if ( tag->selfclose ) {
-	ret = f.t->next;
-	f.t->next = 0;
-	return ret;
-    }
+	case H_COMMENT:	if ( c == '-' )
+			    s->scan = H_CDASH;
+			break;
 
-    while ( (c = flogetc(&f)) != EOF ) {
-	if ( c == '<' ) {
-	    /* tag? */
-	    c = flogetc(&f);
-	    if ( c == '!' ) { /* comment? */
-		if ( flogetc(&f) == '-' && flogetc(&f) == '-' ) {
-		    /* yes */
-		    while ( (c = flogetc(&f)) != EOF ) {
-			if ( c == '-' && flogetc(&f) == '-'
-				      && flogetc(&f) == '>')
-			      /* consumed whole comment */
-			      break;
-		    }
-		}
-	    }
-	    else { 
-		if ( closing = (c == '/') ) c = flogetc(&f);
+	case H_CDASH:	s->scan = (c == '-') ? H_CDASH2 : H_COMMENT;
+			break;
 
-		for ( i=0; i < tag->size; i++, c=flogetc(&f) ) {
-		    if ( tag->id[i] != toupper(c) )
+	case H_CDASH2:	s->scan = (c == '>') ? H_TEXT : H_COMMENT;
 			break;
-		}
 
-		if ( (i == tag->size) && !isalnum(c) ) {
-		    depth = depth + (closing ? -1 : 1);
-		    if ( depth == 0 ) {
-			while ( c != EOF && c != '>' ) {
-			    /* consume trailing gunk in close tag */
-			    c = flogetc(&f);
+	case H_TAG:
+	tagname:	if ( s->i < tag->size ) {
+			    if ( tag->id[s->i] == toupper(c) )
+				s->i++;
+			    else
+				s->scan = H_TEXT;
+			    break;
 			}
-			if ( c == EOF )
+			s->scan = H_TEXT;
+			if ( isalnum(c) )
 			    break;
-			if ( !f.t )
-			    return 0;
-			splitline(f.t, floindex(f));
-			ret = f.t->next;
-			f.t->next = 0;
-			return ret;
-		    }
-		}
-	    }
+			s->depth += s->closing ? -1 : 1;
+			if ( s->depth < s->low )
+			    s->low = s->depth;
+			if ( s->depth != 0 )
+			    break;
+			s->scan = H_GUNK;
+			/* fall into the close tag */
+
+	case H_GUNK:	if ( c == '>' )
+			    return i+1;
+			break;
 	}
     }
+    return -1;
+}
+
+
+/* an html block that isn't closed is followed all the way to the end
+ * of the lines that compile() is working through, and that walk is
+ * kept (one for each tag) so that the blocks of that tag which start
+ * further down, before the lines after them have been touched, can be
+ * seen to be unclosed without walking to the end again.
+ */
+struct htmlline {
+    Line *t;
+    int size;			/* how long it was */
+    int depth;			/* how deep the walk was at the start of it
+				 * (or -1 if it was inside a tag or comment) */
+    int low;			/* how shallow it got from there on */
+} ;
+
+typedef STRING(struct htmlline) Htmllines;
+
+struct htmlwalk {
+    struct kw *tag;
+    Htmllines lines;
+} ;
+
+typedef STRING(struct htmlwalk) Htmlwalks;
+
+
+static int
+htmllinecmp(struct htmlline *a, struct htmlline *b)
+{
+    if ( a->t == b->t )
+	return 0;
+    return (a->t < b->t) ? -1 : 1;
+}
+
+
+static struct htmlwalk *
+htmlwalk(Htmlwalks *walks, struct kw *tag)
+{
+    int i;
+
+    for ( i=0; i < S(*walks); i++ )
+	if ( T(*walks)[i].tag == tag )
+	    return &T(*walks)[i];
+    return 0;
+}
+
+
+/* would walking an html block that starts on this line only come to
+ * the same end as a walk that's already been taken?
+ */
+static int
+notclosed(Htmlwalks *walks, struct kw *tag, Line *t)
+{
+    struct htmlwalk *w;
+    struct htmlline key, *l;
+
+    if ( !(walks && (w = htmlwalk(walks, tag))) )
+	return 0;
+
+    key.t = t;
+    l = bsearch(&key, T(w->lines), S(w->lines), sizeof key, (stfu)htmllinecmp);
+
+    /* a block that starts here is closed when the depth comes back
+     * to where it was at the start of the line
+     */
+    return l && (l->size == S(t->text)) && (l->depth >= 0) && (l->low > l->depth);
+}
+
+
+/* keep a walk that didn't find the end of a block, with each line
+ * knowing how shallow the walk got after it starts
+ */
+static void
+keepwalk(Htmlwalks *walks, struct kw *tag, Htmllines *lines)
+{
+    struct htmlwalk *w;
+    int i, low = INT_MAX;
+
+    for ( i = S(*lines)-1; i >= 0; --i ) {
+	if ( T(*lines)[i].low < low )
+	    low = T(*lines)[i].low;
+	T(*lines)[i].low = low;
+    }
+    qsort(T(*lines), S(*lines), sizeof T(*lines)[0], (stfu)htmllinecmp);
+
+    if ( w = htmlwalk(walks, tag) )
+	DELETE(w->lines);
+    else {
+	w = &EXPAND(*walks);
+	w->tag = tag;
+    }
+    w->lines = *lines;
+}
+
+
+static void
+freewalks(Htmlwalks *walks)
+{
+    int i;
+
+    for ( i=0; i < S(*walks); i++ )
+	DELETE(T(*walks)[i].lines);
+    DELETE(*walks);
+}
+
+
+/* find the end of an html block (or a comment, which markdown only
+ * ends if the comment end is at the end of a line), splitting the line
+ * that it ends in.  If `walks` isn't null, an unclosed block is looked
+ * for in there first and kept there if it wasn't.
+ */
+static Line *
+htmlblock(Paragraph *p, struct kw *tag, int *unclosed, Htmlwalks *walks)
+{
+    struct mkd_chunker s;
+    struct htmlline *l;
+    Htmllines lines;
+    Line *t, *ret;
+    int end;
+
+    if ( *unclosed = notclosed(walks, tag, p->text) )
+	return 0;
+
+    memset(&s, 0, sizeof s);
+    s.tag = tag;
+    CREATE(lines);
+
+    for ( t = p->text; t; t = t->next ) {
+	if ( walks ) {
+	    if ( S(lines) >= ALLOCATED(lines) )
+		RESERVE(lines, S(lines));
+	    l = &EXPAND(lines);
+	    l->t = t;
+	    l->size = S(t->text);
+	    l->depth = (s.scan == H_TEXT) ? s.depth : -1;
+	    s.low = INT_MAX;
+	}
+	if ( (end = htmlscan(&s, t)) >= 0 ) {
+	    DELETE(lines);
+	    splitline(t, end);
+	    ret = t->next;
+	    t->next = 0;
+	    return ret;
+	}
+	if ( walks )
+	    l->low = s.low;
+    }
+
     *unclosed = 1;
+    if ( walks )
+	keepwalk(walks, tag, &lines);
     return 0;
 }
 
@@ -467,7 +623,7 @@ static int
 is_extra_dd(Line *t)
 {
     return (t->dle < 4) && (T(t->text)[t->dle] == ':')
-			&& isspace(T(t->text)[t->dle+1]);
+			&& L_IS(T(t->text)[t->dle+1], L_BLANK);
 }
 
 
@@ -523,7 +679,9 @@ islist(Line *t, int *clip, mkd_flag_t *flags, int *list_type)
     if ( isdefinition(t,clip,list_type,flags) )
 	return DL;
 	
-    if ( strchr("*-+", T(t->text)[t->dle]) && isspace(T(t->text)[t->dle+1]) ) {
+    q = T(t->text) + t->dle;
+
+    if ( L_IS(q[0], L_BULLET) && L_IS(q[1], L_BLANK) ) {
 	i = nextnonblank(t, t->dle+1);
 	*clip = (i > 4) ? 4 : i;
 	*list_type = UL;
@@ -535,15 +693,24 @@ islist(Line *t, int *clip, mkd_flag_t *flags, int *list_type)
 
 	    if ( !(is_flag_set(flags, MKD_NOALPHALIST) || is_flag_set(flags, MKD_STRICT))
 			  && (j == t->dle + 2)
-			  && isalpha(T(t->text)[t->dle]) ) {
+			  && L_IS(q[0], L_ALPHA) ) {
 		j = nextnonblank(t,j);
 		*clip = (j > 4) ? 4 : j;
 		*list_type = AL;
 		return AL;
 	    }
 
-	    strtoul(T(t->text)+t->dle, &q, 10);
-	    if ( (q > T(t->text)+t->dle) && (q == T(t->text) + (j-1)) ) {
+	    /* a number (which strtoul() would let have a sign) and
+	     * then the .
+	     */
+	    i = t->dle + ((q[0] == '+') || (q[0] == '-'));
+	    if ( L_IS(T(t->text)[i], L_DIGIT) ) {
+		while ( L_IS(T(t->text)[i], L_DIGIT) )
+		    ++i;
+	    }
+	    else
+		i = t->dle;
+	    if ( (i > t->dle) && (i == j-1) ) {
 		j = nextnonblank(t,j);
 		*clip = j;
 		*list_type = OL;
@@ -1161,7 +1328,11 @@ addfootnote(Line *p, MMIOT* f)
 static Paragraph *
 Pp(ParagraphRoot *d, Line *ptr, int typ)
 {
-    Paragraph *ret = calloc(sizeof *ret, 1);
+    Paragraph *ret;
+
+    ATAG(A_PARAGRAPHS);
+    ret = calloc(sizeof *ret, 1);
+    AUNTAG();
 
     ret->text = ptr;
     ret->typ = typ;
@@ -1195,8 +1366,12 @@ uncache(Cache *cache, ParagraphRoot *d, MMIOT *f)
 
     if ( T(*cache) ) {
 	E(*cache)->next = 0;
-	p = Pp(d, 0, SOURCE);
-	p->down = compile(T(*cache), 1, f);
+	if ( f->stream == STREAM_NOTES )
+	    ___mkd_freeLines(T(*cache));
+	else {
+	    p = Pp(d, 0, SOURCE);
+	    p->down = compile(T(*cache), 1, f);
+	}
 	T(*cache) = E(*cache) = 0;
     }
 }
@@ -1218,6 +1393,10 @@ compile_document(Line *ptr, MMIOT *f)
     int previous_was_break = 1;
 
     while ( ptr ) {
+	if ( OUT_OF_BUDGET(f) ) {
+	    ___mkd_freeLines(ptr);
+	    break;
+	}
 	if ( !is_flag_set(&(f->flags), MKD_NOHTML) && (tag = isopentag(ptr)) ) {
 	    int blocktype;
 	    /* If we encounter a html/style block, compile and save all
@@ -1230,10 +1409,13 @@ compile_document(Line *ptr, MMIOT *f)
 	    else
 		blocktype = strcmp(tag->id, "STYLE") == 0 ? STYLE : HTML;
 	    p = Pp(&d, ptr, blocktype);
-	    ptr = htmlblock(p, tag, &unclosed);
+	    ptr = htmlblock(p, tag, &unclosed, 0);
 	    if ( unclosed ) {
 		p->typ = SOURCE;
-		p->down = compile(p->text, 1, f);
+		if ( f->stream == STREAM_NOTES )
+		    ___mkd_freeLines(p->text);
+		else
+		    p->down = compile(p->text, 1, f);
 		p->text = 0;
 	    }
 	    previous_was_break = 1;
@@ -1243,7 +1425,14 @@ compile_document(Line *ptr, MMIOT *f)
 	     * out of the input stream and file them away for
 	     * later processing
 	     */
+	    ATAG(A_FOOTNOTES);
 	    ptr = consume(addfootnote(ptr, f), &eaten);
+	    AUNTAG();
+	    if ( f->stream == STREAM_BLOCKS ) {
+		/* mkd_stream() picked this one up on the first pass */
+		--S(f->footnotes->note);
+		___mkd_freefootnote(&T(f->footnotes->note)[S(f->footnotes->note)]);
+	    }
 	    previous_was_break = 1;
 	}
 	else if (iscodefence(ptr, 2, 0, &(f->flags))) {
@@ -1258,8 +1447,13 @@ compile_document(Line *ptr, MMIOT *f)
 		while ( (more = more->next) && !iscodefence(more, ptr->count, ptr->kind, &(f->flags)) )
 		    ATTACH(source,more);
 
-		if ( more )
-		    ptr = more;
+		if ( more ) {
+		    /* and the closing fence, so it isn't mistaken
+		     * for the start of another one
+		     */
+		    ATTACH(source,more);
+		    ptr = more->next;
+		}
 		else {
 		    source = checkpoint;
 		    ptr = ptr->next;
@@ -1356,11 +1550,33 @@ compile(Line *ptr, int toplevel, MMIOT *f)
     int para = toplevel;
     int blocks = 0;
     int hdr_type, list_type, list_class, indent;
+    Htmlwalks walks;
 
+    if ( f->budget ) {
+	/* blockquotes and lists recurse back into here, so this is
+	 * where runaway nesting gets caught
+	 */
+	if ( LIMIT_OF(f, MKD_LIMIT_DEPTH)
+		&& (f->budget->depth > LIMIT_OF(f, MKD_LIMIT_DEPTH)) )
+	    ___mkd_overlimit(f, MKD_LIMIT_DEPTH);
+	if ( f->budget->error ) {
+	    if ( ptr )
+		___mkd_freeLines(ptr);
+	    return 0;
+	}
+	f->budget->depth++;
+    }
+
+    CREATE(walks);
     ptr = consume(ptr, &para);
 
     while ( ptr ) {
 
+	if ( OUT_OF_BUDGET(f) ) {
+	    ___mkd_freeLines(ptr);
+	    break;
+	}
+
 	if ( iscode(ptr) ) {
 	    p = Pp(&d, ptr, CODE);
 
@@ -1421,7 +1637,7 @@ compile(Line *ptr, int toplevel, MMIOT *f)
 		/* possibly an html block
 		 */
 
-		ptr = htmlblock(p, tag, &unclosed);
+		ptr = htmlblock(p, tag, &unclosed, &walks);
 		if ( ! unclosed ) {
 		    p->typ = HTML;
 		}
@@ -1444,6 +1660,9 @@ compile(Line *ptr, int toplevel, MMIOT *f)
 	    p->align = PARA;
 
     }
+    freewalks(&walks);
+    if ( f->budget )
+	f->budget->depth--;
     return T(d);
 }
 
@@ -1455,47 +1674,548 @@ compile(Line *ptr, int toplevel, MMIOT *f)
 
 
 /*
- * prepare and compile `text`, returning a Paragraph tree.
+ * set up a document's MMIOT for compiling
  */
-int
-mkd_compile(Document *doc, mkd_flag_t* flags)
+void
+___mkd_prepare(Document *doc, mkd_flag_t *flags)
 {
-    if ( !doc )
-	return 0;
-
-    if ( doc->compiled ) {
-	if ( doc->dirty || DIFFERENT(flags, &doc->ctx->flags) ) {
-	    doc->compiled = doc->dirty = 0;
-	    if ( doc->code)
-		___mkd_freeParagraph(doc->code);
-	    if ( doc->ctx->footnotes )
-		___mkd_freefootnotes(doc->ctx);
-	}
-	else
-	    return 1;
-    }
+    /* hang on to the buffers from the last time the document was
+     * compiled (see ___mkd_recycle())
+     */
+    Cstring in = doc->ctx->in, out = doc->ctx->out;
+    Cstring Q = doc->ctx->Q, tags = doc->ctx->tags;
+    Qtokens tokens = doc->ctx->tokens;
+    Istring brackets = doc->ctx->brackets;
+    Runs runs = doc->ctx->runs, bysize = doc->ctx->bysize;
 
-    doc->compiled = 1;
     memset(doc->ctx, 0, sizeof(MMIOT) );
+    doc->ctx->in = in;
+    S(doc->ctx->in) = 0;
+    doc->ctx->out = out;
+    S(doc->ctx->out) = 0;
+    doc->ctx->brackets = brackets;
+    S(doc->ctx->brackets) = 0;
+    doc->ctx->runs = runs;
+    S(doc->ctx->runs) = 0;
+    doc->ctx->bysize = bysize;
+    S(doc->ctx->bysize) = 0;
+    doc->ctx->Q = Q;
+    S(doc->ctx->Q) = 0;
+    doc->ctx->tokens = tokens;
+    S(doc->ctx->tokens) = 0;
+    doc->ctx->tags = tags;
+    S(doc->ctx->tags) = 0;
     doc->ctx->ref_prefix= doc->ref_prefix;
+    doc->ctx->protocols = doc->protocols;
     doc->ctx->cb        = &(doc->cb);
+    if ( doc->collect_stats )
+	doc->ctx->stats = &(doc->stats);
+    doc->ctx->budget = &(doc->budget);
+    ___mkd_budget(&doc->budget);
     if (flags)
 	COPY_FLAGS(doc->ctx->flags, *flags);
     else
 	mkd_init_flags(&doc->ctx->flags);
-    CREATE(doc->ctx->in);
     doc->ctx->footnotes = malloc(sizeof doc->ctx->footnotes[0]);
     doc->ctx->footnotes->reference = 0;
+    doc->ctx->footnotes->deferred = 0;
     CREATE(doc->ctx->footnotes->note);
 
 
     mkd_initialize();
+}
+
+
+/*
+ * compile one piece of a document that's being streamed
+ */
+Paragraph *
+___mkd_compile_chunk(Line *ptr, MMIOT *f)
+{
+    return compile_document(ptr, f);
+}
+
+
+/*
+ * follow a line of source through compile(), which only sees the code
+ * fences outside of blockquotes and lists (those are compiled on their
+ * own, so a fence inside one doesn't reach past the end of it.)  A
+ * blockquote carries on until a line after a blank line doesn't start
+ * with `>', and a list until a line after a blank line isn't indented
+ * or a new item.  A list only starts at the start of a block, because a
+ * toplevel paragraph swallows the items under it, and any block that
+ * starts with a run of lines (fences and all) turns into a definition
+ * list if a definition comes after them.
+ */
+static void
+follow(struct mkd_chunker *s, Line *t, mkd_flag_t *flags)
+{
+    int after = !s->joined || s->broke;
+    int z;
+
+    s->broke = 0;
 
-    doc->code = compile_document(T(doc->content), doc->ctx);
+    if ( blankline(t) ) {
+	if ( s->dt )
+	    s->dt = 2;
+	return;
+    }
+
+    if ( s->dt ) {
+	if ( is_extra_dd(t) ) {
+	    s->code = s->dt = 0;
+	    s->nest = 2;
+	    s->indent = t->dle + 2;
+	    return;
+	}
+	if ( (s->dt == 2) || iscode(t) || end_of_block(t, flags) )
+	    s->dt = 0;
+    }
+
+    if ( s->code ) {
+	if ( !t->is_checked )
+	    checkline(t, flags);
+
+	if ( (s->kept == s->opened + 1) && (t->kind == chk_dash || t->kind == chk_equal) )
+	    s->code = 0;	/* it was a setext header, not a fence */
+	else if ( iscodefence(t, s->code, s->codekind, flags) ) {
+	    s->code = 0;
+	    s->fenced = s->kept;
+	}
+	return;
+    }
+
+    if ( s->nest && !after ) {
+	/* (a rule under a list item ends the list) */
+	if ( (s->nest == 1) || (t->dle >= s->indent) || !ishr(t, flags) )
+	    return;
+	s->nest = 0;
+    }
+    else if ( (s->nest == 1) && isquote(t) )
+	return;
+    else if ( (s->nest == 2) && (t->dle >= s->indent) )
+	return;
+    else if ( after || isquote(t) ) {
+	/* a new block */
+	s->nest = 0;
+	if ( is_flag_set(flags, MKD_DLEXTRA) && !is_flag_set(flags, MKD_STRICT)
+					     && !iscode(t) && !end_of_block(t, flags) )
+	    s->dt = 1;
+	if ( isquote(t) )
+	    s->nest = 1;
+	else if ( after && !iscode(t) && islist(t, &s->indent, flags, &z) )
+	    s->nest = 2;
+    }
+
+    if ( s->nest )
+	return;
+
+    if ( iscodefence(t, 2, 0, flags) ) {
+	s->code = t->count;
+	s->codekind = t->kind;
+	s->opened = s->kept;
+    }
+    else if ( ishr(t, flags) || ((t->dle == 0) && (S(t->text) > 1) && (T(t->text)[0] == '#')) )
+	s->broke = 1;
+}
+
+
+/*
+ * follow a streamed document through compile_document(), keeping
+ * track of the code fences and html blocks it can't be cut inside
+ * of and of what's been cached up as source.  compile_document()
+ * scoops up everything between a pair of fences, but compile() can
+ * pair them up differently.
+ */
+static void
+track(struct mkd_chunker *s, Line *t, mkd_flag_t *flags)
+{
+    Line rest;
+    int end;
+
+    if ( s->fence ) {
+	if ( iscodefence(t, s->fence, s->fencekind, flags) )
+	    s->fence = 0;
+    }
+    else if ( !s->tag ) {
+	if ( !is_flag_set(flags, MKD_NOHTML) && (s->tag = isopentag(t)) ) {
+	    s->scan = H_TEXT;
+	    s->depth = 0;
+	    s->joined = 0;
+	    s->nest = s->code = s->dt = 0;
+	}
+	else if ( isfootnote(t) ) {
+	    /* (compile() won't see the footnote, so the lines around it
+	     * might go together)
+	     */
+	    s->cut = 0;
+	    s->note = ( is_flag_set(flags, MKD_EXTRA_FOOTNOTE)
+			&& !is_flag_set(flags, MKD_STRICT)
+			&& (T(t->text)[t->dle+1] == '^') ) ? 2 : 1;
+	    return;
+	}
+	else if ( iscodefence(t, 2, 0, flags) ) {
+	    s->fence = t->count;
+	    s->fencekind = t->kind;
+	}
+    }
+
+    if ( s->tag ) {
+	if ( (end = htmlscan(s, t)) < 0 )
+	    return;
+
+	s->tag = 0;
+	if ( end < S(t->text) ) {
+	    /* htmlblock() splits the line here, and compile_document()
+	     * picks up with the rest of it
+	     */
+	    memset(&rest, 0, sizeof rest);
+	    T(rest.text) = T(t->text) + end;
+	    S(rest.text) = S(t->text) - end;
+	    track(s, &rest, flags);
+	}
+	return;
+    }
+
+    follow(s, t, flags);
+    s->joined = !blankline(t);
+}
+
+
+/*
+ * can a block that starts with this line be compiled on its own, or
+ * does it continue a list, blockquote, or definition list above it?
+ */
+static int
+cuttable(Line *t, mkd_flag_t *flags)
+{
+    int z;
+
+    return !( isquote(t) || is_extra_dd(t) || islist(t, &z, flags, &z) );
+}
+
+
+/*
+ * add a line to a streamed document, returning the last line of a
+ * piece that can be cut off and compiled (or 0 if there isn't one
+ * yet.)  A cut can only be made where a new top-level block starts
+ * after a blank line, and only once enough of the following text
+ * has been read to show that the block doesn't continue the one
+ * before it.
+ */
+Line *
+___mkd_chunk(struct mkd_chunker *s, Line *t, mkd_flag_t *flags)
+{
+    Line *ret = 0;
+    int z;
+
+    ++s->lines;
+
+    if ( s->note ) {
+	/* addfootnote() and consume() eat the blank lines after a
+	 * footnote, and the indented ones after an extra footnote
+	 */
+	if ( blankline(t) || ((s->note == 2) && (t->dle >= 4)) ) {
+	    s->prev = t;
+	    return 0;
+	}
+	s->note = 0;
+    }
+    ++s->kept;
+
+    /* (textblock() carries a paragraph with a fenced code block in
+     * it on past a single blank line after the fence)
+     */
+    if ( !(s->fence || s->code || s->tag || s->joined || s->dangling) && s->prev && blankline(s->prev)
+			       && (t->dle == 0) && !blankline(t) && !isfootnote(t)
+			       && !(s->fenced && (s->kept - s->fenced == 2)) ) {
+	if ( s->cut && cuttable(s->cut, flags) )
+	    ret = s->before;
+	s->cut = t;
+	s->before = s->prev;
+    }
+    track(s, t, flags);
+
+    /* (a footnote is taken out before compile() sees the lines around
+     * it, so it doesn't count when lines are counted for compile())
+     */
+    if ( s->note )
+	--s->kept;
+
+    /* a discount definition list term picks up its definition from
+     * past any number of blank lines if the first of them is indented
+     */
+    if ( !blankline(t) )
+	s->dangling = 0;
+    else if ( (t->dle >= 4) && s->prev
+			    && is_flag_set(flags, MKD_DLDISCOUNT)
+			    && !is_flag_set(flags, MKD_STRICT)
+			    && is_discount_dt(s->prev, &z, flags) )
+	s->dangling = 1;
+
+    s->prev = t;
+    return ret;
+}
+
+
+/* a document isn't cut into pieces any smaller than this (in lines)
+ */
+#define PIECE_LINES	1000
+
+/* one piece of a document that's being compiled in parallel
+ */
+struct piece {
+    Line *text;
+    Paragraph *code;
+    MMIOT f;
+    struct footnote_list notes;
+    struct mkd_budget budget;
+} ;
+
+typedef STRING(struct piece) Pieces;
+
+
+static void
+compile_piece(void *ctx, int job, int thread)
+{
+    struct piece *p = (struct piece *)ctx + job;
+
+    p->code = compile_document(p->text, &p->f);
+}
+
+
+/* add a piece of the document to the end of the compiled code; if
+ * the last piece ended in the middle of a source block and this one
+ * carries on with it, the two are joined the way compile_document()
+ * would have done it.
+ */
+static void
+stitch(ParagraphRoot *d, Paragraph *p)
+{
+    Paragraph *q;
+
+    if ( !p )
+	return;
+
+    if ( E(*d) && (E(*d)->typ == SOURCE) && (p->typ == SOURCE) ) {
+	if ( (q = E(*d)->down) ) {
+	    while ( q->next )
+		q = q->next;
+	    q->next = p->down;
+	}
+	else
+	    E(*d)->down = p->down;
+
+	q = p->next;
+	p->down = p->next = 0;
+	___mkd_freeParagraph(p);
+	if ( (p = q) == 0 )
+	    return;
+    }
+
+    if ( E(*d) )
+	E(*d)->next = p;
+    else
+	T(*d) = p;
+    for ( E(*d) = p; E(*d)->next; E(*d) = E(*d)->next )
+	;
+}
+
+
+/*
+ * cut a large document into pieces that compile the same way on their
+ * own (the same places that mkd_stream() uses), compile them on up
+ * to doc->threads threads, then put the pieces and their footnotes
+ * back together in order and give the headers their unique labels.
+ */
+static Paragraph *
+compile_pieces(Document *doc)
+{
+    MMIOT *f = doc->ctx;
+    struct mkd_chunker chunk;
+    ParagraphRoot d = { 0, 0 };
+    Pieces pieces;
+    struct piece *p;
+    Line *t, *next, *end, *start = T(doc->content);
+    int i, j, size, at;
+
+    for ( size=0, t = start; t; t = t->next )
+	++size;
+
+    if ( size < 2 * PIECE_LINES )
+	return compile_document(start, f);
+
+    size /= 4 * doc->threads;
+    if ( size < PIECE_LINES )
+	size = PIECE_LINES;
+
+    CREATE(pieces);
+    memset(&chunk, 0, sizeof chunk);
+    for ( at = 0, t = start; t; t = next ) {
+	next = t->next;
+	if ( (end = ___mkd_chunk(&chunk, t, &f->flags)) && (chunk.lines - at >= size) ) {
+	    EXPAND(pieces).text = start;
+	    start = end->next;
+	    end->next = 0;
+	    at = chunk.lines;
+	}
+    }
+    EXPAND(pieces).text = start;
+
+    for ( i=0; i < S(pieces); i++ ) {
+	p = &T(pieces)[i];
+
+	memset(&p->f, 0, sizeof p->f);
+	p->f.ref_prefix = f->ref_prefix;
+	p->f.protocols = f->protocols;
+	p->f.cb = f->cb;
+	COPY_FLAGS(p->f.flags, f->flags);
+	clear_mkd_flag(&p->f.flags, MKD_TOC);
+	p->budget = doc->budget;
+	p->f.budget = &p->budget;
+	p->notes.reference = p->notes.deferred = 0;
+	CREATE(p->notes.note);
+	p->f.footnotes = &p->notes;
+    }
+
+    ___mkd_parallel(doc->threads, S(pieces), compile_piece, T(pieces));
+
+    for ( i=0; i < S(pieces); i++ ) {
+	p = &T(pieces)[i];
+
+	if ( p->budget.error && !doc->budget.error ) {
+	    doc->budget.error = p->budget.error;
+	    doc->budget.armed = 1;
+	}
+	for ( j=0; j < S(p->notes.note); j++ )
+	    EXPAND(f->footnotes->note) = T(p->notes.note)[j];
+	DELETE(p->notes.note);
+
+	stitch(&d, p->code);
+    }
+    DELETE(pieces);
+
+    if ( is_flag_set(&(f->flags), MKD_TOC) && !is_flag_set(&(f->flags), MKD_STRICT) )
+	___mkd_uniquify(&d, T(d));
+
+    return T(d);
+}
+
+
+/* only the callbacks, or flags that don't change the blocks, are
+ * different, so the compiled document can be displayed the new way
+ * as it is
+ */
+static void
+restyle(Document *doc, mkd_flag_t *flags)
+{
+    if ( flags )
+	COPY_FLAGS(doc->ctx->flags, *flags);
+    else
+	mkd_init_flags(&doc->ctx->flags);
+    doc->ctx->ref_prefix = doc->ref_prefix;
+    doc->ctx->protocols = doc->protocols;
+    doc->dirty = 0;
+
+    /* (the html the pieces were displayed as last time is no good)
+     */
+    if ( doc->edit )
+	doc->edit->stale = 1;
+}
+
+
+/* the lines of a document are used up when it's compiled, so read
+ * them in again (with the new flags, which might change the header
+ * and how tabs are expanded) from the markdown they came from
+ */
+static void
+reread(Document *doc, mkd_flag_t *flags)
+{
+    struct string_stream about;
+
+    if ( T(doc->content) ) ___mkd_freeLines(T(doc->content));
+    if ( doc->title ) ___mkd_freeLine(doc->title);
+    if ( doc->author ) ___mkd_freeLine(doc->author);
+    if ( doc->date ) ___mkd_freeLine(doc->date);
+    T(doc->content) = E(doc->content) = 0;
+    doc->title = doc->author = doc->date = 0;
+    doc->stats.input_bytes = doc->stats.input_lines = 0;
+
+    about.data = T(doc->source);
+    about.size = S(doc->source);
+    __mkd_populate(doc, (int (*)(void*))__mkd_io_strget, &about, flags);
+}
+
+
+/*
+ * prepare and compile `text`, returning a Paragraph tree.
+ * Returns 0 if the document ran into one of its resource limits.
+ */
+int
+mkd_compile(Document *doc, mkd_flag_t* flags)
+{
+    double start;
+
+    if ( !doc )
+	return 0;
+
+    if ( doc->loaded ) {
+	/* there's no markdown to compile it from again, but it's
+	 * still good if only the callbacks have changed
+	 */
+	doc->dirty = 0;
+	return !DIFFERENT(flags, &doc->ctx->flags);
+    }
+
+    if ( doc->compiled ) {
+	if ( !(doc->dirty || DIFFERENT(flags, &doc->ctx->flags)) )
+	    return !doc->budget.error;
+
+	if ( RECOMPILE(flags, &doc->ctx->flags) && !(doc->kept || doc->edit) ) {
+	    /* the markdown wasn't kept, so there's nothing to compile
+	     * it from again; it's left as it was
+	     */
+	    return 0;
+	}
+
+	DELETE(doc->toc);
+	CREATE(doc->toc);
+	doc->html = 0;
+
+	if ( !RECOMPILE(flags, &doc->ctx->flags) ) {
+	    restyle(doc, flags);
+	    return !doc->budget.error;
+	}
+
+	doc->compiled = doc->dirty = 0;
+	if ( doc->edit )
+	    ___mkd_edit_reset(doc);
+	if ( doc->code)
+	    ___mkd_freeParagraph(doc->code);
+	if ( doc->ctx->footnotes )
+	    ___mkd_freefootnotes(doc->ctx);
+	if ( !doc->edit )
+	    reread(doc, flags);
+    }
+
+    start = ___mkd_clock();
+    doc->compiled = 1;
+    ___mkd_prepare(doc, flags);
+
+    /* (step & time limits are counted across the whole document, so a
+     * document that has them is compiled in one piece)
+     */
+    if ( doc->edit )
+	doc->code = ___mkd_edit_compile(doc);
+    else if ( (doc->threads > 1) && !doc->budget.armed )
+	doc->code = compile_pieces(doc);
+    else
+	doc->code = compile_document(T(doc->content), doc->ctx);
     qsort(T(doc->ctx->footnotes->note), S(doc->ctx->footnotes->note),
 		        sizeof T(doc->ctx->footnotes->note)[0],
 			           (stfu)__mkd_footsort);
     memset(&doc->content, 0, sizeof doc->content);
-    return 1;
+    doc->stats.compile_time = ___mkd_clock() - start;
+    return !doc->budget.error;
 }
 
@@ -44,6 +44,7 @@ enum {  MKD_NOLINKS=0,		/* don't do link processing, block <a> tags  */
 	MKD_URLENCODEDANCHOR,	/* urlencode non-identifier chars instead of replacing with dots */
 	MKD_LATEX,		/* handle embedded LaTeX escapes */
 	MKD_ALT_AS_TITLE,	/* use alt text as the title if no title is listed */
+	MKD_KEEPSOURCE,		/* keep the markdown, so it can be compiled again */
 			/* end of user flags */
 	IS_LABEL,
 	MKD_NR_FLAGS };
@@ -62,10 +63,12 @@ void mkd_init_flags(mkd_flag_t *p);
 void ___mkd_or_flags(mkd_flag_t* dst, mkd_flag_t* src);
 int ___mkd_different(mkd_flag_t* dst, mkd_flag_t* src);
 int ___mkd_any_flags(mkd_flag_t* dst, mkd_flag_t* src);
+int ___mkd_recompile(mkd_flag_t* dst, mkd_flag_t* src);
 
 #define ADD_FLAGS(dst,src)	___mkd_or_flags(dst,src)
 #define DIFFERENT(dst,src)	___mkd_different(dst,src)
 #define ANY_FLAGS(dst,src)	___mkd_any_flags(dst,src)
+#define RECOMPILE(dst,src)	___mkd_recompile(dst,src)
 
 /* each input line is read into a Line, which contains the line,
  * the offset of the first non-space character [this assumes 
@@ -112,6 +115,20 @@ typedef struct paragraph {
 
 typedef ANCHOR(Paragraph) ParagraphRoot;
 
+typedef STRING(int) Istring;
+
+/* a run of ` or ~ in the text of a block
+ */
+struct run {
+    int at;			/* where it starts, */
+    int size;			/* how long it is, */
+    int c;			/* and what it's a run of */
+} ;
+
+typedef STRING(struct run) Runs;
+
+#define MKD_NR_PTYPES	(SOURCE+1)
+
 enum { ETX, SETEXT };	/* header types */
 
 /* reference-style links (and images) are stored in an array
@@ -132,19 +149,28 @@ typedef struct footnote {
 } Footnote;
 
 
-typedef struct block {
-    enum { bTEXT, bSTAR, bUNDER } b_type;
-    int  b_count;
-    char b_char;
-    Cstring b_text;
-    Cstring b_post;
-} block;
+/* a run of * or _ in the emphasis queue, and the <em> and <strong>
+ * tags that are put in front of it when it's matched.  It has a slot
+ * in the queue's tags for every character in the run (each match uses
+ * up at least one of them;  the tags it closes are put in from the
+ * front, and the ones it opens from the back.)
+ */
+typedef struct emtoken {
+    int at;			/* where it is in the queued text */
+    char c;			/* '*' or '_' */
+    int size;			/* how long the run was */
+    int count;			/* how much of it is left to match */
+    int fill;			/* how much of it was given up on */
+    int tags;			/* where its slots start */
+    int closed, opened;		/* how many slots are used at each end */
+} emtoken;
 
-typedef STRING(block) Qblock;
+typedef STRING(emtoken) Qtokens;
 
 
 typedef char* (*mkd_callback_t)(const char*, const int, void*);
 typedef void  (*mkd_free_t)(char*, void*);
+typedef int   (*mkd_sink_t)(const char*, const int, void*);
 
 typedef struct callback_data {
     void *e_data;		/* private data for callbacks */
@@ -156,6 +182,23 @@ typedef struct callback_data {
 } Callback_data;
 
 
+/* the url protocols that safe links may use and that are autolinked,
+ * as a trie, so text can be checked against all of them at once
+ */
+struct mkd_trie {
+    char c;
+    char end;			/* a protocol ends with this character */
+    unsigned short down;	/* the characters that can come after it */
+    unsigned short next;	/* another character that can be here */
+} ;
+
+typedef struct protocols {
+    char *list;			/* the protocols, lowercased, with colons */
+    unsigned short start[256];	/* what can come after each first character */
+    struct mkd_trie *node;
+} Protocols;
+
+
 struct escaped { 
     char *text;
     struct escaped *up;
@@ -164,28 +207,178 @@ struct escaped {
 
 struct footnote_list {
     int reference;
+    int deferred;		/* numbers are filled in after a parallel render */
     STRING(Footnote) note;
 } ;
 
 
+/* statistics gathered about a document (the layout of this structure
+ * must match the one published in mkdio.h)
+ */
+struct mkd_stats {
+    long input_bytes;		/* characters read by populate() */
+    long input_lines;		/* lines read by populate() */
+    long paragraphs[MKD_NR_PTYPES];	/* compiled paragraphs, by ->typ */
+    long footnotes;		/* reference links & footnotes defined */
+    long reparses;		/* calls to ___mkd_reparse() */
+    long emphasis;		/* emphasis tokens queued */
+    long links;			/* links & images generated */
+    long callbacks;		/* user callbacks called */
+    long cached;		/* blocks copied out of a cache */
+    long output_bytes;		/* size of the generated html */
+    double callback_time;	/* seconds spent in user callbacks */
+    double populate_time;	/* seconds spent reading input */
+    double compile_time;	/* seconds spent in mkd_compile() */
+    double render_time;		/* seconds spent generating html */
+} ;
+
+
+/* resource limits (the ids must match the ones published in mkdio.h)
+ * and the running tally against them.   A document's MMIOT and every
+ * MMIOT that ___mkd_reparse() makes from it share one of these.
+ */
+enum { MKD_LIMIT_NONE=0, MKD_LIMIT_DEPTH, MKD_LIMIT_REPARSE,
+       MKD_LIMIT_OUTPUT, MKD_LIMIT_EMPHASIS, MKD_LIMIT_STEPS,
+       MKD_LIMIT_TIME, MKD_LIMIT_DEGRADE, MKD_NR_LIMITS };
+
+struct mkd_budget {
+    long limit[MKD_NR_LIMITS];	/* 0 == no limit */
+    long steps;			/* blocks compiled or characters rendered */
+    int depth;			/* current block nesting */
+    int reparse;		/* current ___mkd_reparse() nesting */
+    double deadline;		/* give up when ___mkd_clock() passes this */
+    int armed;			/* step or time limits, or an error */
+    int degraded;		/* skip smartypants & autolinks */
+    int error;			/* the limit that was exceeded */
+} ;
+
+/* check a MMIOT against its budget (OUT_OF_BUDGET() also counts
+ * a step against it)
+ */
+#define OUT_OF_BUDGET(f)	((f)->budget && (f)->budget->armed && ___mkd_step(f))
+#define DEGRADED(f)		((f)->budget && (f)->budget->degraded)
+#define FAILED(f)		((f)->budget && (f)->budget->error)
+#define LIMIT_OF(f,l)		((f)->budget ? (f)->budget->limit[l] : 0)
+
+
+/* somewhere to send generated output as it's finished, instead of
+ * building all of it up in memory
+ */
+struct mkd_sink {
+    mkd_sink_t fn;		/* returns EOF if the write failed */
+    void *ctx;
+    long written;		/* bytes sent to fn so far */
+    int error;			/* fn has failed */
+} ;
+
+#define SINK_TO(s,f,c)	((s).fn = (f), (s).ctx = (c), (s).written = (s).error = 0)
+
+
 /* a magic markdown io thing holds all the data structures needed to
  * do the backend processing of a markdown document
  */
 typedef struct mmiot {
     Cstring out;
     Cstring in;
-    Qblock Q;
+    Cstring Q;			/* the emphasis queue:  text, */
+    Qtokens tokens;		/* the runs of emphasis in it, */
+    Cstring tags;		/* and the tags they were matched with */
     char last;	/* last text character added to out */
     int isp;
     struct escaped *esc;
     char *ref_prefix;
+    Protocols *protocols;	/* (or null for the standard ones) */
     struct footnote_list *footnotes;
     mkd_flag_t flags;
 
     Callback_data *cb;
+    struct mkd_stats *stats;	/* statistics, if they are being collected */
+    struct mkd_budget *budget;	/* resource limits */
+    struct mkd_sink *sink;	/* where to flush finished blocks to */
+    Istring *blocks;		/* where blocks end in ->out */
+    int stream;			/* which pass of mkd_stream() this is */
+#define STREAM_NOTES	1	/* only collecting the footnotes */
+#define STREAM_BLOCKS	2	/* the footnotes have already been collected */
+    Cstring *refs;		/* the tags of the links looked up, for the cache */
+    Istring brackets;		/* where each [ and ( in ->in is closed, */
+    int lastparen;		/* and where the last ) is (see brackets()) */
+    Runs runs;			/* the runs of ` and ~ in ->in, */
+    Runs bysize;		/* the same runs by character and size, */
+    int lastmath[3];		/* where the last $$, \) and \] are, */
+    int indexed;		/* and how much input they're for, plus one (see runs()) */
 } MMIOT;
 
 
+/* what a block (and the state it's rendered in) hashes to, for
+ * finding its html in a mkd_cache
+ */
+struct mkd_hash {
+    unsigned long a, b;
+    Cstring bytes;		/* what was hashed */
+} ;
+
+struct mkd_cache;
+
+
+/* what mkd_stream() needs to know to find the places where a document
+ * can be cut into pieces that compile the same way on their own
+ */
+struct mkd_chunker {
+    Line *prev;			/* the last line read */
+    Line *cut;			/* a place where the input might be cut */
+    Line *before;		/* and the line before it */
+    int lines;			/* how many lines have been read */
+    int kept;			/* (and how many of them compile() will see) */
+    int fence;			/* size of an open code fence */
+    int fencekind;
+    int code;			/* and of the one compile() sees */
+    int codekind;
+    int opened;			/* the line that opened it */
+    int dt;			/* or it might be a definition list term */
+    int broke;			/* the last line was a rule or header */
+    int fenced;			/* the line that closed the last one (of ->kept) */
+    int note;			/* in a footnote (2 for an extra footnote) */
+    int joined;			/* the last line of source wasn't blank */
+    int dangling;		/* a definition list term is waiting for its definition */
+    int nest;			/* in a blockquote (1) or a list (2) */
+    int indent;			/* how far that list's items are indented */
+    struct kw *tag;		/* open html block */
+    int scan;			/* where we are in a tag in that block */
+    int depth;			/* how deeply it's nested */
+    int low;			/* (how shallow it's been, for htmlblock()) */
+    int closing;		/* is it a closing tag? */
+    int i;			/* how much of the tag name has been seen */
+} ;
+
+
+/* a piece of a document that mkd_update() can recompile, and
+ * mkd_document() can re-render, on its own
+ */
+struct mkd_piece {
+    Cstring text;		/* the markdown for this piece */
+    Paragraph *code;		/* what it compiled into */
+    Paragraph *last;		/* its last top-level block */
+    Paragraph *head, *tail;	/* the ends of the source blocks it starts & ends with */
+    Paragraph *unit;		/* the first block htmlify() displays */
+    int opens;			/* it starts with an html block */
+    struct footnote_list notes;	/* the footnotes it defines */
+    Cstring html;		/* what it was rendered as last time */
+    Cstring labels;		/* and the header labels it was rendered with */
+    char before;		/* and the last character written before it */
+    char after;			/* the last character it wrote */
+    int fresh;			/* is ->html any good? */
+} ;
+
+/* what mkd_update() needs to know about a document
+ */
+struct mkd_edit {
+    mkd_flag_t flags;		/* the flags the document was read with */
+    STRING(struct mkd_piece) pieces;
+    STRING(Paragraph**) links;	/* where the pieces were joined together */
+    int stale;			/* the footnotes changed, so render everything */
+} ;
+
+
 #define MKD_EOLN	'\r'
 
 
@@ -203,14 +396,31 @@ typedef struct document {
     Line *author;
     Line *date;
     ANCHOR(Line) content;	/* uncompiled text, not valid after compile() */
+    Cstring source;		/* the markdown it was read from, for compiling it again */
+    int kept;			/* (if it was read with MKD_KEEPSOURCE) */
     Paragraph *code;		/* intermediate code generated by compile() */
     int compiled;		/* set after mkd_compile() */
     int dirty;			/* flags or callbacks changed */
     int html;			/* set after (internal) htmlify() */
     int tabstop;		/* for properly expanding tabs (ick) */
     char *ref_prefix;
+    Protocols *protocols;	/* from mkd_protocols() */
     MMIOT *ctx;			/* backend buffers, flags, and structures */
     Callback_data cb;		/* callback functions & private data */
+    int collect_stats;		/* keep statistics for mkd_stats()? */
+    struct mkd_stats stats;
+    struct mkd_budget budget;	/* resource limits for this document */
+    Istring blocks;		/* block boundaries in the generated html */
+    int footnotes;		/* where the footnotes start in the html */
+    Cstring toc;		/* table of contents, for mkd_iovec() */
+    struct iovec *iov;		/* mkd_iovec() results */
+    int nr_iov;
+    FILE *stream;		/* mkd_stream() input */
+    long stream_at;		/* where the markdown starts in ->stream */
+    int threads;		/* how many threads to compile & render with */
+    struct mkd_edit *edit;	/* mkd_update() state */
+    struct mkd_cache *cache;	/* html for blocks, kept from one render to the next */
+    int loaded;			/* from mkd_load_compiled(), so it can't be compiled again */
 } Document;
 
 
@@ -270,6 +480,75 @@ extern void mkd_initialize(void);
 extern void mkd_shlib_destructor(void);
 
 extern void mkd_ref_prefix(Document*, char*);
+extern int  mkd_protocols(Document*, char*);
+
+extern void mkd_collect_stats(Document*, int);
+extern int  mkd_stats(Document*, struct mkd_stats*);
+extern int  mkd_generatestats(Document*, FILE*);
+
+extern int  mkd_sink_html(Document*, mkd_sink_t, void*);
+extern int  mkd_sink_toc(Document*, mkd_sink_t, void*);
+extern int  mkd_sink_css(Document*, mkd_sink_t, void*);
+extern int  mkd_sink_xml(char*, int, mkd_sink_t, void*);
+extern int  mkd_sink_xhtmlpage(Document*, mkd_flag_t*, mkd_sink_t, void*);
+
+/* parts of the document for mkd_iovec() (must match mkdio.h)
+ */
+enum { MKD_IOV_TOC=1, MKD_IOV_BODY=2, MKD_IOV_FOOTNOTES=4 };
+#define MKD_IOV_ALL	(MKD_IOV_TOC|MKD_IOV_BODY|MKD_IOV_FOOTNOTES)
+
+extern int  mkd_iovec(Document*, int, struct iovec**);
+
+extern int  mkd_set_limit(Document*, int, long);
+extern int  mkd_error(Document*);
+
+extern int  mkd_set_threads(Document*, int);
+
+extern Document *mkd_stream_in(FILE*, mkd_flag_t*);
+extern int  mkd_stream(Document*, mkd_flag_t*, mkd_sink_t, void*);
+
+/* a job for mkd_batch() (must match mkdio.h)
+ */
+struct mkd_job {
+    const char *text;
+    int size;
+    const char *file;
+    mkd_flag_t *flags;
+    mkd_callback_t e_url, e_flags, e_anchor, e_codefmt;
+    mkd_free_t e_free;
+    void *e_data;
+    void *ctx;
+} ;
+
+typedef void (*mkd_done_t)(struct mkd_job*, Document*, void*);
+
+extern int  mkd_batch(struct mkd_job*, int, int, mkd_done_t, void*);
+
+extern Document *mkd_edit_string(const char*, int, mkd_flag_t*);
+extern int  mkd_update(Document*, int, int, const char*, int);
+
+extern struct mkd_cache *mkd_new_cache(int);
+extern void mkd_free_cache(struct mkd_cache*);
+extern int  mkd_use_cache(Document*, struct mkd_cache*);
+
+extern int  mkd_save_compiled(Document*, FILE*);
+extern Document *mkd_load_compiled(const char*, int);
+
+/* what mkd_render() renders with, and into (must match mkdio.h)
+ */
+struct mkd_render {
+    mkd_callback_t e_url, e_flags, e_anchor, e_codefmt;
+    mkd_free_t e_free;
+    void *e_data;
+    char *ref_prefix;
+    mkd_flag_t *flags;
+    char *html;
+    int size;
+    int alloc;
+} ;
+
+extern int  mkd_render(Document*, struct mkd_render*);
+extern void mkd_free_render(struct mkd_render*);
 
 /* internal resource handling functions.
  */
@@ -281,12 +560,49 @@ extern void ___mkd_freefootnotes(MMIOT *);
 extern void ___mkd_initmmiot(MMIOT *, void *);
 extern void ___mkd_freemmiot(MMIOT *, void *);
 extern void ___mkd_freeLineRange(Line *, Line *);
+extern void ___mkd_recycle(Document *);
 extern void ___mkd_xml(char *, int, FILE *);
 extern void ___mkd_reparse(char *, int, mkd_flag_t*, MMIOT*, char*);
 extern void ___mkd_emblock(MMIOT*);
 extern void ___mkd_tidy(Cstring *);
+extern double ___mkd_clock(void);
+extern char *___mkd_callback(MMIOT*, mkd_callback_t, const char*, int, void*);
+extern int  ___mkd_sink_document(Document *, struct mkd_sink *);
+extern int  ___mkd_flush(Cstring *, struct mkd_sink *);
+extern int  ___mkd_fsink(const char *, const int, void *);
+extern int  ___mkd_xmlsink(const char *, const int, void *);
+extern void ___mkd_budget(struct mkd_budget *);
+extern int  ___mkd_step(MMIOT *);
+extern int  ___mkd_overlimit(MMIOT *, int);
+extern void ___mkd_prepare(Document *, mkd_flag_t *);
+extern Paragraph *___mkd_compile_chunk(Line *, MMIOT *);
+extern Line *___mkd_chunk(struct mkd_chunker *, Line *, mkd_flag_t *);
+extern void ___mkd_stream_blocks(Paragraph *, MMIOT *, int *);
+extern void ___mkd_stream_end(MMIOT *, int *);
+extern void ___mkd_parallel(int, int, void (*)(void *, int, int), void *);
+extern void ___mkd_census(Paragraph *, long *);
+extern Paragraph *___mkd_edit_compile(Document *);
+extern void ___mkd_edit_reset(Document *);
+extern void ___mkd_edit_free(Document *);
+extern int  ___mkd_cache_get(struct mkd_cache *, Paragraph *, MMIOT *, struct mkd_hash *, struct mkd_hash *);
+extern void ___mkd_cache_put(struct mkd_cache *, struct mkd_hash *, MMIOT *, int, Cstring *, struct mkd_hash *);
+extern int  ___mkd_clean(const char *, int, int);
+extern Protocols *___mkd_protocols(char *);
+extern void ___mkd_free_protocols(Protocols *);
+extern int  ___mkd_isprotocol(MMIOT *, char *, int);
+
+/* what kinds of escaping a character needs (from ___mkd_escapes[])
+ */
+#define ESC_HTML	0x01	/* & < > */
+#define ESC_CODE	0x02	/* ESC_HTML, and \ and hard returns in code */
+#define ESC_XML		0x04	/* & < > " ' */
+#define ESC_URL		0x08	/* not a letter, digit, or punctuation in a url */
+#define ESC_SPACE	0x10	/* whitespace (left alone in urls that are displayed) */
+
+extern const unsigned char ___mkd_escapes[256];
 
 extern Document *__mkd_new_Document(void);
+extern void __mkd_populate(Document *, int (*)(void *), void *, mkd_flag_t *);
 extern void __mkd_enqueue(Document*, Cstring *);
 extern void __mkd_trim_line(Line *, int);
 
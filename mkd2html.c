@@ -3,11 +3,13 @@
  *
  * usage:  mkd2html [options] filename
  *  or     mkd2html [options] < markdown > html
+ *  or     mkd2html [options] -j count filename...
  *
  *  options
  *         -css css-file
  *         -header line-to-add-to-<HEADER>
  *         -footer line-to-add-before-</BODY>
+ *         -j count (write each filename.html with up to count threads)
  *
  * example:
  *
@@ -69,13 +71,14 @@ fail(char *why, ...)
 }
 
 
-enum { GFM, ADD_CSS, ADD_HEADER, ADD_FOOTER };
+enum { GFM, ADD_CSS, ADD_HEADER, ADD_FOOTER, JOBS };
 
 struct h_opt opts[] = {
     { GFM,           "gfm",'G', 0,       "Github style markdown" },
     { ADD_CSS,       "css", 0, "url",    "Additional css for this page" },
     { ADD_HEADER, "header", 0, "header", "Additional headers for this page" },
     { ADD_FOOTER, "footer", 0, "footer", "Additional footers for this page" },
+    { JOBS,             0, 'j', "count", "Write each source.html with up to `count` threads" },
 };
 #define NROPTS (sizeof opts/sizeof opts[0])
 
@@ -83,17 +86,184 @@ struct h_opt opts[] = {
 extern char* mkd_h1_title(MMIOT *);
 #endif
 
+STRING(char*) css, headers, footers;
+
+
+/* find the markdown for `name`, which is either name or name.text
+ */
+static char *
+sourcefile(char *name)
+{
+    char *source = malloc(strlen(name) + 6);
+    FILE *input;
+
+    if ( !source )
+	fail("out of memory allocating name buffers");
+
+    strcpy(source, name);
+    if ( (input = fopen(source, "r")) == 0 ) {
+	strcat(source, ".text");
+	if ( (input = fopen(source, "r")) == 0 )
+	    fail("can't open either %s or %s", name, source);
+    }
+    fclose(input);
+    return source;
+}
+
+
+/* name.html (unless name is a device or some other special file)
+ */
+static char *
+destfile(char *name)
+{
+    char *dest = malloc(strlen(name) + 6);
+    char *dot;
+
+    if ( !dest )
+	fail("out of memory allocating name buffers");
+
+    strcpy(dest, name);
+    if ( notspecial(dest) ) {
+	if (( dot = strrchr(dest, '.') ))
+	    *dot = 0;
+	strcat(dest, ".html");
+    }
+    return dest;
+}
+
+
+/* write a compiled document as a web page
+ */
+static void
+page(MMIOT *mmiot, FILE *output)
+{
+    char *h;
+    int i;
+
+    h = mkd_doc_title(mmiot);
+#if USE_H1TITLE
+    if ( ! h )
+	h = mkd_h1_title(mmiot);
+#endif
+
+    /* print a header */
+
+    fprintf(output,
+	"<!doctype html>\n"
+	"<html>\n"
+	"<head>\n"
+	"  <meta name=\"GENERATOR\" content=\"mkd2html %s\">\n", markdown_version);
+
+    fprintf(output,"  <meta http-equiv=\"Content-Type\""
+		          " content=\"text/html; charset=utf-8\">\n");
+
+    for ( i=0; i < S(css); i++ )
+	fprintf(output, "  <link rel=\"stylesheet\"\n"
+			"        type=\"text/css\"\n"
+			"        href=\"%s\" />\n", T(css)[i]);
+
+    fprintf(output,"  <title>");
+    if ( h )
+	mkd_generateline(h, strlen(h), output, 0);
+    /* xhtml requires a <title> in the header, even if it doesn't
+     * contain anything
+     */
+    fprintf(output, "</title>\n");
+    
+    for ( i=0; i < S(headers); i++ )
+	fprintf(output, "  %s\n", T(headers)[i]);
+    fprintf(output, "</head>\n"
+		    "<body>\n");
+
+    /* print the compiled body */
+
+    mkd_generatehtml(mmiot, output);
+
+    for ( i=0; i < S(footers); i++ )
+	fprintf(output, "%s\n", T(footers)[i]);
+    
+    fprintf(output, "</body>\n"
+		    "</html>\n");
+}
+
+
+/* a -j page, and what happened to it
+ */
+struct job {
+    char *source, *dest;
+    enum { UNREAD=0, UNWRITTEN, WRITTEN } status;
+} ;
+
+
+/* mkd_batch() completion function
+ */
+static void
+batch_done(struct mkd_job *job, MMIOT *mmiot, void *ctx)
+{
+    struct job *pg = job->ctx;
+    FILE *output;
+
+    if ( !mmiot )
+	return;
+
+    pg->status = UNWRITTEN;
+    if ( (output = fopen(pg->dest, "w")) == 0 )
+	return;
+    page(mmiot, output);
+    if ( fclose(output) == 0 )
+	pg->status = WRITTEN;
+}
+
+
+/* -j: write source.html for each of a pile of sources, with up to
+ * `threads` threads
+ */
+static int
+batch(int count, char **names, int threads)
+{
+    struct mkd_job *jobs = calloc(count, sizeof jobs[0]);
+    struct job *pages = calloc(count, sizeof pages[0]);
+    int i, rc = 0;
+
+    if ( !(jobs && pages) )
+	fail("out of memory allocating jobs");
+
+    for ( i=0; i < count; i++ ) {
+	pages[i].source = sourcefile(names[i]);
+	pages[i].dest = destfile(names[i]);
+	jobs[i].file = pages[i].source;
+	jobs[i].ctx = &pages[i];
+    }
+
+    if ( mkd_batch(jobs, count, threads, batch_done, 0) == EOF )
+	fail("can't start the batch");
+
+    for ( i=0; i < count; i++ ) {
+	if ( pages[i].status == UNREAD ) {
+	    fprintf(stderr, "%s: can't read %s\n", pgm, pages[i].source);
+	    rc = 1;
+	}
+	else if ( pages[i].status == UNWRITTEN ) {
+	    fprintf(stderr, "%s: can't write to %s\n", pgm, pages[i].dest);
+	    rc = 1;
+	}
+	free(pages[i].source);
+	free(pages[i].dest);
+    }
+    free(pages);
+    free(jobs);
+    return rc;
+}
+
 
 int
 main(int argc, char **argv)
 {
-    char *h;
     char *source = 0, *dest = 0;
     MMIOT *mmiot;
-    int i;
     int gfm = 0;
+    int threads = 0;
     FILE *input, *output; 
-    STRING(char*) css, headers, footers;
     struct h_opt *res;
     struct h_context flags;
 
@@ -124,6 +294,10 @@ main(int argc, char **argv)
 	case GFM:
 	    gfm = 1;
 	    break;
+	case JOBS:
+	    if ( (threads = atoi(hoptarg(&flags))) < 1 )
+		fail("-j needs a count of at least 1");
+	    break;
 	default:
 	    fprintf(stderr, "unknown option?\n");
 	    break;
@@ -133,8 +307,15 @@ main(int argc, char **argv)
     argc -= hoptind(&flags);
     argv += hoptind(&flags);
 
+    if ( threads ) {
+	if ( gfm )
+	    fail("-j can't be used with -G");
+	if ( argc == 0 )
+	    fail("-j needs files to read");
+	exit(batch(argc, argv, threads));
+    }
+
     switch ( argc ) {
-	char *p, *dot;
     case 0:
 	input = stdin;
 	output = stdout;
@@ -142,30 +323,11 @@ main(int argc, char **argv)
     
     case 1:
     case 2:
-	dest   = malloc(strlen(argv[argc-1]) + 6);
-	source = malloc(strlen(argv[0]) + 6);
-
-	if ( !(source && dest) )
-	    fail("out of memory allocating name buffers");
-
-	strcpy(source, argv[0]);
-	strcpy(dest, argv[argc-1]);
-	if (( p = strrchr(source, '/') ))
-	    p = source;
-	else
-	    ++p;
-
-	if ( (input = fopen(source, "r")) == 0 ) {
-	    strcat(source, ".text");
-	    if ( (input = fopen(source, "r")) == 0 )
-		fail("can't open either %s or %s", argv[0], source);
-	}
+	source = sourcefile(argv[0]);
+	dest = destfile(argv[argc-1]);
 
-	if ( notspecial(dest) ) {
-	    if (( dot = strrchr(dest, '.') ))
-		*dot = 0;
-	    strcat(dest, ".html");
-	}
+	if ( (input = fopen(source, "r")) == 0 )
+	    fail("can't open %s", source);
 
 	if ( (output = fopen(dest, "w")) == 0 )
 	    fail("can't write to %s", dest);
@@ -184,52 +346,8 @@ main(int argc, char **argv)
     if ( !mkd_compile(mmiot, 0) )
 	fail("couldn't compile input");
 
+    page(mmiot, output);
 
-    h = mkd_doc_title(mmiot);
-#if USE_H1TITLE
-    if ( ! h )
-	h = mkd_h1_title(mmiot);
-#endif
-
-    /* print a header */
-
-    fprintf(output,
-	"<!doctype html>\n"
-	"<html>\n"
-	"<head>\n"
-	"  <meta name=\"GENERATOR\" content=\"mkd2html %s\">\n", markdown_version);
-
-    fprintf(output,"  <meta http-equiv=\"Content-Type\""
-		          " content=\"text/html; charset=utf-8\">\n");
-
-    for ( i=0; i < S(css); i++ )
-	fprintf(output, "  <link rel=\"stylesheet\"\n"
-			"        type=\"text/css\"\n"
-			"        href=\"%s\" />\n", T(css)[i]);
-
-    fprintf(output,"  <title>");
-    if ( h )
-	mkd_generateline(h, strlen(h), output, 0);
-    /* xhtml requires a <title> in the header, even if it doesn't
-     * contain anything
-     */
-    fprintf(output, "</title>\n");
-    
-    for ( i=0; i < S(headers); i++ )
-	fprintf(output, "  %s\n", T(headers)[i]);
-    fprintf(output, "</head>\n"
-		    "<body>\n");
-
-    /* print the compiled body */
-
-    mkd_generatehtml(mmiot, output);
-
-    for ( i=0; i < S(footers); i++ )
-	fprintf(output, "%s\n", T(footers)[i]);
-    
-    fprintf(output, "</body>\n"
-		    "</html>\n");
-    
     mkd_cleanup(mmiot);
     exit(0);
 }
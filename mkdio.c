@@ -41,12 +41,14 @@ __mkd_new_Document(void)
 void
 __mkd_enqueue(Document* a, Cstring *line)
 {
-    Line *p = calloc(sizeof *p, 1);
+    Line *p;
     unsigned char c;
     int xp = 0;
     int           size = S(*line);
     unsigned char *str = (unsigned char*)T(*line);
 
+    ATAG(A_LINES);
+    p = calloc(sizeof *p, 1);
     CREATE(p->text);
     ATTACH(a->content, p);
 
@@ -71,6 +73,7 @@ __mkd_enqueue(Document* a, Cstring *line)
     EXPAND(p->text) = 0;
     S(p->text)--;
     p->dle = mkd_firstnonblank(p);
+    AUNTAG();
 }
 
 
@@ -90,24 +93,21 @@ __mkd_trim_line(Line *p, int clip)
 }
 
 
-/* build a Document from any old input.
+/* read any old input into a (new or recycled) Document
  */
 typedef int (*getc_func)(void*);
 
-Document *
-populate(getc_func getc, void* ctx, mkd_flag_t *flags)
+void
+__mkd_populate(Document *a, getc_func getc, void* ctx, mkd_flag_t *flags)
 {
     Cstring line;
-    Document *a = __mkd_new_Document();
     int c;
     int pandoc = 0;
+    double start = ___mkd_clock();
 
     if ( flags && (is_flag_set(flags, MKD_NOHEADER) || is_flag_set(flags, MKD_STRICT)) )
 	pandoc= EOF;
 
-    if ( !a ) return 0;
-
-
     if ( flags && (is_flag_set(flags, MKD_TABSTOP) || is_flag_set(flags, MKD_STRICT)) )
 	a->tabstop = 4;
     else
@@ -115,7 +115,9 @@ populate(getc_func getc, void* ctx, mkd_flag_t *flags)
 
     CREATE(line);
 
+    ATAG(A_LINES);
     while ( (c = (*getc)(ctx)) != EOF ) {
+	a->stats.input_bytes++;
 	if ( c == '\n' ) {
 	    if ( pandoc != EOF && pandoc < 3 ) {
 		if ( S(line) && (T(line)[0] == '%') )
@@ -124,16 +126,21 @@ populate(getc_func getc, void* ctx, mkd_flag_t *flags)
 		    pandoc = EOF;
 	    }
 	    __mkd_enqueue(a, &line);
+	    a->stats.input_lines++;
 	    S(line) = 0;
 	}
 	else if ( (c & 0x80) || isprint(c) || isspace(c) )
 	    EXPAND(line) = c;
     }
 
-    if ( S(line) )
+    if ( S(line) ) {
 	__mkd_enqueue(a, &line);
+	a->stats.input_lines++;
+    }
 
     DELETE(line);
+    AUNTAG();
+    AINPUT(a->stats.input_bytes);
 
     if ( pandoc == 3 ) {
 	/* the first three lines started with %, so we have a header.
@@ -149,16 +156,66 @@ populate(getc_func getc, void* ctx, mkd_flag_t *flags)
 	T(a->content) = headers->next->next->next;
     }
 
+    a->stats.populate_time = ___mkd_clock() - start;
+}
+
+
+/* build a Document from any old input.
+ */
+Document *
+populate(getc_func getc, void* ctx, mkd_flag_t *flags)
+{
+    Document *a = __mkd_new_Document();
+
+    if ( a )
+	__mkd_populate(a, getc, ctx, flags);
     return a;
 }
 
 
-/* convert a file into a linked list
+/* a file being read, and a copy of what's been read from it
+ */
+struct kept {
+    FILE *f;
+    Cstring text;
+} ;
+
+static int
+keptc(struct kept *k)
+{
+    int c = fgetc(k->f);
+
+    if ( c != EOF ) {
+	if ( S(k->text) >= ALLOCATED(k->text) )
+	    RESERVE(k->text, S(k->text)+1);
+	EXPAND(k->text) = c;
+    }
+    return c;
+}
+
+
+/* convert a file into a linked list (keeping the markdown if asked,
+ * so it can be compiled again with different flags)
  */
 Document *
 mkd_in(FILE *f, mkd_flag_t *flags)
 {
-    return populate((getc_func)fgetc, f, flags);
+    struct kept k;
+    Document *doc;
+
+    if ( !(flags && is_flag_set(flags, MKD_KEEPSOURCE)) )
+	return populate((getc_func)fgetc, f, flags);
+
+    k.f = f;
+    CREATE(k.text);
+
+    if ( doc = populate((getc_func)keptc, &k, flags) ) {
+	doc->source = k.text;
+	doc->kept = 1;
+    }
+    else
+	DELETE(k.text);
+    return doc;
 }
 
 
@@ -182,31 +239,69 @@ mkd_string(const char *buf, int len, mkd_flag_t* flags)
 {
     struct string_stream about;
 
+    Document *doc;
+
     about.data = buf;
     about.size = len;
 
-    return populate((getc_func)__mkd_io_strget, &about, flags);
+    doc = populate((getc_func)__mkd_io_strget, &about, flags);
+
+    if ( doc && flags && is_flag_set(flags, MKD_KEEPSOURCE) ) {
+	if ( len > 0 )
+	    SUFFIX(doc->source, (char*)buf, len);
+	doc->kept = 1;
+    }
+    return doc;
+}
+
+
+/* a sink that writes to a file
+ */
+int
+___mkd_fsink(const char *bfr, const int size, void *output)
+{
+    return (fwrite(bfr, 1, size, (FILE*)output) == size) ? size : EOF;
 }
 
 
-/* write the html to a file (xmlified if necessary)
+/* write the html to a sink (xmlified if necessary)
  */
 int
-mkd_generatehtml(Document *p, FILE *output)
+mkd_sink_html(Document *p, mkd_sink_t fn, void *ctx)
 {
-    char *doc;
-    int szdoc;
+    struct mkd_sink out, xml;
 
-    DO_OR_DIE( szdoc = mkd_document(p,&doc) );
-    if ( is_flag_set( &(p->ctx->flags), MKD_CDATA ) )
-	DO_OR_DIE( mkd_generatexml(doc, szdoc, output) );
-    else if ( fwrite(doc, szdoc, 1, output) != 1 )
+    if ( !(p && fn) )
 	return EOF;
-    DO_OR_DIE( putc('\n', output) );
+
+    if ( is_flag_set( &(p->ctx->flags), MKD_CDATA ) ) {
+	SINK_TO(xml, fn, ctx);
+	SINK_TO(out, ___mkd_xmlsink, &xml);
+    }
+    else
+	SINK_TO(out, fn, ctx);
+
+    DO_OR_DIE( ___mkd_sink_document(p, &out) );
+
+    /* (a document that didn't turn into any html isn't followed by a
+     * newline either, unless it's being written as xml)
+     */
+    if ( out.written || is_flag_set( &(p->ctx->flags), MKD_CDATA ) ) {
+	DO_OR_DIE( (*fn)("\n", 1, ctx) );
+    }
     return 0;
 }
 
 
+/* write the html to a file (xmlified if necessary)
+ */
+int
+mkd_generatehtml(Document *p, FILE *output)
+{
+    return mkd_sink_html(p, ___mkd_fsink, output);
+}
+
+
 /* convert some markdown text to html
  */
 int
@@ -296,7 +391,7 @@ mkd_string_to_anchor(char *s, int len, mkd_sta_function_t outchar,
 	return;
 
     if ( f->cb->e_anchor )
-	res = (*(f->cb->e_anchor))(line, size, f->cb->e_data);
+	res = ___mkd_callback(f, f->cb->e_anchor, line, size, f->cb->e_data);
     else
 	res = mkd_anchor_format(line, size, labelformat, &(f->flags));
 
@@ -466,9 +561,35 @@ mkd_ref_prefix(Document *f, char *data)
 	if ( f->ref_prefix != data )
 	    f->dirty = 1;
 	f->ref_prefix = data;
+	/* (a loaded document won't be compiled again to pick it up)
+	 */
+	if ( f->loaded )
+	    f->ctx->ref_prefix = data;
     }
 }
 
+
+/* set the url protocols (a comma-separated list, or null for the
+ * standard ones) that safe links may use and that are autolinked
+ */
+int
+mkd_protocols(Document *f, char *list)
+{
+    Protocols *p = 0;
+
+    if ( !f || (list && !(p = ___mkd_protocols(list))) )
+	return EOF;
+
+    ___mkd_free_protocols(f->protocols);
+    f->protocols = p;
+    f->dirty = 1;
+    /* (the old ones are gone, and a loaded document won't be compiled
+     * again to pick up the new ones)
+     */
+    f->ctx->protocols = p;
+    return 0;
+}
+
 #if 0
 static void
 sayflags(char *pfx, mkd_flag_t* flags, FILE *output)
@@ -550,3 +671,40 @@ ___mkd_any_flags(mkd_flag_t *dst, mkd_flag_t *src)
 
     return count;
 }
+
+
+/* the flags that change how a document is read in and cut up into
+ * blocks (the rest only change how the blocks are displayed)
+ */
+static int compiling[] = {
+    MKD_NOHTML, MKD_NORMAL_LISTITEM, MKD_EXPLICITLIST, MKD_STRICT,
+    MKD_NOTABLES, MKD_1_COMPAT, MKD_TOC, MKD_NOHEADER, MKD_TABSTOP,
+    MKD_NODIVQUOTE, MKD_NOALPHALIST, MKD_EXTRA_FOOTNOTE, MKD_NOSTYLE,
+    MKD_DLDISCOUNT, MKD_DLEXTRA, MKD_FENCEDCODE,
+} ;
+#define NR_COMPILING	(sizeof compiling / sizeof compiling[0])
+
+/* does a document compiled with one set of flags have to be compiled
+ * again to be displayed with the other?
+ */
+int
+___mkd_recompile(mkd_flag_t *dst, mkd_flag_t *src)
+{
+    int i;
+    mkd_flag_t zeroes;
+
+    if ( dst == 0 || src == 0 ) {
+	mkd_init_flags(&zeroes);
+	if ( !dst )
+	    dst = &zeroes;
+	if ( !src )
+	    src = &zeroes;
+    }
+
+    for (i=0; i < NR_COMPILING; i++)
+	if ( is_flag_set(src,compiling[i]) != is_flag_set(dst,compiling[i]) )
+	    return 1;
+
+    return 0;
+}
+
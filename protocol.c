@@ -0,0 +1,190 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+/* the protocols that are used when a document doesn't say which ones
+ * to use (https:, http:, news:, and ftp:), as ___mkd_protocols() would
+ * build them.  Node 0 is where the first characters hang from.
+ */
+static struct mkd_trie standard[] = {
+    { 0,   0, 13,  0 },	/*  0 */
+    { 'h', 0,  2,  0 },	/*  1 */
+    { 't', 0,  3,  0 },	/*  2 */
+    { 't', 0,  4,  0 },	/*  3 */
+    { 'p', 0,  7,  0 },	/*  4 */
+    { 's', 0,  6,  0 },	/*  5 */
+    { ':', 1,  0,  0 },	/*  6 */
+    { ':', 1,  0,  5 },	/*  7 */
+    { 'n', 0,  9,  1 },	/*  8 */
+    { 'e', 0, 10,  0 },	/*  9 */
+    { 'w', 0, 11,  0 },	/* 10 */
+    { 's', 0, 12,  0 },	/* 11 */
+    { ':', 1,  0,  0 },	/* 12 */
+    { 'f', 0, 14,  8 },	/* 13 */
+    { 't', 0, 15,  0 },	/* 14 */
+    { 'p', 0, 16,  0 },	/* 15 */
+    { ':', 1,  0,  0 },	/* 16 */
+} ;
+
+static Protocols defaults = {
+    "https:,http:,news:,ftp:",
+    {
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 00 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 10 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 20 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 30 */
+	 0,  0,  0,  0,  0,  0, 14,  0,  2,  0,  0,  0,  0,  0,  9,  0,	/* 40 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 50 */
+	 0,  0,  0,  0,  0,  0, 14,  0,  2,  0,  0,  0,  0,  0,  9,  0,	/* 60 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 70 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 80 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* 90 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* a0 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* b0 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* c0 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* d0 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* e0 */
+	 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,	/* f0 */
+    },
+    standard,
+} ;
+
+typedef STRING(struct mkd_trie) Trie;
+
+
+/* find (or add) the node for character `c` after node `x`
+ */
+static int
+branch(Trie *trie, int x, int c)
+{
+    struct mkd_trie *t;
+    int y;
+
+    for ( y = T(*trie)[x].down; y; y = T(*trie)[y].next )
+	if ( T(*trie)[y].c == c )
+	    return y;
+
+    if ( (y = S(*trie)) > USHRT_MAX )
+	return 0;
+
+    t = &EXPAND(*trie);
+    t->c = c;
+    t->end = 0;
+    t->down = 0;
+    t->next = T(*trie)[x].down;
+    T(*trie)[x].down = y;
+    return y;
+}
+
+
+/* build a trie from a comma-separated list of protocols (with or
+ * without their trailing colons);  returns a null pointer if
+ * something in the list isn't a protocol.
+ */
+Protocols *
+___mkd_protocols(char *list)
+{
+    Trie trie;
+    Protocols *res;
+    Cstring names;
+    unsigned char *p;
+    int x, y, i;
+
+    CREATE(trie);
+    CREATE(names);
+    memset(&EXPAND(trie), 0, sizeof T(trie)[0]);
+
+    for ( p = (unsigned char *)list; *p; ) {
+	while ( *p == ',' || isspace(*p) )
+	    ++p;
+	if ( !*p )
+	    break;
+
+	/* protocol/method is [alpha][alnum or '+.-'] */
+	if ( !isalpha(*p) )
+	    goto bad;
+	if ( S(names) )
+	    EXPAND(names) = ',';
+	for ( x=0; isalnum(*p) || *p == '.' || *p == '+' || *p == '-'; ++p ) {
+	    if ( !(x = branch(&trie, x, tolower(*p))) )
+		goto bad;
+	    EXPAND(names) = tolower(*p);
+	}
+	if ( *p == ':' )
+	    ++p;
+	if ( !(*p == 0 || *p == ',' || isspace(*p)) || !(x = branch(&trie, x, ':')) )
+	    goto bad;
+	EXPAND(names) = ':';
+	T(trie)[x].end = 1;
+    }
+    EXPAND(names) = 0;
+
+    if ( !(res = calloc(1, sizeof *res)) )
+	goto bad;
+
+    for ( y = T(trie)[0].down; y; y = T(trie)[y].next ) {
+	i = T(trie)[y].c;
+	res->start[i] = res->start[toupper(i)] = T(trie)[y].down;
+    }
+    res->list = T(names);
+    res->node = T(trie);
+    return res;
+
+bad:
+    DELETE(trie);
+    DELETE(names);
+    return 0;
+}
+
+
+void
+___mkd_free_protocols(Protocols *p)
+{
+    if ( p && (p != &defaults) ) {
+	free(p->list);
+	free(p->node);
+	free(p);
+    }
+}
+
+
+/* does `text` start with one of the protocols the document uses (or
+ * the standard ones, if it doesn't say)?  Every character is looked
+ * at once, no matter how many protocols there are.
+ */
+int
+___mkd_isprotocol(MMIOT *f, char *text, int size)
+{
+    Protocols *p = f->protocols ? f->protocols : &defaults;
+    struct mkd_trie *node = p->node;
+    int x, i, c;
+
+    if ( (size < 2) || !(x = p->start[(unsigned char)text[0]]) )
+	return 0;
+
+    for ( i=1; i < size; i++ ) {
+	c = tolower((unsigned char)text[i]);
+	while ( x && (node[x].c != c) )
+	    x = node[x].next;
+	if ( !x )
+	    return 0;
+	if ( node[x].end )
+	    return 1;
+	x = node[x].down;
+    }
+    return 0;
+}
@@ -99,10 +99,13 @@ ___mkd_initmmiot(MMIOT *f, void *footnotes)
 	CREATE(f->in);
 	CREATE(f->out);
 	CREATE(f->Q);
+	CREATE(f->tokens);
+	CREATE(f->tags);
 	if ( footnotes )
 	    f->footnotes = footnotes;
 	else {
 	    f->footnotes = malloc(sizeof f->footnotes[0]);
+	    f->footnotes->reference = f->footnotes->deferred = 0;
 	    CREATE(f->footnotes->note);
 	}
     }
@@ -118,6 +121,11 @@ ___mkd_freemmiot(MMIOT *f, void *footnotes)
 	DELETE(f->in);
 	DELETE(f->out);
 	DELETE(f->Q);
+	DELETE(f->tokens);
+	DELETE(f->tags);
+	DELETE(f->brackets);
+	DELETE(f->runs);
+	DELETE(f->bysize);
 	if ( f->footnotes != footnotes )
 	    ___mkd_freefootnotes(f);
 	memset(f, 0, sizeof *f);
@@ -142,22 +150,61 @@ ___mkd_freeLineRange(Line *anchor, Line *stop)
 }
 
 
+/* throw away the text of a document but keep its buffers around, so
+ * it can be used again by mkd_batch() without going back to malloc()
+ */
+void
+___mkd_recycle(Document *doc)
+{
+    MMIOT *ctx = doc->ctx;
+    Istring blocks = doc->blocks;
+    Cstring toc = doc->toc;
+
+    if ( doc->iov ) free(doc->iov);
+    if ( doc->code) ___mkd_freeParagraph(doc->code);
+    if ( doc->title) ___mkd_freeLine(doc->title);
+    if ( doc->author) ___mkd_freeLine(doc->author);
+    if ( doc->date) ___mkd_freeLine(doc->date);
+    if ( T(doc->content) ) ___mkd_freeLines(T(doc->content));
+    DELETE(doc->source);
+    ___mkd_free_protocols(doc->protocols);
+    ___mkd_freefootnotes(ctx);
+    ctx->footnotes = 0;
+
+    memset(doc, 0, sizeof doc[0]);
+    doc->magic = VALID_DOCUMENT;
+    doc->ctx = ctx;
+    doc->blocks = blocks;
+    S(doc->blocks) = 0;
+    doc->toc = toc;
+    S(doc->toc) = 0;
+}
+
+
 /* clean up everything allocated in __mkd_compile()
  */
 void
 mkd_cleanup(Document *doc)
 {
     if ( doc && (doc->magic == VALID_DOCUMENT) ) {
+	if ( doc->edit )
+	    ___mkd_edit_free(doc);
 	if ( doc->ctx ) {
 	    ___mkd_freemmiot(doc->ctx, 0);
 	    free(doc->ctx);
 	}
 
+	DELETE(doc->blocks);
+	DELETE(doc->toc);
+	if ( doc->iov ) free(doc->iov);
+
 	if ( doc->code) ___mkd_freeParagraph(doc->code);
 	if ( doc->title) ___mkd_freeLine(doc->title);
 	if ( doc->author) ___mkd_freeLine(doc->author);
 	if ( doc->date) ___mkd_freeLine(doc->date);
 	if ( T(doc->content) ) ___mkd_freeLines(T(doc->content));
+	DELETE(doc->source);
+	___mkd_free_protocols(doc->protocols);
 	memset(doc, 0, sizeof doc[0]);
 	free(doc);
     }
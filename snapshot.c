@@ -0,0 +1,418 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+/* a saved document is
+ *
+ *	"mkdC" version
+ *	flags
+ *	title author date		(lines)
+ *	footnotes			(count, then each footnote)
+ *	blocks
+ *
+ * where numbers are 4 bytes, least significant first, strings are a
+ * size (-1 for a null pointer) followed by that many bytes, and every
+ * list of lines or blocks ends with a 0 (each one is preceded by a 1.)
+ * Nothing in it depends on where it's loaded, so it can be read back
+ * straight out of a mmap()ed file.
+ */
+#define MAGIC		"mkdC"
+#define VERSION		1
+
+/* blocks can't be nested more deeply than this in a saved document
+ */
+#define MAX_DEPTH	1000
+
+/* the flags in a line are 0 or 1
+ */
+#define BOOLEAN(x)	(((x) == 0) || ((x) == 1))
+
+struct image {
+    const unsigned char *p;	/* what's left to read */
+    const unsigned char *end;
+    long size;			/* how big the whole thing is */
+    int bad;			/* it ran out or didn't make sense */
+} ;
+
+
+static void
+putnum(Cstring *out, long n)
+{
+    EXPAND(*out) = n & 0xff;
+    EXPAND(*out) = (n >> 8) & 0xff;
+    EXPAND(*out) = (n >> 16) & 0xff;
+    EXPAND(*out) = (n >> 24) & 0xff;
+}
+
+
+static void
+putbytes(Cstring *out, char *s, int size)
+{
+    putnum(out, size);
+    SUFFIX(*out, s, size);
+}
+
+
+static void
+putstring(Cstring *out, char *s)
+{
+    if ( s )
+	putbytes(out, s, strlen(s));
+    else
+	putnum(out, -1);
+}
+
+
+static void
+putline(Cstring *out, Line *t)
+{
+    putnum(out, 1);
+    putbytes(out, T(t->text), S(t->text));
+    putnum(out, t->dle);
+    putnum(out, t->has_pipechar);
+    putnum(out, t->is_checked);
+    putnum(out, t->kind);
+    putnum(out, t->is_fenced);
+    putstring(out, t->fence_class);
+    putnum(out, t->count);
+}
+
+
+static void
+putlines(Cstring *out, Line *t)
+{
+    for ( ; t; t = t->next )
+	putline(out, t);
+    putnum(out, 0);
+}
+
+
+/* the title, author, and date are one line each (and whatever their
+ * ->next pointers point at went away when the document was compiled)
+ */
+static void
+putheader(Cstring *out, Line *t)
+{
+    if ( t )
+	putline(out, t);
+    putnum(out, 0);
+}
+
+
+static void
+putblocks(Cstring *out, Paragraph *p)
+{
+    for ( ; p; p = p->next ) {
+	putnum(out, 1);
+	putnum(out, p->typ);
+	putnum(out, p->align);
+	putnum(out, p->hnumber);
+	putnum(out, p->para_flags);
+	putstring(out, p->label);
+	putstring(out, p->ident);
+	putstring(out, p->lang);
+	putlines(out, p->text);
+	putblocks(out, p->down);
+    }
+    putnum(out, 0);
+}
+
+
+/* write a compiled document out in a form that mkd_load_compiled()
+ * can turn back into a document without compiling it again
+ */
+int
+mkd_save_compiled(Document *doc, FILE *output)
+{
+    Cstring out;
+    Footnote *t;
+    int i, rc;
+
+    if ( !(doc && doc->compiled && output) || doc->budget.error || doc->stream )
+	return EOF;
+
+    CREATE(out);
+    SUFFIX(out, MAGIC, 4);
+    putnum(&out, VERSION);
+
+    putnum(&out, MKD_NR_FLAGS);
+    for ( i=0; i < MKD_NR_FLAGS; i++ )
+	EXPAND(out) = is_flag_set(&doc->ctx->flags, i);
+
+    putheader(&out, doc->title);
+    putheader(&out, doc->author);
+    putheader(&out, doc->date);
+
+    putnum(&out, S(doc->ctx->footnotes->note));
+    for ( i=0; i < S(doc->ctx->footnotes->note); i++ ) {
+	t = &T(doc->ctx->footnotes->note)[i];
+	putbytes(&out, T(t->tag), S(t->tag));
+	putbytes(&out, T(t->link), S(t->link));
+	putbytes(&out, T(t->title), S(t->title));
+	putnum(&out, t->height);
+	putnum(&out, t->width);
+	putnum(&out, t->fn_flags & EXTRA_FOOTNOTE);
+	putblocks(&out, t->text);
+    }
+
+    putblocks(&out, doc->code);
+
+    rc = (fwrite(T(out), 1, S(out), output) == S(out)) ? 0 : EOF;
+    DELETE(out);
+    return rc;
+}
+
+
+static long
+getnum(struct image *in)
+{
+    long n;
+
+    if ( in->bad || (in->end - in->p < 4) ) {
+	in->bad = 1;
+	return 0;
+    }
+    n = in->p[0] | (in->p[1] << 8) | (in->p[2] << 16) | ((long)in->p[3] << 24);
+    in->p += 4;
+
+    /* (sign extend it where longs are bigger than 32 bits)
+     */
+    return (n & 0x80000000L) ? (n | ~0xffffffffL) : n;
+}
+
+
+/* read a size, checking that there's that much left
+ */
+static int
+getsize(struct image *in)
+{
+    long size = getnum(in);
+
+    if ( size < -1 || size > in->end - in->p )
+	in->bad = 1;
+    return in->bad ? -1 : size;
+}
+
+
+/* is a string made of what populate() lets through from the input?
+ * (the renderer writes control characters into its own output, so
+ * they can't be let in from anywhere else)
+ */
+static int
+readable(const unsigned char *s, int size)
+{
+    while ( size-- > 0 ) {
+	if ( !((*s & 0x80) || isprint(*s) || isspace(*s)) )
+	    return 0;
+	++s;
+    }
+    return 1;
+}
+
+
+static void
+getbytes(struct image *in, Cstring *res)
+{
+    int size = getsize(in);
+
+    CREATE(*res);
+    if ( size < 0 || !readable(in->p, size) ) {
+	in->bad = 1;
+	return;
+    }
+    /* (lines are nul-terminated, even though the nul isn't counted)
+     */
+    RESERVE(*res, size+1);
+    SUFFIX(*res, (char*)in->p, size);
+    T(*res)[size] = 0;
+    in->p += size;
+}
+
+
+static char *
+getstring(struct image *in)
+{
+    int size = getsize(in);
+    char *res;
+
+    if ( size > 0 && !readable(in->p, size) )
+	in->bad = 1;
+    if ( size < 0 || in->bad || !(res = malloc(size+1)) )
+	return 0;
+    memcpy(res, in->p, size);
+    res[size] = 0;
+    in->p += size;
+    return res;
+}
+
+
+static Line *
+getlines(struct image *in)
+{
+    ANCHOR(Line) lines;
+    Line *t;
+
+    T(lines) = E(lines) = 0;
+
+    while ( getnum(in) == 1 ) {
+	if ( !(t = calloc(1, sizeof *t)) ) {
+	    in->bad = 1;
+	    break;
+	}
+	ATTACH(lines, t);
+	getbytes(in, &t->text);
+	t->dle = getnum(in);
+	t->has_pipechar = getnum(in);
+	t->is_checked = getnum(in);
+	t->kind = getnum(in);
+	t->is_fenced = getnum(in);
+	t->fence_class = getstring(in);
+	t->count = getnum(in);
+
+	/* (compiling can trim a line so it's shorter than its indent,
+	 * and anything that looks at the indent stops at the end)
+	 */
+	if ( t->dle > S(t->text) )
+	    t->dle = S(t->text);
+
+	if ( (t->kind < chk_text) || (t->kind > chk_equal)
+				  || (t->dle < 0)
+				  || (t->count < 0) || (t->count > in->size)
+				  || !BOOLEAN(t->is_fenced)
+				  || !BOOLEAN(t->is_checked)
+				  || !BOOLEAN(t->has_pipechar) )
+	    in->bad = 1;
+    }
+    return T(lines);
+}
+
+
+static Line *
+getheader(struct image *in)
+{
+    Line *t = getlines(in);
+
+    if ( t && t->next ) {
+	___mkd_freeLines(t->next);
+	t->next = 0;
+	in->bad = 1;
+    }
+    return t;
+}
+
+
+static Paragraph *
+getblocks(struct image *in, int depth)
+{
+    ANCHOR(Paragraph) blocks;
+    Paragraph *p;
+
+    T(blocks) = E(blocks) = 0;
+
+    if ( depth > MAX_DEPTH )
+	in->bad = 1;
+
+    while ( getnum(in) == 1 ) {
+	if ( !(p = calloc(1, sizeof *p)) ) {
+	    in->bad = 1;
+	    break;
+	}
+	ATTACH(blocks, p);
+	p->typ = getnum(in);
+	p->align = getnum(in);
+	p->hnumber = getnum(in);
+	p->para_flags = getnum(in);
+	p->label = getstring(in);
+	p->ident = getstring(in);
+	p->lang = getstring(in);
+	p->text = getlines(in);
+	p->down = getblocks(in, depth+1);
+
+	if ( (p->typ < WHITESPACE) || (p->typ > SOURCE)
+				   || (p->align < IMPLICIT) || (p->align > CENTER)
+				   || (p->hnumber < (p->typ == HDR)) || (p->hnumber > 6)
+				   || (p->para_flags & ~(GITHUB_CHECK|IS_CHECKED)) )
+	    in->bad = 1;
+    }
+    return T(blocks);
+}
+
+
+/* turn what mkd_save_compiled() wrote back into a compiled document
+ * (with the flags it was compiled with);  returns a null pointer if
+ * it isn't a saved document.
+ */
+Document *
+mkd_load_compiled(const char *image, int size)
+{
+    struct image in;
+    Document *doc;
+    mkd_flag_t flags;
+    Footnote *t;
+    int i, count;
+
+    if ( !image || (size < 8) || memcmp(image, MAGIC, 4) != 0 )
+	return 0;
+
+    in.p = (const unsigned char *)image + 4;
+    in.end = (const unsigned char *)image + size;
+    in.size = size;
+    in.bad = 0;
+
+    if ( (getnum(&in) != VERSION) || (getnum(&in) != MKD_NR_FLAGS)
+				  || (in.end - in.p < MKD_NR_FLAGS) )
+	return 0;
+
+    if ( !(doc = __mkd_new_Document()) )
+	return 0;
+
+    mkd_init_flags(&flags);
+    for ( i=0; i < MKD_NR_FLAGS; i++ )
+	if ( *in.p++ )
+	    set_mkd_flag(&flags, i);
+
+    doc->compiled = doc->loaded = 1;
+    ___mkd_prepare(doc, &flags);
+
+    doc->title = getheader(&in);
+    doc->author = getheader(&in);
+    doc->date = getheader(&in);
+
+    /* each footnote takes up at least 24 bytes
+     */
+    count = getnum(&in);
+    if ( (count < 0) || (count > (in.end - in.p) / 24) )
+	in.bad = 1;
+    for ( i=0; (i < count) && !in.bad; i++ ) {
+	t = &EXPAND(doc->ctx->footnotes->note);
+	memset(t, 0, sizeof *t);
+	getbytes(&in, &t->tag);
+	getbytes(&in, &t->link);
+	getbytes(&in, &t->title);
+	t->height = getnum(&in);
+	t->width = getnum(&in);
+	t->fn_flags = getnum(&in) & EXTRA_FOOTNOTE;
+	t->text = getblocks(&in, 0);
+    }
+
+    doc->code = getblocks(&in, 0);
+
+    if ( in.bad || (in.p != in.end) ) {
+	mkd_cleanup(doc);
+	return 0;
+    }
+    return doc;
+}
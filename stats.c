@@ -0,0 +1,150 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "config.h"
+
+#if HAVE_CLOCK_GETTIME
+#elif HAVE_GETTIMEOFDAY
+#include <sys/time.h>
+#endif
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+static char *ptypes[MKD_NR_PTYPES] = {
+    "whitespace", "code", "quote", "markup", "html", "style", "dl",
+    "ul", "ol", "al", "item", "header", "hr", "table", "source"
+} ;
+
+
+/* wall clock time, in seconds
+ */
+double
+___mkd_clock(void)
+{
+#if HAVE_CLOCK_GETTIME
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1e9);
+#elif HAVE_GETTIMEOFDAY
+    struct timeval now;
+
+    gettimeofday(&now, 0);
+    return now.tv_sec + (now.tv_usec / 1e6);
+#else
+    return (double)time(0);
+#endif
+}
+
+
+/* call a user callback, counting (and timing) it if we're
+ * collecting statistics
+ */
+char *
+___mkd_callback(MMIOT *f, mkd_callback_t fn, const char *text, int size, void *ctx)
+{
+    double start;
+    char *ret;
+
+    if ( !f->stats )
+	return (*fn)(text, size, ctx);
+
+    start = ___mkd_clock();
+    ret = (*fn)(text, size, ctx);
+    f->stats->callbacks++;
+    f->stats->callback_time += ___mkd_clock() - start;
+    return ret;
+}
+
+
+/* count up the compiled paragraphs
+ */
+void
+___mkd_census(Paragraph *p, long *count)
+{
+    for ( ; p ; p = p->next ) {
+	if ( p->typ < MKD_NR_PTYPES )
+	    count[p->typ]++;
+	if ( p->down )
+	    ___mkd_census(p->down, count);
+    }
+}
+
+
+/* turn statistics collection on or off for a document
+ */
+void
+mkd_collect_stats(Document *doc, int enable)
+{
+    if ( doc ) {
+	doc->collect_stats = enable;
+	if ( doc->compiled )
+	    doc->ctx->stats = enable ? &doc->stats : 0;
+    }
+}
+
+
+/* return the statistics for a document.  Input counts and timing
+ * are always available;  the rest is only gathered if
+ * mkd_collect_stats() was called before compiling the document.
+ */
+int
+mkd_stats(Document *doc, struct mkd_stats *res)
+{
+    if ( !(doc && res) )
+	return EOF;
+
+    memcpy(res, &doc->stats, sizeof *res);
+
+    if ( doc->compiled ) {
+	memset(res->paragraphs, 0, sizeof res->paragraphs);
+	___mkd_census(doc->code, res->paragraphs);
+	res->footnotes = doc->ctx->footnotes ? S(doc->ctx->footnotes->note) : 0;
+    }
+    return 0;
+}
+
+
+/* print the statistics for a document
+ */
+int
+mkd_generatestats(Document *doc, FILE *out)
+{
+    struct mkd_stats st;
+    int i;
+
+    DO_OR_DIE( mkd_stats(doc, &st) );
+
+    fprintf(out, "input: %ld byte%s, %ld line%s\n",
+		st.input_bytes, (st.input_bytes == 1) ? "" : "s",
+		st.input_lines, (st.input_lines == 1) ? "" : "s");
+    fprintf(out, "paragraphs:");
+    for ( i=0; i < MKD_NR_PTYPES; i++ )
+	if ( st.paragraphs[i] )
+	    fprintf(out, " %s=%ld", ptypes[i], st.paragraphs[i]);
+    fputc('\n', out);
+    fprintf(out, "footnotes: %ld\n", st.footnotes);
+    if ( doc->collect_stats ) {
+	fprintf(out, "reparses: %ld\n", st.reparses);
+	fprintf(out, "emphasis tokens: %ld\n", st.emphasis);
+	fprintf(out, "links: %ld\n", st.links);
+	fprintf(out, "callbacks: %ld (%.6fs)\n", st.callbacks, st.callback_time);
+	if ( doc->cache )
+	    fprintf(out, "cached blocks: %ld\n", st.cached);
+	fprintf(out, "output: %ld byte%s\n",
+		    st.output_bytes, (st.output_bytes == 1) ? "" : "s");
+	fprintf(out, "time: populate %.6fs, compile %.6fs, render %.6fs\n",
+		    st.populate_time, st.compile_time, st.render_time);
+    }
+    return 0;
+}
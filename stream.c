@@ -0,0 +1,254 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "config.h"
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+typedef int (*stfu)(const void*,const void*);
+
+int __mkd_footsort(Footnote *, Footnote *);
+
+/* where mkd_stream() is between pieces of a document
+ */
+struct progress {
+    int html;		/* for ___mkd_stream_blocks() */
+    int source;		/* did the last piece end with a source block? */
+} ;
+
+/* read a line from a streamed document onto the end of ->content,
+ * the same way populate() does.  Returns '\n' or EOF for how the
+ * line ended, or 0 if there wasn't anything left to read.
+ */
+static int
+readline(Document *doc, Cstring *line, int count)
+{
+    int c;
+
+    S(*line) = 0;
+    while ( (c = getc(doc->stream)) != EOF ) {
+	if ( count )
+	    doc->stats.input_bytes++;
+	if ( c == '\n' )
+	    break;
+	if ( (c & 0x80) || isprint(c) || isspace(c) )
+	    EXPAND(*line) = c;
+    }
+
+    if ( (c == EOF) && (S(*line) == 0) )
+	return 0;
+
+    __mkd_enqueue(doc, line);
+    if ( count )
+	doc->stats.input_lines++;
+    return c;
+}
+
+
+/* prepare to stream a file.  The markdown isn't read until
+ * mkd_stream(), but the pandoc header (if there is one) is pulled
+ * off now so it can be used by mkd_doc_title() & friends.  If the
+ * file can't be rewound, it's read in the old-fashioned way.
+ */
+Document *
+mkd_stream_in(FILE *f, mkd_flag_t *flags)
+{
+    Document *doc;
+    Cstring line;
+    Line *headers;
+    long start;
+    int i;
+
+    if ( (start = ftell(f)) < 0 || fseek(f, start, SEEK_SET) < 0 )
+	return mkd_in(f, flags);
+
+    if ( (doc = __mkd_new_Document()) == 0 )
+	return 0;
+
+    if ( flags && (is_flag_set(flags, MKD_TABSTOP) || is_flag_set(flags, MKD_STRICT)) )
+	doc->tabstop = 4;
+    else
+	doc->tabstop = TABSTOP;
+
+    doc->stream = f;
+    doc->stream_at = start;
+
+    if ( flags && (is_flag_set(flags, MKD_NOHEADER) || is_flag_set(flags, MKD_STRICT)) )
+	return doc;
+
+    CREATE(line);
+    for ( i=0; i < 3; i++ )
+	if ( readline(doc, &line, 1) != '\n' || S(line) == 0 || T(line)[0] != '%' )
+	    break;
+    DELETE(line);
+
+    if ( i == 3 ) {
+	headers = T(doc->content);
+
+	doc->title = headers;             __mkd_trim_line(doc->title, 1);
+	doc->author= headers->next;       __mkd_trim_line(doc->author, 1);
+	doc->date  = headers->next->next; __mkd_trim_line(doc->date, 1);
+	doc->date->next = 0;
+	doc->stream_at = ftell(f);
+    }
+    else {
+	if ( T(doc->content) )
+	    ___mkd_freeLines(T(doc->content));
+	memset(&doc->stats, 0, sizeof doc->stats);
+    }
+    T(doc->content) = E(doc->content) = 0;
+    return doc;
+}
+
+
+/* read a streamed document a piece at a time, passing each piece to
+ * `fn`, which compiles (and, on the second pass, renders) it.
+ */
+static int
+pass(Document *doc, int which, void (*fn)(Document *, Line *, struct progress *),
+				     struct progress *state)
+{
+    struct mkd_chunker chunk;
+    Cstring line;
+    Line *end, *piece;
+    MMIOT *f = doc->ctx;
+
+    if ( fseek(doc->stream, doc->stream_at, SEEK_SET) < 0 )
+	return EOF;
+
+    f->stream = which;
+    ___mkd_budget(&doc->budget);
+    memset(&chunk, 0, sizeof chunk);
+    CREATE(line);
+
+    while ( !FAILED(f) && readline(doc, &line, which == STREAM_BLOCKS) ) {
+	if ( end = ___mkd_chunk(&chunk, E(doc->content), &f->flags) ) {
+	    piece = T(doc->content);
+	    T(doc->content) = end->next;
+	    end->next = 0;
+	    (*fn)(doc, piece, state);
+	}
+    }
+    if ( T(doc->content) )
+	(*fn)(doc, T(doc->content), state);
+    T(doc->content) = E(doc->content) = 0;
+
+    DELETE(line);
+    return ferror(doc->stream) ? EOF : 0;
+}
+
+
+/* first pass:  the footnotes are the only things that matter
+ */
+static void
+notes(Document *doc, Line *piece, struct progress *state)
+{
+    Paragraph *p = ___mkd_compile_chunk(piece, doc->ctx);
+
+    if ( p )
+	___mkd_freeParagraph(p);
+}
+
+
+/* second pass:  generate the html and throw each piece away
+ */
+static void
+blocks(Document *doc, Line *piece, struct progress *state)
+{
+    Paragraph *p = ___mkd_compile_chunk(piece, doc->ctx);
+    Paragraph *last;
+
+    if ( p ) {
+	/* a source block that carries on from the last piece
+	 * is only counted once
+	 */
+	___mkd_census(p, doc->stats.paragraphs);
+	if ( state->source && (p->typ == SOURCE) )
+	    doc->stats.paragraphs[SOURCE]--;
+	for ( last = p; last->next; last = last->next )
+	    ;
+	state->source = (last->typ == SOURCE);
+
+	___mkd_stream_blocks(p, doc->ctx, &state->html);
+	___mkd_freeParagraph(p);
+    }
+}
+
+
+/* compile and render a document a piece at a time, sending the html
+ * to a sink.  It takes two passes over the input;  the first picks
+ * up the reference links and footnotes, and the second generates the
+ * html, so the only part of the document that's in memory at any time
+ * is the block being worked on (plus the footnotes.)  Returns EOF if
+ * the input couldn't be read, the sink failed, or the document ran into
+ * one of its resource limits.
+ */
+int
+mkd_stream(Document *doc, mkd_flag_t *flags, mkd_sink_t fn, void *ctx)
+{
+    struct mkd_sink out, xml;
+    MMIOT *f;
+    struct progress state = { 0, 0 };
+    double start;
+
+    if ( !(doc && fn) )
+	return EOF;
+
+    if ( !doc->stream ) {
+	/* mkd_stream_in() couldn't rewind the input, so it's all
+	 * in memory already
+	 */
+	mkd_compile(doc, flags);
+	return mkd_sink_html(doc, fn, ctx);
+    }
+
+    ___mkd_freemmiot(doc->ctx, 0);
+    ___mkd_prepare(doc, flags);
+    memset(doc->stats.paragraphs, 0, sizeof doc->stats.paragraphs);
+    f = doc->ctx;
+
+    if ( is_flag_set(&f->flags, MKD_CDATA) ) {
+	SINK_TO(xml, fn, ctx);
+	SINK_TO(out, ___mkd_xmlsink, &xml);
+    }
+    else
+	SINK_TO(out, fn, ctx);
+
+    start = ___mkd_clock();
+    DO_OR_DIE( pass(doc, STREAM_NOTES, notes, &state) );
+    qsort(T(f->footnotes->note), S(f->footnotes->note),
+			sizeof T(f->footnotes->note)[0],
+			(stfu)__mkd_footsort);
+    doc->stats.footnotes = S(f->footnotes->note);
+    doc->stats.compile_time = ___mkd_clock() - start;
+
+    start = ___mkd_clock();
+    f->sink = &out;
+    DO_OR_DIE( pass(doc, STREAM_BLOCKS, blocks, &state) );
+    ___mkd_stream_end(f, &state.html);
+    f->sink = 0;
+    f->stream = 0;
+    doc->stats.output_bytes = out.written;
+    doc->stats.render_time = ___mkd_clock() - start;
+
+    if ( doc->budget.error || out.error )
+	return EOF;
+
+    /* (like mkd_sink_html(), a document that didn't turn into any
+     * html isn't followed by a newline)
+     */
+    if ( out.written || is_flag_set(&f->flags, MKD_CDATA) ) {
+	DO_OR_DIE( (*fn)("\n", 1, ctx) );
+    }
+    return 0;
+}
@@ -23,5 +23,9 @@ try -fautolink 'parenthesised (url)' \
 
 try -fautolink 'token with trailing @' 'orc@' '<p>orc@</p>'
 
+try -fautolink 'link in the middle of a word' \
+    'xhttp://here' \
+    '<p>x<a href="http://here">http://here</a></p>'
+
 summary $0
 exit $rc
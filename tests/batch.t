@@ -0,0 +1,79 @@
+. tests/functions.sh
+
+title "rendering a batch of files"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/batch.$$
+
+mkdir $TMP
+
+i=0
+while [ $i -lt 12 ]; do
+    ./echo "# file $i
+
+text for file $i[^1] with a [link][l]
+
+[^1]: footnote $i
+
+[l]: http://example.com/$i" > $TMP/f$i.text
+    i=`expr $i + 1`
+done
+FILES=`ls $TMP/f*.text`
+
+batch() {
+    try_header "$1"
+    WANT=`for f in $FILES; do ./markdown $2 $f; done 2>&1`
+    Q=`./markdown -j 4 $2 $FILES 2>&1`
+
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$WANT" | head -20 | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+batch 'html' ''
+batch 'footnotes' '-ffootnote'
+batch 'table of contents' '-T -x'
+
+try_header 'mkd2html'
+for f in $FILES; do ./mkd2html $f; done
+mkdir $TMP/want
+mv $TMP/*.html $TMP/want
+if ./mkd2html -j 4 $FILES; then
+    (cd $TMP/want; for f in *.html; do cmp -s $f ../$f || exit 1; done)
+else
+    false
+fi
+if [ $? -eq 0 ]; then
+    __passed=`expr $__passed + 1`
+    test $VERBOSE && ./echo " ok"
+else
+    __failed=`expr $__failed + 1`
+    test $VERBOSE || ./echo "mkd2html"
+    rc=1
+fi
+
+try_header 'a file that is not there'
+if ./markdown -j 2 $TMP/f0.text $TMP/nosuchfile >/dev/null 2>&1; then
+    __failed=`expr $__failed + 1`
+    test $VERBOSE || ./echo "a file that is not there"
+    ./echo "markdown -j did not fail"
+    rc=1
+else
+    __passed=`expr $__passed + 1`
+    test $VERBOSE && ./echo " ok"
+fi
+
+rm -rf $TMP
+
+summary $0
+exit $rc
@@ -25,11 +25,15 @@ try '`>`' '`>`' '<p><code>&gt;</code></p>'
 try '`` ` ``' '`` ` ``' '<p><code>`</code></p>'
 try '````` ``` `' '````` ``` `' '<p><code>``</code> `</p>'
 try '````` ` ```' '````` ` ```' '<p><code>`` `</code></p>'
+try '`` a ``` b ` c' '`` a ``` b ` c' '<p><code>` a ``` b</code> c</p>'
+try '``` x `` y ` z' '``` x `` y ` z' '<p><code>` x</code> y ` z</p>'
 try 'backslashes in code(1)' '    printf "%s: \n", $1;' \
 '<pre><code>printf "%s: \n", $1;
 </code></pre>'
 try 'backslashes in code(2)' '`printf "%s: \n", $1;`' \
 '<p><code>printf "%s: \n", $1;</code></p>'
+try 'code inside emphasis' 'a *b `*c* & d` e* f' \
+'<p>a <em>b <code>*c* &amp; d</code> e</em> f</p>'
 
 summary $0
 exit $rc
@@ -233,6 +233,57 @@ bar
 </code></pre>
 </p>'
 
+# the fence that closes a code block isn't the start of another one
+try -ffencedcode,footnote 'footnote between fenced code blocks' \
+'```
+code
+```
+[^1]: a note
+
+text[^1]
+
+```
+more
+```' \
+'<p><pre><code>code
+</code></pre>
+text<sup id="fnref:1"><a href="#fn:1" rel="footnote">1</a></sup></p>
+
+<p><pre><code>more
+</code></pre>
+</p>
+<div class="footnotes">
+<hr/>
+<ol>
+<li id="fn:1">
+a note<a href="#fnref:1" rev="footnote">&#8617;</a></li>
+</ol>
+</div>'
+
+try -ffencedcode 'html block between fenced code blocks' \
+'~~~
+code
+~~~
+<div>
+html
+</div>
+
+~~~
+more
+~~~' \
+'<p><pre><code>code
+</code></pre>
+</p>
+
+<div>
+html
+</div>
+
+
+<p><pre><code>more
+</code></pre>
+</p>'
+
 
 try -ffencedcode 'checkline misparse as fenced code' \
 '[`label`](#code)
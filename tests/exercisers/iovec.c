@@ -0,0 +1,218 @@
+/*
+ * check that the pieces mkd_iovec() hands back for a document, put
+ * together, are the same as mkd_toc() and mkd_document() (with the
+ * body and footnotes pieces splitting the document where the
+ * footnotes start.)
+ *
+ * usage: iovec [-f flags] [file]
+ *
+ * Without a file, it checks a sample document with a few different
+ * sets of flags.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#if HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#else
+struct iovec {
+    void *iov_base;
+    size_t iov_len;
+} ;
+#endif
+
+#include "mkdio.h"
+
+char *pgm = "iovec";
+
+char *text;			/* the document */
+int size, alloc;
+
+char sample[] =
+    "% title\n% author\n% date\n"
+    "A header\n========\n\n"
+    "Some text with a [link] and a footnote[^1].\n\n"
+    "* a list\n* with items\n\n"
+    "> a quote\n\n"
+    "```\nfenced code\n```\n\n"
+    "## another header\n\n"
+    "<div>\nsome html\n</div>\n\n"
+    "### and another[^2]\n\n"
+    "[link]: /url \"title\"\n"
+    "[^1]: a footnote\n\n"
+    "[^2]: and another\n\n";
+
+char *samples[] = { "", "toc", "footnote", "footnote,toc,fencedcode", "strict" };
+#define NRSAMPLES	(sizeof samples / sizeof samples[0])
+
+/* what mkd_iovec() is asked for, and what it should come up with
+ * (in this order)
+ */
+#define TOC	0
+#define BODY	1
+#define NOTES	2
+
+struct {
+    char *name;
+    int parts;
+    int want[3];		/* which of the toc, body, and notes */
+} asks[] = {
+    { "the whole document",		MKD_IOV_ALL,		{ 1, 1, 1 } },
+    { "the document without a toc",	MKD_IOV_BODY|MKD_IOV_FOOTNOTES,	{ 0, 1, 1 } },
+    { "the table of contents",		MKD_IOV_TOC,		{ 1, 0, 0 } },
+    { "the body",			MKD_IOV_BODY,		{ 0, 1, 0 } },
+    { "the footnotes",			MKD_IOV_FOOTNOTES,	{ 0, 0, 1 } },
+    { "nothing",			0,			{ 0, 0, 0 } },
+} ;
+#define NRASKS	(sizeof asks / sizeof asks[0])
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+/* read a whole file into memory
+ */
+void
+slurp(char *file)
+{
+    FILE *f = fopen(file, "r");
+    int c;
+
+    if ( !f )
+	fail(file);
+
+    for ( size = 0; (c = getc(f)) != EOF; text[size++] = c )
+	if ( size >= alloc && !(text = realloc(text, alloc += 4096)) )
+	    fail("realloc");
+    fclose(f);
+}
+
+
+int
+check(mkd_flag_t *flags)
+{
+    MMIOT *doc = mkd_string(text, size, flags);
+    struct iovec *iov;
+    char *html, *toc = 0, *want, *got;
+    int szhtml, sztoc, notes, count, i, j, szwant, szgot, rc = 0;
+    char *piece[3];
+    int szpiece[3];
+
+    if ( !doc || !mkd_compile(doc, flags) || (szhtml = mkd_document(doc, &html)) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    if ( (sztoc = mkd_toc(doc, &toc)) == EOF )
+	sztoc = 0;
+
+    /* the footnotes (if there are any) are the end of the document,
+     * starting with the <div> they're in
+     */
+    notes = szhtml;
+    if ( (got = strstr(html, "\n<div class=\"footnotes\">")) )
+	notes = got - html;
+
+    piece[BODY] = html;			szpiece[BODY] = notes;
+    piece[NOTES] = html + notes;	szpiece[NOTES] = szhtml - notes;
+    piece[TOC] = toc;			szpiece[TOC] = sztoc;
+
+    if ( !(want = malloc(szhtml + sztoc + 1)) || !(got = malloc(szhtml + sztoc + 1)) )
+	fail("malloc");
+
+    for ( i=0; (i < NRASKS) && (rc == 0); i++ ) {
+	szwant = 0;
+	for ( j=TOC; j <= NOTES; j++ )
+	    if ( asks[i].want[j] && szpiece[j] ) {
+		memcpy(want + szwant, piece[j], szpiece[j]);
+		szwant += szpiece[j];
+	    }
+
+	if ( (count = mkd_iovec(doc, asks[i].parts, &iov)) == EOF ) {
+	    fprintf(stderr, "%s: mkd_iovec failed for %s\n", pgm, asks[i].name);
+	    exit(1);
+	}
+	for ( szgot = j = 0; j < count; j++ ) {
+	    if ( (iov[j].iov_len == 0) || (szgot + iov[j].iov_len > szwant) ) {
+		szgot = -1;
+		break;
+	    }
+	    memcpy(got + szgot, iov[j].iov_base, iov[j].iov_len);
+	    szgot += iov[j].iov_len;
+	}
+
+	if ( (szgot != szwant) || memcmp(got, want, szwant) != 0 ) {
+	    fprintf(stderr, "%s: %s is not the same\n", pgm, asks[i].name);
+	    rc = 1;
+	}
+    }
+
+    free(want);
+    free(got);
+    free(toc);
+    mkd_cleanup(doc);
+    return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    mkd_flag_t *flags = mkd_flags();
+    char *opts, *bad;
+    int opt, i, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "f:")) != EOF ) {
+	switch (opt) {
+	case 'f':   if ( (bad = mkd_set_flag_string(flags, optarg)) ) {
+			fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+			exit(1);
+		    }
+		    break;
+	default:    fprintf(stderr, "usage: %s [-f flags] [file]\n", pgm);
+		    exit(1);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ( argc > 0 ) {
+	slurp(argv[0]);
+	rc = check(flags);
+    }
+    else {
+	fputs("check mkd_iovec: ", stdout);
+	fflush(stdout);
+
+	text = sample;
+	size = sizeof sample - 1;
+
+	for ( i=0; (i < NRSAMPLES) && (rc == 0); i++ ) {
+	    printf("%s ", *samples[i] ? samples[i] : "default");
+	    fflush(stdout);
+
+	    mkd_free_flags(flags);
+	    flags = mkd_flags();
+	    opts = strdup(samples[i]);	/* (mkd_set_flag_string() writes on it) */
+	    if ( (bad = mkd_set_flag_string(flags, opts)) ) {
+		fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+		exit(1);
+	    }
+	    free(opts);
+	    rc = check(flags);
+	}
+	if ( rc == 0 )
+	    puts("ok");
+    }
+    mkd_free_flags(flags);
+    exit(rc);
+}
@@ -0,0 +1,433 @@
+/*
+ * render one compiled document with mkd_render() on a lot of threads
+ * at once, each thread with its own url callback, footnote prefix,
+ * and display flags, and check that every render is the same as
+ * compiling the document from scratch with those callbacks and flags
+ * and rendering it with mkd_document() (and that the shared document
+ * isn't changed.)  Then check that compiling the document again with
+ * different flags is the same as compiling it from scratch with them
+ * (and that it can't be compiled again unless its markdown was kept.)
+ *
+ * usage: render [-f flags] [-n renders] [-t threads] [file]
+ *
+ * Without a file, it renders a sample document with a few different
+ * sets of flags.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#if USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "mkdio.h"
+
+char *pgm = "render";
+
+char *text;			/* the document */
+int size, alloc;
+
+/* each tenant has its own callbacks, footnote prefix, and flags
+ * (which only change how the document is displayed)
+ */
+#define TENANTS	4
+
+char *prefix[TENANTS] = { 0, "one", "two", "three" };
+char *styles[TENANTS] = { "", "nolinks", "nopants,safelink", "noimage,noext,nosuperscript" };
+mkd_flag_t *shown[TENANTS];
+char *want[TENANTS];		/* the html each tenant should get */
+
+/* flags to compile the document with again
+ */
+char *changes[] = { "nolinks", "nohtml,safelink", "toc", "tabstop", "noheader", "fencedcode,dlextra" };
+#define NRCHANGES	(sizeof changes / sizeof changes[0])
+
+/* the flags in them that change how it's cut up into blocks
+ */
+int blockflags[] = { MKD_NOHTML, MKD_TOC, MKD_TABSTOP, MKD_NOHEADER, MKD_FENCEDCODE, MKD_DLEXTRA };
+#define NRBLOCKFLAGS	(sizeof blockflags / sizeof blockflags[0])
+
+MMIOT *doc;			/* the document they all share */
+int renders = 50;		/* how many times each thread renders it */
+
+char sample[] =
+    "% title\n% author\n% date\n"
+    "A header\n========\n\n"
+    "Some text with a [link] and a footnote[^1].  \n"
+    "More of the same paragraph, with trailing blanks \t\n"
+    "and <http://example.com/auto> and [another][^2].\n\n"
+    "* a list\n* with a [link] in it\n\n"
+    "> a quote with a footnote[^2]\n\n"
+    "|a|b|   \n|-|-|\n|1|[link]|  \n\n"
+    "![an image](/pic.png =10x20 \"title\")\n\n"
+    "term\n:   definition[^1]\n\n"
+    "<div>\nsome *html*\n</div>\n\n"
+    "* a list item\n\n  \tafter a tab\n\n"
+    "```\nfenced code\n```\n\n"
+    "## another header\n\n"
+    "[link]: /url \"title\"\n"
+    "[^1]: a footnote with a [link]\n\n"
+    "[^2]: another footnote\n\n";
+
+char *samples[] = { "", "footnote", "footnote,toc,dlextra", "footnote,strict", "nohtml" };
+#define NRSAMPLES	(sizeof samples / sizeof samples[0])
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+/* read a whole file into memory
+ */
+void
+slurp(char *file)
+{
+    FILE *f = fopen(file, "r");
+    int c;
+
+    if ( !f )
+	fail(file);
+
+    for ( size = 0; (c = getc(f)) != EOF; text[size++] = c )
+	if ( size >= alloc && !(text = realloc(text, alloc += 4096)) )
+	    fail("realloc");
+    fclose(f);
+}
+
+
+/* a copy of some flags, with some more flags turned on
+ */
+mkd_flag_t *
+with(mkd_flag_t *flags, char *more)
+{
+    mkd_flag_t *res = mkd_copy_flags(flags);
+    char *opts = strdup(more);	/* (mkd_set_flag_string() writes on it) */
+    char *bad;
+
+    if ( !(res && opts) )
+	fail("mkd_copy_flags");
+    if ( (bad = mkd_set_flag_string(res, opts)) ) {
+	fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+	exit(1);
+    }
+    free(opts);
+    return res;
+}
+
+
+/* put the tenant's name in front of every url
+ */
+char *
+tenant_url(const char *url, const int size, void *ctx)
+{
+    char *name = ctx ? ctx : "default";
+    char *res = malloc(strlen(name) + size + 3);
+
+    if ( res )
+	sprintf(res, "/%s/%.*s", name, size, url);
+    return res;
+}
+
+
+void
+tenant_free(char *res, void *ctx)
+{
+    free(res);
+}
+
+
+/* compile the document from scratch for one tenant (or, if `tenant`
+ * is -1, without any callbacks) and return its html
+ */
+char *
+scratch(mkd_flag_t *flags, int tenant)
+{
+    MMIOT *fresh = mkd_string(text, size, flags);
+    char *html, *res;
+
+    if ( !fresh )
+	fail("mkd_string");
+
+    if ( tenant >= 0 ) {
+	mkd_e_url(fresh, tenant_url);
+	mkd_e_free(fresh, tenant_free);
+	mkd_e_data(fresh, prefix[tenant]);
+	if ( prefix[tenant] )
+	    mkd_ref_prefix(fresh, prefix[tenant]);
+    }
+
+    if ( !mkd_compile(fresh, flags) || mkd_document(fresh, &html) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    if ( !(res = strdup(html)) )
+	fail("strdup");
+    mkd_cleanup(fresh);
+    return res;
+}
+
+
+/* render the shared document over and over, as each of the tenants
+ * in turn, and return how many times it came out wrong
+ */
+void *
+worker(void *arg)
+{
+    struct mkd_render r;
+    long wrong = 0;
+    int i, tenant, size;
+
+    memset(&r, 0, sizeof r);
+    r.e_url = tenant_url;
+    r.e_free = tenant_free;
+
+    for ( i=0; i < renders; i++ ) {
+	tenant = (i + (long)arg) % TENANTS;
+	r.e_data = r.ref_prefix = prefix[tenant];
+	r.flags = shown[tenant];
+
+	size = mkd_render(doc, &r);
+	if ( size == EOF || size != strlen(want[tenant])
+			 || strcmp(r.html, want[tenant]) != 0 )
+	    ++wrong;
+    }
+    mkd_free_render(&r);
+    return (void*)wrong;
+}
+
+
+/* compile the document, then compile it again with each set of
+ * changes (and then without them), checking it against compiling it
+ * from scratch every time
+ */
+int
+recompile(mkd_flag_t *flags)
+{
+    mkd_flag_t *changed, *kept;
+    char *html, *fresh;
+    int i, rc = 0;
+
+    if ( !(kept = mkd_copy_flags(flags)) )
+	fail("mkd_copy_flags");
+    mkd_set_flag_num(kept, MKD_KEEPSOURCE);
+
+    if ( !(doc = mkd_string(text, size, kept)) || !mkd_compile(doc, flags)
+					      || mkd_document(doc, &html) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    mkd_free_flags(kept);
+
+    for ( i=0; (i < NRCHANGES) && (rc == 0); i++ ) {
+	changed = with(flags, changes[i]);
+
+	if ( !mkd_compile(doc, changed) || mkd_document(doc, &html) == EOF ) {
+	    fprintf(stderr, "%s: can't compile the document again\n", pgm);
+	    exit(1);
+	}
+	fresh = scratch(changed, -1);
+	if ( strcmp(html, fresh) != 0 ) {
+	    fprintf(stderr, "%s: compiled again with <%s>, it's not the same\n",
+			    pgm, changes[i]);
+	    rc = 1;
+	}
+	free(fresh);
+
+	if ( rc == 0 && (!mkd_compile(doc, flags) || mkd_document(doc, &html) == EOF) ) {
+	    fprintf(stderr, "%s: can't compile the document again\n", pgm);
+	    exit(1);
+	}
+	fresh = scratch(flags, -1);
+	if ( rc == 0 && strcmp(html, fresh) != 0 ) {
+	    fprintf(stderr, "%s: compiled again without <%s>, it's not the same\n",
+			    pgm, changes[i]);
+	    rc = 1;
+	}
+	free(fresh);
+	mkd_free_flags(changed);
+    }
+    mkd_cleanup(doc);
+    return rc;
+}
+
+
+/* a document whose markdown wasn't kept can still be displayed with
+ * other flags, but it can't be compiled again (and is left the way it
+ * was when it's asked to be)
+ */
+int
+unkept(mkd_flag_t *flags)
+{
+    mkd_flag_t *changed;
+    char *html, *fresh;
+    int i, j, ok, again, rc = 0;
+
+    for ( i=0; (i < NRCHANGES) && (rc == 0); i++ ) {
+	if ( !(doc = mkd_string(text, size, flags)) || !mkd_compile(doc, flags) ) {
+	    fprintf(stderr, "%s: can't compile the document\n", pgm);
+	    exit(1);
+	}
+	changed = with(flags, changes[i]);
+
+	for ( again = j = 0; j < NRBLOCKFLAGS; j++ )
+	    if ( mkd_flag_isset(changed, blockflags[j]) != mkd_flag_isset(flags, blockflags[j]) )
+		again = 1;
+
+	if ( (ok = mkd_compile(doc, changed)) == again ) {
+	    fprintf(stderr, "%s: <%s> %s compile it again\n", pgm, changes[i],
+			    ok ? "didn't" : "tried to");
+	    rc = 1;
+	}
+	if ( mkd_document(doc, &html) == EOF ) {
+	    fprintf(stderr, "%s: can't display the document again\n", pgm);
+	    exit(1);
+	}
+	fresh = scratch(ok ? changed : flags, -1);
+	if ( rc == 0 && strcmp(html, fresh) != 0 ) {
+	    fprintf(stderr, "%s: %s <%s>, it's not the same\n", pgm,
+			    ok ? "displayed again with" : "not compiled again with",
+			    changes[i]);
+	    rc = 1;
+	}
+	free(fresh);
+	mkd_free_flags(changed);
+	mkd_cleanup(doc);
+    }
+    return rc;
+}
+
+
+/* render the document on `threads` threads at once (or one after
+ * the other, if there aren't any threads)
+ */
+int
+check(mkd_flag_t *flags, int threads)
+{
+    char *plain, *html;
+    long wrong = 0;
+    int i;
+#if USE_THREADS
+    void *ret;
+    pthread_t *tid = calloc(threads, sizeof tid[0]);
+
+    if ( !tid )
+	fail("calloc");
+#endif
+
+    for ( i=0; i < TENANTS; i++ ) {
+	shown[i] = with(flags, styles[i]);
+	want[i] = scratch(shown[i], i);
+    }
+
+    if ( !(doc = mkd_string(text, size, flags)) || !mkd_compile(doc, flags) ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+
+#if USE_THREADS
+    for ( i=0; i < threads; i++ )
+	if ( pthread_create(&tid[i], 0, worker, (void*)(long)i) != 0 )
+	    fail("pthread_create");
+    for ( i=0; i < threads; i++ ) {
+	pthread_join(tid[i], &ret);
+	wrong += (long)ret;
+    }
+    free(tid);
+#else
+    for ( i=0; i < threads; i++ )
+	wrong += (long)worker((void*)(long)i);
+#endif
+
+    if ( wrong ) {
+	fprintf(stderr, "%s: %ld renders were not the same\n", pgm, wrong);
+	return 1;
+    }
+
+    /* the document should render the way it would have if mkd_render()
+     * had never seen it
+     */
+    plain = scratch(flags, -1);
+    if ( mkd_document(doc, &html) == EOF || strcmp(html, plain) != 0 ) {
+	fprintf(stderr, "%s: the shared document was changed\n", pgm);
+	return 1;
+    }
+    free(plain);
+
+    mkd_cleanup(doc);
+    for ( i=0; i < TENANTS; i++ ) {
+	free(want[i]);
+	mkd_free_flags(shown[i]);
+    }
+    return recompile(flags) || unkept(flags);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    mkd_flag_t *flags = mkd_flags();
+    char *opts, *bad;
+    int opt, threads = 8, i, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "f:n:t:")) != EOF ) {
+	switch (opt) {
+	case 'f':   if ( (bad = mkd_set_flag_string(flags, optarg)) ) {
+			fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+			exit(1);
+		    }
+		    break;
+	case 'n':   renders = atoi(optarg);
+		    break;
+	case 't':   threads = atoi(optarg);
+		    break;
+	default:    fprintf(stderr, "usage: %s [-f flags] [-n renders] "
+				    "[-t threads] [file]\n", pgm);
+		    exit(1);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ( threads < 1 )
+	threads = 1;
+
+    if ( argc > 0 ) {
+	slurp(argv[0]);
+	rc = check(flags, threads);
+    }
+    else {
+	fputs("check mkd_render: ", stdout);
+	fflush(stdout);
+
+	text = sample;
+	size = sizeof sample - 1;
+
+	for ( i=0; (i < NRSAMPLES) && (rc == 0); i++ ) {
+	    printf("%s ", *samples[i] ? samples[i] : "default");
+	    fflush(stdout);
+
+	    mkd_free_flags(flags);
+	    flags = mkd_flags();
+	    opts = strdup(samples[i]);	/* (mkd_set_flag_string() writes on it) */
+	    if ( (bad = mkd_set_flag_string(flags, opts)) ) {
+		fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+		exit(1);
+	    }
+	    free(opts);
+	    rc = check(flags, threads);
+	}
+	if ( rc == 0 )
+	    puts("ok");
+    }
+    mkd_free_flags(flags);
+    exit(rc);
+}
@@ -0,0 +1,297 @@
+/*
+ * write a document through the output sinks and check that what
+ * they're passed is the same as what mkd_document(), mkd_toc(),
+ * mkd_css(), and mkd_xml() make of it, that an empty document isn't
+ * followed by a newline, and that a sink that fails makes them fail.
+ *
+ * usage: sink [-f flags] [file]
+ *
+ * Without a file, it checks a sample document with a few different
+ * sets of flags.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mkdio.h"
+
+char *pgm = "sink";
+
+char *text;			/* the document */
+int size, alloc;
+
+/* what a sink has been passed
+ */
+struct output {
+    char *text;
+    int size, alloc;
+    int calls;			/* how many times it's been called */
+    int fail;			/* fail on this call (if it's not 0) */
+} ;
+
+char sample[] =
+    "% title\n% author\n% date\n"
+    "A header\n========\n\n"
+    "Some text with a [link] and a footnote[^1].\n\n"
+    "<style>\np { color: red; }\n</style>\n\n"
+    "* a list\n* with items\n\n"
+    "> a quote & some \"quotes\"\n\n"
+    "```\nfenced <code>\n```\n\n"
+    "## another header\n\n"
+    "<div>\nsome html\n</div>\n\n"
+    "[link]: /url \"title\"\n"
+    "[^1]: a footnote\n\n";
+
+char *samples[] = { "", "toc", "footnote,toc,fencedcode", "cdata", "strict" };
+#define NRSAMPLES	(sizeof samples / sizeof samples[0])
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+/* read a whole file into memory
+ */
+void
+slurp(char *file)
+{
+    FILE *f = fopen(file, "r");
+    int c;
+
+    if ( !f )
+	fail(file);
+
+    for ( size = 0; (c = getc(f)) != EOF; text[size++] = c )
+	if ( size >= alloc && !(text = realloc(text, alloc += 4096)) )
+	    fail("realloc");
+    fclose(f);
+}
+
+
+int
+sink(const char *bfr, const int size, void *ctx)
+{
+    struct output *out = ctx;
+
+    if ( ++out->calls == out->fail )
+	return EOF;
+
+    if ( out->size + size >= out->alloc
+	     && !(out->text = realloc(out->text, out->alloc += size + 4096)) )
+	fail("realloc");
+    memcpy(out->text + out->size, bfr, size);
+    out->size += size;
+    return size;
+}
+
+
+/* did a sink get `size` bytes of `want` (and then `more`)?
+ */
+int
+same(char *what, struct output *out, char *want, int size, char *more)
+{
+    int extra = strlen(more);
+
+    if ( (out->size == size + extra)
+	    && ((out->size == 0) || ((memcmp(out->text, want, size) == 0)
+				 && (memcmp(out->text+size, more, extra) == 0))) )
+	return 0;
+    fprintf(stderr, "%s: %s is not the same (%d bytes, wanted %d)\n",
+		    pgm, what, out->size, size + extra);
+    return 1;
+}
+
+
+MMIOT *
+compile(char *text, int size, mkd_flag_t *flags)
+{
+    MMIOT *doc = mkd_string(text, size, flags);
+
+    if ( !doc || !mkd_compile(doc, flags) ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    return doc;
+}
+
+
+/* check the sinks against the functions that keep the output in memory
+ */
+int
+check(mkd_flag_t *flags)
+{
+    struct output out;
+    MMIOT *doc;
+    char *html, *copy, *toc, *css, *xml;
+    int szhtml, sztoc, szcss, szxml, rc = 0;
+
+    /* (the html is copied, because it's written over when the
+     * document is rendered again)
+     */
+    doc = compile(text, size, flags);
+    if ( (szhtml = mkd_document(doc, &html)) == EOF ) {
+	fprintf(stderr, "%s: can't generate the document\n", pgm);
+	exit(1);
+    }
+    if ( !(copy = malloc(szhtml+1)) )
+	fail("malloc");
+    html = memcpy(copy, html, szhtml+1);
+
+    xml = 0;
+    if ( mkd_flag_isset(flags, MKD_CDATA) ) {
+	/* (mkd_document() never xmlifies the html, but the sink does)
+	 */
+	if ( (szxml = mkd_xml(html, szhtml, &xml)) == EOF ) {
+	    fprintf(stderr, "%s: can't xmlify the document\n", pgm);
+	    exit(1);
+	}
+	free(html);
+	html = xml;
+	szhtml = szxml;
+	xml = 0;
+    }
+
+    memset(&out, 0, sizeof out);
+    if ( mkd_sink_html(doc, sink, &out) == EOF ) {
+	fprintf(stderr, "%s: mkd_sink_html failed\n", pgm);
+	rc = 1;
+    }
+    rc |= same("the html", &out, html, szhtml, szhtml ? "\n" : "");
+
+    if ( mkd_flag_isset(flags, MKD_TOC) ) {
+	sztoc = mkd_toc(doc, &toc);
+	out.size = 0;
+	if ( mkd_sink_toc(doc, sink, &out) == EOF ) {
+	    fprintf(stderr, "%s: mkd_sink_toc failed\n", pgm);
+	    rc = 1;
+	}
+	rc |= same("the table of contents", &out, toc, sztoc, "");
+	free(toc);
+    }
+
+    szcss = mkd_css(doc, &css);
+    out.size = 0;
+    if ( mkd_sink_css(doc, sink, &out) == EOF ) {
+	fprintf(stderr, "%s: mkd_sink_css failed\n", pgm);
+	rc = 1;
+    }
+    rc |= same("the css", &out, css, szcss, "");
+    free(css);
+
+    if ( !xml ) {
+	szxml = mkd_xml(html, szhtml, &xml);
+	out.size = 0;
+	if ( mkd_sink_xml(html, szhtml, sink, &out) == EOF ) {
+	    fprintf(stderr, "%s: mkd_sink_xml failed\n", pgm);
+	    rc = 1;
+	}
+	rc |= same("the xml", &out, xml, szxml, "");
+	free(xml);
+    }
+
+    /* a sink that fails makes the whole thing fail
+     */
+    if ( szhtml ) {
+	out.size = out.calls = 0;
+	out.fail = 1;
+	if ( mkd_sink_html(doc, sink, &out) != EOF ) {
+	    fprintf(stderr, "%s: mkd_sink_html didn't notice the sink failing\n", pgm);
+	    rc = 1;
+	}
+	out.fail = 0;
+    }
+
+    mkd_cleanup(doc);
+    free(html);
+    free(out.text);
+    return rc;
+}
+
+
+/* a document with no html in it shouldn't write anything at all
+ */
+int
+empty(mkd_flag_t *flags)
+{
+    static char *nothing[] = { "", "\n\n", "[link]: /url\n" };
+    struct output out;
+    MMIOT *doc;
+    int i, rc = 0;
+
+    if ( mkd_flag_isset(flags, MKD_CDATA) )
+	return 0;
+
+    memset(&out, 0, sizeof out);
+    for ( i=0; i < sizeof nothing / sizeof nothing[0]; i++ ) {
+	doc = compile(nothing[i], strlen(nothing[i]), flags);
+	out.size = 0;
+	if ( mkd_sink_html(doc, sink, &out) == EOF ) {
+	    fprintf(stderr, "%s: mkd_sink_html failed on an empty document\n", pgm);
+	    rc = 1;
+	}
+	rc |= same("an empty document", &out, "", 0, "");
+	mkd_cleanup(doc);
+    }
+    free(out.text);
+    return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    mkd_flag_t *flags = mkd_flags();
+    char *opts, *bad;
+    int opt, i, rc = 0;
+
+    while ( (opt = getopt(argc, argv, "f:")) != EOF ) {
+	switch (opt) {
+	case 'f':   if ( (bad = mkd_set_flag_string(flags, optarg)) ) {
+			fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+			exit(1);
+		    }
+		    break;
+	default:    fprintf(stderr, "usage: %s [-f flags] [file]\n", pgm);
+		    exit(1);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ( argc > 0 ) {
+	slurp(argv[0]);
+	rc = check(flags);
+    }
+    else {
+	fputs("check the output sinks: ", stdout);
+	fflush(stdout);
+
+	text = sample;
+	size = sizeof sample - 1;
+
+	for ( i=0; (i < NRSAMPLES) && (rc == 0); i++ ) {
+	    printf("%s ", *samples[i] ? samples[i] : "default");
+	    fflush(stdout);
+
+	    mkd_free_flags(flags);
+	    flags = mkd_flags();
+	    opts = strdup(samples[i]);	/* (mkd_set_flag_string() writes on it) */
+	    if ( (bad = mkd_set_flag_string(flags, opts)) ) {
+		fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+		exit(1);
+	    }
+	    free(opts);
+	    rc = check(flags) || empty(flags);
+	}
+	if ( rc == 0 )
+	    puts("ok");
+    }
+    mkd_free_flags(flags);
+    exit(rc);
+}
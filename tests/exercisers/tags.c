@@ -0,0 +1,131 @@
+/*
+ * charge some allocations to the allocation profiler's subsystems
+ * (with atag() and auntag() nested, with a tag that doesn't exist,
+ * and with a block that's reallocated under a different tag than it
+ * was allocated under) and check that the profile adump() writes
+ * has every subsystem, by name and in order, charged with what it
+ * should have been.
+ *
+ * usage: tags
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "amalloc.h"
+
+/* (these are always the real thing here, whether or not the library
+ * was built with amalloc)
+ */
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef adump
+
+extern void *amalloc(int);
+extern void *arealloc(void*,int);
+extern void afree(void*);
+extern void adump();
+extern void atag(int);
+extern void auntag();
+
+char *pgm = "tags";
+
+char want[] =
+    "subsystem        allocs   reallocs    current       peak\n"
+    "other                 3          0          0        100\n"
+    "lines                 2          0          0        200\n"
+    "paragraphs            1          0          0        300\n"
+    "queue                 2          0          0        400\n"
+    "output                1          1          0       1000\n"
+    "footnotes             1          0          0        600\n"
+    "total                10          1          0       1060\n"
+    "realloc sizes:\n"
+    "  <=     1024: 1\n";
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char *p, *q, *r, *s;
+    char got[sizeof want + 200];
+    int i, size, err;
+    FILE *profile;
+
+    fputs("check the allocation tags: ", stdout);
+    fflush(stdout);
+
+    /* a block for every subsystem, each one bigger than the last
+     */
+    for ( i=0; i < A_NR_TAGS; i++ ) {
+	atag(i);
+	if ( !(p = amalloc(100 * (i+1))) )
+	    fail("amalloc");
+	auntag();
+	afree(p);
+    }
+
+    /* nested tags, and a tag that's out of range
+     */
+    atag(A_LINES);
+    atag(A_QUEUE);
+    p = amalloc(10);
+    auntag();
+    q = amalloc(20);
+    auntag();
+    atag(A_NR_TAGS);
+    r = amalloc(30);
+    auntag();
+
+    /* a block that isn't charged to anything is charged to the
+     * subsystem that reallocates it
+     */
+    s = amalloc(40);
+    atag(A_OUTPUT);
+    s = arealloc(s, 1000);
+    auntag();
+
+    if ( !(p && q && r && s) )
+	fail("amalloc");
+    afree(p);
+    afree(q);
+    afree(r);
+    afree(s);
+
+    /* catch the profile on its way to stderr
+     */
+    if ( !(profile = tmpfile()) || (err = dup(2)) < 0 )
+	fail("tmpfile");
+    setenv("AMALLOC_PROFILE", "1", 1);
+    fflush(stderr);
+    dup2(fileno(profile), 2);
+    adump();
+    fflush(stderr);
+    dup2(err, 2);
+    close(err);
+
+    rewind(profile);
+    size = fread(got, 1, sizeof got - 1, profile);
+    got[size] = 0;
+    fclose(profile);
+
+    if ( strcmp(got, want) != 0 ) {
+	fprintf(stderr, "%s: the profile is not the same\nwanted:\n%sgot:\n%s",
+			pgm, want, got);
+	exit(1);
+    }
+    puts("ok");
+    exit(0);
+}
@@ -0,0 +1,447 @@
+/*
+ * make random edits to a document with mkd_update() and check that the
+ * html is the same as compiling the edited document from scratch (and
+ * as compiling it from scratch and rendering it through a block cache),
+ * or (with -b count) time typing into it against compiling it from
+ * scratch.
+ *
+ * usage: update [-f flags] [-n edits] [-r seed] [-t threads] [-b count]
+ *		 [-c blocks] [file]
+ *
+ * Without a file, it edits a sample document with a few different sets
+ * of flags.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "mkdio.h"
+
+char *pgm = "update";
+
+char *text;			/* the document as it's being edited */
+int size, alloc;
+int threads;			/* compile & render with this many threads */
+struct mkd_cache *cache;	/* the html for blocks from earlier edits */
+
+/* bits of markdown that change what the blocks around them are
+ */
+char *bits[] = {
+    "\n", "\n\n", "x", "some words ", "# ", "> ", "* ", "1. ", "    ",
+    "\t", "```\n", "~~~\n", "<div>\n", "</div>\n", "<!-- ", " -->\n",
+    "---\n", "=====\n", "[^1]", "[^1]: a note\n", "[link]", "[link]: /url\n",
+    "|a|b|\n", "|-|-|\n", ":   ", "%title\n", "***", "=", "-", " ",
+} ;
+#define NRBITS	(sizeof bits / sizeof bits[0])
+
+/* the sample document (which is repeated enough times to be cut into
+ * more than a few pieces)
+ */
+char sample[] =
+    "% title\n% author\n% date\n"
+    "A header\n========\n\n"
+    "Some text with a [link] and a footnote[^1].\n"
+    "More of the same paragraph.\n\n"
+    "* a list\n* with items\n\n    and an indented paragraph\n\n"
+    "* after a blank line\n\n"
+    "> a quote\n> that goes on\n\n"
+    "more quote\n\n"
+    "```\ncode\n\nin a fence\n```\n\n"
+    "    indented code\n\n    more code\n\n"
+    "<div>\nsome html\n\n</div>\n\n"
+    "<!-- a comment\n\n-->\n\n"
+    "term\n:   definition\n\n"
+    "|a|b|\n|-|-|\n|1|2|\n\n"
+    "## another header\n\n"
+    "[link]: /url \"title\"\n"
+    "[^1]: a footnote\n\n"
+    "---\n\n";
+
+#define REPEAT	12
+
+char *samples[] = { "", "toc", "footnote,fencedcode,dlextra", "toc,strict", "nohtml" };
+#define NRSAMPLES	(sizeof samples / sizeof samples[0])
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+/* read a whole file into memory
+ */
+void
+slurp(char *file)
+{
+    FILE *f = fopen(file, "r");
+    int c;
+
+    if ( !f )
+	fail(file);
+
+    for ( size = 0; (c = getc(f)) != EOF; text[size++] = c )
+	if ( size >= alloc && !(text = realloc(text, alloc += 4096)) )
+	    fail("realloc");
+    fclose(f);
+}
+
+
+/* change the text
+ */
+void
+change(int offset, int old, char *new, int length)
+{
+    if ( size - old + length >= alloc
+	    && !(text = realloc(text, alloc = size - old + length + 4096)) )
+	fail("realloc");
+
+    memmove(text + offset + length, text + offset + old, size - (offset + old));
+    memcpy(text + offset, new, length);
+    size += length - old;
+}
+
+
+/* change the text, then tell the document about it
+ */
+void
+edit(MMIOT *doc, int offset, int old, char *new, int length)
+{
+    change(offset, old, new, length);
+
+    if ( mkd_update(doc, offset, old, new, length) == EOF ) {
+	fprintf(stderr, "%s: mkd_update(%d, %d, %d) failed\n", pgm, offset, old, length);
+	exit(1);
+    }
+}
+
+
+/* an edit that runs off the end of the document (even one whose end
+ * is past the largest int) is refused
+ */
+int
+misfit(MMIOT *doc)
+{
+    if ( (mkd_update(doc, size, 1, "", 0) != EOF)
+	    || (mkd_update(doc, 1, INT_MAX, "", 0) != EOF)
+	    || (mkd_update(doc, INT_MAX, INT_MAX, "", 0) != EOF) ) {
+	fprintf(stderr, "%s: an edit past the end of the document wasn't refused\n", pgm);
+	return 1;
+    }
+    return 0;
+}
+
+
+/* make a random edit, mostly at the start of a line
+ */
+void
+scribble(MMIOT *doc)
+{
+    int offset = size ? (rand() % (size+1)) : 0;
+    int old;
+    char *eol;
+
+    if ( rand() % 2 )
+	while ( offset > 0 && text[offset-1] != '\n' )
+	    --offset;
+
+    switch ( rand() % 3 ) {
+    case 0: /* delete a few characters or a line */
+	if ( (rand() % 2) && (eol = memchr(text+offset, '\n', size-offset)) )
+	    old = 1 + (eol - (text+offset));
+	else
+	    old = 1 + rand() % 20;
+	if ( offset + old > size )
+	    old = size - offset;
+	edit(doc, offset, old, "", 0);
+	break;
+
+    case 1: /* replace a character */
+	if ( offset < size ) {
+	    edit(doc, offset, 1, bits[rand() % NRBITS], 1);
+	    break;
+	}
+	/* fall into */
+
+    default: /* insert something */
+	eol = bits[rand() % NRBITS];
+	edit(doc, offset, 0, eol, strlen(eol));
+	break;
+    }
+}
+
+
+/* compile the text from scratch, and return its html (and toc)
+ */
+MMIOT *
+scratch(mkd_flag_t *flags, char **html, char **toc)
+{
+    MMIOT *doc = mkd_string(text, size, flags);
+
+    if ( doc && threads )
+	mkd_set_threads(doc, threads);
+    if ( !doc || !mkd_compile(doc, flags) || mkd_document(doc, html) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    if ( mkd_toc(doc, toc) == EOF )
+	*toc = 0;
+    return doc;
+}
+
+
+/* compile the text from scratch, and render it through the cache
+ */
+MMIOT *
+cached(mkd_flag_t *flags, char **html)
+{
+    MMIOT *doc = mkd_string(text, size, flags);
+
+    if ( doc )
+	mkd_use_cache(doc, cache);
+    if ( !doc || !mkd_compile(doc, flags) || mkd_document(doc, html) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    return doc;
+}
+
+
+int
+same(char *a, char *b)
+{
+    return (a && b) ? (strcmp(a, b) == 0) : (a == b);
+}
+
+
+/* edit the document over and over, checking it against a fresh copy
+ * after every edit
+ */
+int
+check(MMIOT *doc, mkd_flag_t *flags, int edits)
+{
+    MMIOT *fresh, *again;
+    char *html, *toc, *want, *wanttoc, *reused;
+    int i;
+
+    if ( misfit(doc) )
+	return 1;
+
+    for ( i=0; i <= edits; i++ ) {
+	if ( i > 0 )
+	    scribble(doc);
+
+	if ( mkd_document(doc, &html) == EOF ) {
+	    fprintf(stderr, "%s: edit %d: can't render the document\n", pgm, i);
+	    return 1;
+	}
+	if ( mkd_toc(doc, &toc) == EOF )
+	    toc = 0;
+
+	fresh = scratch(flags, &want, &wanttoc);
+	again = cached(flags, &reused);
+	if ( !same(html, want) || !same(toc, wanttoc)
+			       || !same(mkd_doc_title(doc), mkd_doc_title(fresh)) ) {
+	    fprintf(stderr, "%s: edit %d: the document is not the same\n", pgm, i);
+	    fwrite(text, 1, size, stderr);
+	    return 1;
+	}
+	if ( !same(reused, want) ) {
+	    fprintf(stderr, "%s: edit %d: the cached html is not the same\n", pgm, i);
+	    fwrite(text, 1, size, stderr);
+	    return 1;
+	}
+	mkd_cleanup(again);
+	mkd_cleanup(fresh);
+	free(toc);
+	free(wanttoc);
+    }
+    return 0;
+}
+
+
+double
+now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* time typing (and deleting) a character in the middle of the document
+ */
+void
+benchmark(MMIOT *doc, mkd_flag_t *flags, int count)
+{
+    MMIOT *fresh;
+    char *html, *toc;
+    int i, at = size / 2;
+    double start, updated, compiled, reused;
+
+    while ( at > 0 && text[at-1] != '\n' )
+	--at;
+
+    start = now();
+    for ( i=0; i < count; i++ ) {
+	edit(doc, at, 0, "x", 1);
+	mkd_document(doc, &html);
+	edit(doc, at, 1, "", 0);
+	mkd_document(doc, &html);
+    }
+    updated = now() - start;
+
+    start = now();
+    for ( i=0; i < 2*count; i++ ) {
+	fresh = scratch(flags, &html, &toc);
+	mkd_cleanup(fresh);
+	free(toc);
+    }
+    compiled = now() - start;
+
+    start = now();
+    for ( i=0; i < count; i++ ) {
+	change(at, 0, "x", 1);
+	mkd_cleanup(cached(flags, &html));
+	change(at, 1, "", 0);
+	mkd_cleanup(cached(flags, &html));
+    }
+    reused = now() - start;
+
+    printf("%d keystrokes (%d bytes)\n", 2*count, size);
+    printf("  mkd_update():   %10.1f usec/keystroke\n", 1e6 * updated / (2*count));
+    printf("  from scratch:   %10.1f usec/keystroke\n", 1e6 * compiled / (2*count));
+    printf("  block cache:    %10.1f usec/keystroke\n", 1e6 * reused / (2*count));
+}
+
+
+/* set up a document to edit
+ */
+MMIOT *
+open_doc(mkd_flag_t *flags)
+{
+    MMIOT *doc;
+    char *html;
+
+    if ( (doc = mkd_edit_string(text, size, flags)) && threads )
+	mkd_set_threads(doc, threads);
+    if ( !doc || !mkd_compile(doc, flags)
+						     || mkd_document(doc, &html) == EOF ) {
+	fprintf(stderr, "%s: can't compile the document\n", pgm);
+	exit(1);
+    }
+    return doc;
+}
+
+
+/* edit the sample document with each set of flags
+ */
+int
+samplers(int edits)
+{
+    mkd_flag_t *flags;
+    MMIOT *doc;
+    char *opts, *bad;
+    int i, rc = 0;
+
+    fputs("check mkd_update: ", stdout);
+    fflush(stdout);
+
+    for ( i=0; (i < NRSAMPLES) && (rc == 0); i++ ) {
+	for ( size=0; size < REPEAT * (sizeof sample - 1); size += sizeof sample - 1 ) {
+	    if ( size + sizeof sample > alloc && !(text = realloc(text, alloc += 4096)) )
+		fail("realloc");
+	    memcpy(text + size, sample, sizeof sample - 1);
+	}
+
+	printf("%s ", *samples[i] ? samples[i] : "default");
+	fflush(stdout);
+
+	flags = mkd_flags();
+	opts = strdup(samples[i]);	/* (mkd_set_flag_string() writes on it) */
+	if ( (bad = mkd_set_flag_string(flags, opts)) ) {
+	    fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+	    exit(1);
+	}
+	free(opts);
+
+	doc = open_doc(flags);
+	rc = check(doc, flags, edits);
+	mkd_cleanup(doc);
+	mkd_free_flags(flags);
+    }
+    if ( rc == 0 )
+	puts("ok");
+    return rc;
+}
+
+
+int
+main(int argc, char **argv)
+{
+    mkd_flag_t *flags = mkd_flags();
+    MMIOT *doc;
+    char *bad;
+    int opt, edits = 200, bench = 0, seed = 1, blocks = 256, rc;
+
+    while ( (opt = getopt(argc, argv, "f:n:r:t:b:c:")) != EOF ) {
+	switch (opt) {
+	case 'f':   if ( (bad = mkd_set_flag_string(flags, optarg)) ) {
+			fprintf(stderr, "%s: unknown option <%s>\n", pgm, bad);
+			exit(1);
+		    }
+		    break;
+	case 'n':   edits = atoi(optarg);
+		    break;
+	case 'r':   seed = atoi(optarg);
+		    break;
+	case 't':   threads = atoi(optarg);
+		    break;
+	case 'b':   bench = atoi(optarg);
+		    break;
+	case 'c':   blocks = atoi(optarg);
+		    break;
+	default:    fprintf(stderr, "usage: %s [-f flags] [-n edits] [-r seed] "
+				    "[-t threads] [-b count] [-c blocks] [file]\n", pgm);
+		    exit(1);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    /* (the library seeds the random number generator when it starts
+     * up, so get that out of the way before seeding it here)
+     */
+    mkd_initialize();
+    srand(seed);
+
+    /* (small enough that blocks are pushed out of it)
+     */
+    if ( !(cache = mkd_new_cache(blocks)) )
+	fail("mkd_new_cache");
+
+    if ( argc == 0 )
+	exit(samplers(edits));
+    slurp(argv[0]);
+
+    doc = open_doc(flags);
+
+    if ( bench > 0 ) {
+	benchmark(doc, flags, bench);
+	rc = 0;
+    }
+    else
+	rc = check(doc, flags, edits);
+
+    mkd_cleanup(doc);
+    mkd_free_flags(flags);
+    mkd_free_cache(cache);
+    exit(rc);
+}
@@ -111,5 +111,25 @@ try 'multi-line html with trailing text' \
 
 <p>+</p>'
 
+try 'unclosed blocks, then one that is closed' \
+'<div>
+a
+
+<div>
+b
+
+<div>
+c
+</div>' \
+'<p><div>
+a</p>
+
+<p><div>
+b</p>
+
+<div>
+c
+</div>'
+
 summary $0
 exit $rc
@@ -0,0 +1,70 @@
+. tests/functions.sh
+
+title "resource limits"
+
+rc=0
+MARKDOWN_FLAGS=
+
+limit() {
+    try_header "$1"
+    Q=`./echo "$3" | ./markdown -limit "$2" 2>&1; ./echo "status $?"`
+
+    if [ "$4" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$4" | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+limit 'nesting within the limit' depth=2 '> > hi' \
+'<blockquote><blockquote><p>hi</p></blockquote></blockquote>
+status 0'
+
+limit 'nesting past the limit' depth=2 '> > > hi' \
+'markdown: depth limit exceeded
+status 2'
+
+limit 'nested lists past the limit' depth=2 \
+'* one
+    * two
+        * three' \
+'markdown: depth limit exceeded
+status 2'
+
+limit 'reparse depth' reparse=1 '[a^(b)](c)' \
+'markdown: reparse limit exceeded
+status 2'
+
+limit 'emphasis tokens' emphasis=3 '*a* *b*' \
+'markdown: emphasis limit exceeded
+status 2'
+
+limit 'output size' output=10 'hello, world' \
+'markdown: output limit exceeded
+status 2'
+
+limit 'output size within the limit' output=100 'hello, world' \
+'<p>hello, world</p>
+status 0'
+
+limit 'step budget' steps=5 'hello, world' \
+'markdown: steps limit exceeded
+status 2'
+
+limit 'degrading smartypants' degrade=3 'hello -- "world"' \
+'<p>hello -- "world"</p>
+status 0'
+
+limit 'unknown limit' nothing=1 'hello' \
+'markdown: unknown limit <nothing=1>
+status 1'
+
+summary $0
+exit $rc
@@ -133,5 +133,17 @@ try       'link with <>' \
 	  '[this](<is a (test)>)' \
 	  '<p><a href="is%20a%20(test)">this</a></p>'
 
+try       'unclosed brackets before a link' \
+	  '[a [b [c [this](/url) [d' \
+	  '<p>[a [b [c <a href="/url">this</a> [d</p>'
+
+try       'escaped brackets in a label' \
+	  '[a \] b \[ c](/url) [\](x)' \
+	  '<p><a href="/url">a ] b [ c</a> [](x)</p>'
+
+try       'nested brackets in a label' \
+	  '[a [b] [c [d]]](/url) [e](f' \
+	  '<p><a href="/url">a [b] [c [d]]</a> [e](f</p>'
+
 summary $0
 exit $rc
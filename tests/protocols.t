@@ -0,0 +1,52 @@
+. tests/functions.sh
+
+title "url protocols"
+
+rc=0
+MARKDOWN_FLAGS=
+
+# format $4 with flags $3 and the protocols in $2
+protocols() {
+    try_header "$1"
+    Q=`./echo "$4" | ./markdown -protocols "$2" $3 2>&1; ./echo "status $?"`
+
+    if [ "$5" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$5" | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+protocols 'safe links' 'gopher,IRC:' -fsafelink \
+    '[a](gopher://x) [b](irc:x) [c](http://x)' \
+'<p><a href="gopher://x">a</a> <a href="irc:x">b</a> [c](http://x)</p>
+status 0'
+
+protocols 'a protocol inside another' 'go,gopher' -fsafelink \
+    '[a](GO:x) [b](gopher:x) [c](goph:x)' \
+'<p><a href="GO:x">a</a> <a href="gopher:x">b</a> [c](goph:x)</p>
+status 0'
+
+protocols 'autolinks' 'gopher, svn+ssh' -fautolink \
+    'gopher://here svn+ssh://there and http://not' \
+'<p><a href="gopher://here">gopher://here</a> <a href="svn+ssh://there">svn+ssh://there</a> and http://not</p>
+status 0'
+
+protocols 'no protocols' '' -fsafelink,autolink \
+    '[a](http://x) http://y' \
+'<p>[a](http://x) http://y</p>
+status 0'
+
+protocols 'not a protocol' 'http,1ftp' '' 'hi' \
+'markdown: bad protocol list <http,1ftp>
+status 1'
+
+summary $0
+exit $rc
@@ -0,0 +1,36 @@
+. tests/functions.sh
+
+title "rendering on more than one thread"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/render.$$
+
+render() {
+    try_header "$1"
+    shift
+    Q=`./tests/exercisers/render "$@" 2>&1`
+
+    if [ $? -eq 0 ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+# (email addresses are left out, because they're scrambled a different
+# way every time they're written)
+for x in tests/*.text; do
+    grep -v @ $x > $TMP
+    render "`basename $x`" -n 10 -t 4 $TMP
+    render "`basename $x` (footnotes)" -n 10 -t 4 -f footnote,toc $TMP
+done
+
+rm -f $TMP
+
+summary $0
+exit $rc
@@ -12,6 +12,7 @@ try -fsafelink 'illegal url' '[test](b?d:protocol)' \
 try -fsafelink 'url fragment (1)' '[test](#bar)' '<p><a href="#bar">test</a></p>'
 try -fsafelink 'url fragment (2)' '[test](/bar)' '<p><a href="/bar">test</a></p>'
 try -fnosafelink 'bogus url (-fnosafelink)' '[test](bad:protocol)' '<p><a href="bad:protocol">test</a></p>'
+try -fsafelink 'standard protocol' '[test](HTTPS://x)' '<p><a href="HTTPS://x">test</a></p>'
 
 
 summary $0
@@ -0,0 +1,108 @@
+. tests/functions.sh
+
+title "markdown -serve"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/serve.$$
+
+check() {
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$WANT" | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+serve() {
+    try_header "$1"
+    ./echo "$2" > $TMP
+    WANT=`./markdown $3 $TMP 2>&1`
+    Q=`./mkdclient $4 $TMP 2>&1`
+    check "$1"
+}
+
+serve 'paragraphs' 'one
+
+two'
+
+serve 'footnotes' 'a[^1]
+
+[^1]: note' -ffootnote '-f footnote'
+
+serve 'table of contents' '# one
+
+## two' '-T -ftoc' '-T -f toc'
+
+serve 'style blocks' '<style>
+p { color: red; }
+</style>
+
+text' '-S' '-S'
+
+try_header 'unknown flags'
+./echo "text" > $TMP
+WANT='mkdclient: unknown option bogus'
+Q=`./mkdclient -f bogus $TMP 2>&1`
+check 'unknown flags'
+
+try_header 'more than one document'
+./echo "first" > $TMP
+./echo "second" > $TMP.2
+WANT=`./markdown $TMP; ./markdown $TMP.2`
+Q=`./mkdclient $TMP $TMP.2 $TMP`
+WANT="$WANT
+`./markdown $TMP`"
+check 'more than one document'
+
+try_header 'a document that changes a little'
+grep -v @ tests/syntax.text > $TMP
+sed -e 's/^Markdown is not a replacement/Markdown is still not a replacement/' $TMP > $TMP.2
+WANT=`./markdown $TMP; ./markdown $TMP.2; ./markdown $TMP`
+Q=`./mkdclient $TMP $TMP.2 $TMP`
+check 'a document that changes a little'
+
+# the server keeps one cache for everyone, so the same blocks in
+# different documents have to come out the way each of them says
+try_header 'the same blocks in different documents'
+./echo "a [link] and ^sup
+
+[link]: /one" > $TMP
+./echo "a [link] and ^sup
+
+[link]: /two" > $TMP.2
+./echo "x^y a [link] and ^sup
+
+[link]: /one" > $TMP.3
+WANT=`./markdown $TMP; ./markdown $TMP.2; ./markdown $TMP.3; ./markdown $TMP`
+Q=`./mkdclient $TMP $TMP.2 $TMP.3 $TMP`
+check 'the same blocks in different documents'
+
+# a request whose header can't be read gets an error, and is the last
+# one that's answered
+malformed() {
+    try_header "$1"
+    WANT="1 0 0 17
+malformed request"
+    Q=`printf "$2" | ./markdown -serve 2>&1`
+    check "$1"
+}
+
+malformed 'a document that is too big' '2147483647 10\nabc'
+malformed 'flags that are too big' '10 2147483647\nabc'
+malformed 'sizes that overflow' '99999999999999999999 1\nabc'
+malformed 'a negative size' '0 -1\nabc'
+malformed 'a header that is not numbers' 'abc\n0 3\nabc'
+malformed 'a header with one number' '3\nabc'
+
+rm -f $TMP $TMP.2 $TMP.3
+
+summary $0
+exit $rc
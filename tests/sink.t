@@ -0,0 +1,41 @@
+. tests/functions.sh
+
+title "writing to output sinks"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/sink.$$
+
+sink() {
+    try_header "$1"
+    shift
+    Q=`./tests/exercisers/sink "$@" 2>&1`
+
+    if [ $? -eq 0 ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+# (email addresses are left out, because they're scrambled a different
+# way every time they're written)
+for x in tests/*.text; do
+    grep -v @ $x > $TMP
+    sink "`basename $x`" $TMP
+    sink "`basename $x` (toc)" -f footnote,toc $TMP
+    sink "`basename $x` (cdata)" -f cdata $TMP
+done
+
+./echo "
+" > $TMP
+sink 'an empty document' $TMP
+
+rm -f $TMP
+
+summary $0
+exit $rc
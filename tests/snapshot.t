@@ -0,0 +1,142 @@
+. tests/functions.sh
+
+title "saving compiled documents"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/snapshot.$$
+
+check() {
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$WANT" | head -20 | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+# save a document with flags $2, then load it and write it out with
+# output options $3
+snapshot() {
+    try_header "$1"
+    WANT=`./markdown $2 $3 $TMP 2>&1`
+    ./markdown $2 -save $TMP.saved $TMP > /dev/null
+    Q=`./markdown -load $3 $TMP.saved 2>&1`
+    check "$1"
+}
+
+./echo "% a title
+% an author
+% a date
+
+# header one
+
+some *text* with a [link][] and a footnote[^1],
+and an image ![pic](/pic.png =10x20 \"title\")
+
+[link]: /url \"link title\"
+[^1]: the footnote
+
+    with more in it
+
+> a quote
+>
+> * with a list
+>     1. and a nested list
+>
+> ~~~ c
+> fenced code
+> ~~~
+
+<style>
+p { color: red; }
+</style>
+
+term
+:   definition
+
+|a|b|
+|-|-|
+|1|2|
+
+## header two
+" > $TMP
+
+snapshot 'html' ''
+snapshot 'title and header labels' '-ftoc' '-T -S'
+snapshot 'footnotes' '-ffootnote,fencedcode,dlextra'
+snapshot 'a different url base' '-ffootnote' '-b http://cdn.example.com -C note'
+
+# (email addresses are left out, because they're scrambled a different
+# way every time they're written)
+for x in tests/syntax.text tests/snakepit.text; do
+    if [ -r $x ]; then
+	grep -v @ $x > $TMP
+	snapshot "`basename $x`" '-ftoc' '-T'
+    fi
+done
+
+# a line that compiling leaves shorter than its indent
+printf '1. x\n    ``\n~ y\n```' > $TMP
+snapshot 'a line shorter than its indent' '-ffencedcode'
+
+# check that markdown -load (writing a table of contents) refuses $TMP
+loadfails() {
+    try_header "$1"
+    if ./markdown -load -T $TMP > /dev/null 2>&1; then
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "markdown -load did not fail"
+	rc=1
+    else
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    fi
+}
+
+loadfails 'something that was not saved'
+
+./echo "one
+
+two" > $TMP
+./markdown -save $TMP.saved $TMP > /dev/null
+head -c 40 $TMP.saved > $TMP
+loadfails 'a truncated document'
+
+# overwrite the saved document at `offset` bytes past the flags (a
+# document that's just a header is the source block it's in, then the
+# header, then its one line of text) with the bytes in $2
+./echo "# a header" > $TMP
+./markdown -ftoc -save $TMP.saved $TMP > /dev/null
+corrupt() {
+    cp $TMP.saved $TMP
+    offset=`od -An -tu1 -j8 -N1 $TMP.saved`
+    offset=`expr 12 + $offset + $1`
+    printf "$2" | dd of=$TMP bs=1 seek=$offset conv=notrunc 2>/dev/null
+}
+
+corrupt 64 '\377\377\377\177'
+loadfails 'a header that is too deep'
+corrupt 64 '\0\0\0\0'
+loadfails 'a header that is not deep enough'
+corrupt 68 '\4\0\0\0'
+loadfails 'a block with flags that do not exist'
+corrupt 124 '\2\0\0\0'
+loadfails 'a line that is fenced twice'
+corrupt 132 '\0\0\0\1'
+loadfails 'a line with more fence than the document'
+corrupt 132 '\377\377\377\377'
+loadfails 'a line with less than no fence'
+corrupt 76 'a \00199\002'
+loadfails 'a line with control characters in it'
+
+rm -f $TMP $TMP.saved
+
+summary $0
+exit $rc
@@ -0,0 +1,73 @@
+. tests/functions.sh
+
+title "document statistics"
+
+rc=0
+MARKDOWN_FLAGS=
+
+# the timing lines vary from run to run, so leave them out
+stats() {
+    if [ "$1" = "-d" ]; then
+	shift
+	try_header "$1"
+	Q=`./echo "$2" | ./markdown -d --stats | sed -ne '/^input:/,$p'`
+    else
+	try_header "$1"
+	Q=`./echo "$2" | ./markdown --stats 2>&1 >/dev/null`
+    fi
+    Q=`./echo "$Q" | grep -v '^time:' | sed -e 's/ (.*s)$//'`
+
+    if [ "$3" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$3" | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+stats 'empty document' '' \
+'input: 1 byte, 1 line
+paragraphs: source=1
+footnotes: 0
+reparses: 0
+emphasis tokens: 0
+links: 0
+callbacks: 0
+output: 0 bytes'
+
+stats 'paragraphs, links, and emphasis' \
+'# header
+
+*hello* [world][w] and <http://example.com>
+
+* one
+* two
+
+[w]: http://example.com/world' \
+'input: 98 bytes, 8 lines
+paragraphs: markup=3 ul=1 item=2 header=1 source=1
+footnotes: 1
+reparses: 1
+emphasis tokens: 2
+links: 2
+callbacks: 0
+output: 178 bytes'
+
+stats -d 'statistics in the parse tree dump' 'hi' \
+'input: 3 bytes, 1 line
+paragraphs: markup=1 source=1
+footnotes: 0
+reparses: 0
+emphasis tokens: 0
+links: 0
+callbacks: 0
+output: 0 bytes'
+
+summary $0
+exit $rc
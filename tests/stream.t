@@ -0,0 +1,125 @@
+. tests/functions.sh
+
+title "streaming"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/stream.$$
+
+stream() {
+    try_header "$1"
+    ./echo "$2" > $TMP
+    WANT=`./markdown $3 < $TMP 2>&1`
+    Q=`./markdown -stream $3 < $TMP 2>&1`
+
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$WANT" | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+stream 'paragraphs' 'one
+
+two
+
+three'
+
+stream 'reference links' '[a][] and [b][]
+
+[a]: http://a
+
+and more
+
+[b]: http://b'
+
+stream 'footnotes' 'a[^1] and b[^2]
+
+[^2]: second
+
+[^1]: first
+
+    with a second paragraph' -ffootnote
+
+stream 'html blocks' '<div>
+
+not markdown
+
+</div>
+
+*but this is*'
+
+stream 'code fences' '~~~
+
+one
+
+<div>
+
+~~~
+
+two'
+
+stream 'lists and quotes' '* one
+
+* two
+
+> three
+
+> four'
+
+# (the footnote isn't there when the paragraph is compiled, so the
+# text after it is still within a blank line of the fence)
+stream 'a footnote after a fenced paragraph' 'a
+```
+x
+```
+
+[^8]: n
+
+b
+
+# x' -ffencedcode,footnotes
+
+stream 'pandoc header' '% title
+% author
+% date
+
+body'
+
+stream 'empty input' ''
+
+# a document with no html in it writes nothing at all (compared byte
+# for byte, because `...` drops trailing newlines)
+nothing() {
+    try_header "$1"
+    printf "$2" > $TMP
+    WANT=`./markdown < $TMP | od -c`
+    Q=`./markdown -stream < $TMP | od -c`
+
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted: $WANT"
+	./echo "got:    $Q"
+	rc=1
+    fi
+}
+
+nothing 'an empty document' ''
+nothing 'only blank lines' '\n\n'
+nothing 'only a reference link' '[link]: /url\n'
+
+rm -f $TMP
+
+summary $0
+exit $rc
@@ -0,0 +1,118 @@
+. tests/functions.sh
+
+title "compiling and generating with threads"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/threads.$$
+
+# a document that's big enough to be cut into pieces
+i=0
+while [ $i -lt 400 ]; do
+    ./echo "# section $i
+
+text for section $i[^$i] with a [link][l$i]
+
+* one
+* two
+
+        code $i
+
+<div>
+html $i
+</div>
+
+~~~
+fenced $i
+
+~~~
+
+[^$i]: footnote $i
+
+[l$i]: http://example.com/$i
+"
+    test `expr $i % 100` -eq 50 && ./echo "see footnote 1[^1]
+"
+    i=`expr $i + 1`
+done > $TMP
+
+threads() {
+    try_header "$1"
+    WANT=`./markdown $2 < ${3:-$TMP} 2>&1`
+    Q=`./markdown -threads 4 $2 < ${3:-$TMP} 2>/dev/null`
+
+    if [ "$WANT" = "$Q" ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "wanted:"
+	./echo "$WANT" | head -20 | sed -e 's/^/	/'
+	./echo "got:"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+threads 'html' ''
+threads 'footnotes and fenced code' '-ffootnote,fencedcode'
+threads 'footnotes with a prefix' '-ffootnote -C note'
+threads 'table of contents' '-T -ftoc'
+threads 'parse tree' '-d'
+
+# superscripts that depend on the paragraph before them, at the
+# places where the document is cut into pieces
+i=0
+while [ $i -lt 200 ]; do
+    if [ `expr $i % 2` -eq 0 ]; then
+	./echo "^sup$i [^$i]
+"
+    else
+	./echo "para$i a
+"
+    fi
+    i=`expr $i + 1`
+done > $TMP.sup
+i=0
+while [ $i -lt 200 ]; do
+    ./echo "[^$i]: note $i
+"
+    i=`expr $i + 2`
+done >> $TMP.sup
+
+threads 'superscripts and footnotes between pieces' '-ffootnote' $TMP.sup
+threads 'superscripts between pieces' '' $TMP.sup
+
+# a fenced paragraph that carries on past a footnote, right where
+# the document is first cut into pieces
+i=0
+while [ $i -lt 496 ]; do
+    ./echo "p
+"
+    i=`expr $i + 1`
+done > $TMP
+./echo 'a
+```
+x
+```
+
+[^8]: n
+
+b
+
+# x
+' >> $TMP
+i=0
+while [ $i -lt 1500 ]; do
+    ./echo "q
+"
+    i=`expr $i + 1`
+done >> $TMP
+
+threads 'a footnote after a fenced paragraph' '-ffencedcode,footnote'
+
+rm -f $TMP $TMP.sup
+
+summary $0
+exit $rc
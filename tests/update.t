@@ -0,0 +1,87 @@
+. tests/functions.sh
+
+title "editing a document"
+
+rc=0
+MARKDOWN_FLAGS=
+TMP=/tmp/update.$$
+
+update() {
+    try_header "$1"
+    shift
+    Q=`./tests/exercisers/update "$@" 2>&1`
+
+    if [ $? -eq 0 ]; then
+	__passed=`expr $__passed + 1`
+	test $VERBOSE && ./echo " ok"
+    else
+	__failed=`expr $__failed + 1`
+	test $VERBOSE || ./echo "$1"
+	./echo "$Q" | head -20 | sed -e 's/^/	/'
+	rc=1
+    fi
+}
+
+# (email addresses are left out, because they're scrambled a different
+# way every time they're written)
+for x in tests/*.text; do
+    grep -v @ $x > $TMP
+    update "`basename $x`" -n 100 $TMP
+    update "`basename $x` (toc)" -n 100 -f toc -r 2 $TMP
+    update "`basename $x` (footnotes)" -n 100 -f footnote,fencedcode -r 3 $TMP
+done
+
+update 'on more than one thread' -n 100 -t 4 $TMP
+
+# superscripts that depend on the paragraph before them, in pieces
+# that are rendered again next to ones that aren't
+i=0
+while [ $i -lt 200 ]; do
+    if [ `expr $i % 2` -eq 0 ]; then
+	./echo "^sup$i
+"
+    else
+	./echo "para$i a
+"
+    fi
+    i=`expr $i + 1`
+done > $TMP
+
+update 'superscripts between pieces' -n 200 $TMP
+
+# a fenced paragraph that carries on past a footnote, where the
+# document is cut into pieces (compiled before it's edited, too)
+i=0
+while [ $i -lt 31 ]; do
+    ./echo "p
+"
+    i=`expr $i + 1`
+done > $TMP
+./echo 'a
+```
+x
+```
+
+[^8]: n
+
+b
+
+# x
+' >> $TMP
+i=0
+while [ $i -lt 200 ]; do
+    ./echo "q
+"
+    i=`expr $i + 1`
+done >> $TMP
+update 'a footnote after a fenced paragraph' -n 20 -f fencedcode,footnote $TMP
+
+# a cache with room for only a few blocks, so they're all looked for
+# in the same places
+grep -v @ tests/syntax.text > $TMP
+update 'through a very small cache' -n 100 -c 1 $TMP
+
+rm -f $TMP
+
+summary $0
+exit $rc
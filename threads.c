@@ -0,0 +1,202 @@
+/* markdown: a C implementation of John Gruber's Markdown markup language.
+ *
+ * Copyright (C) 2007 David L Parsons.
+ * The redistribution terms are provided in the COPYRIGHT file that must
+ * be distributed with this source code.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "config.h"
+
+#if USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "cstring.h"
+#include "markdown.h"
+#include "amalloc.h"
+
+/* the most threads a document (or a batch of them) can use
+ */
+#define MAX_THREADS	256
+
+
+/* each thread has a run of jobs to do; when it runs out, it steals
+ * half of what's left in some other thread's run
+ */
+struct worker {
+    int id;
+    int lo, hi;			/* the jobs it hasn't started yet */
+    struct parallel *all;
+#if USE_THREADS
+    pthread_t tid;
+    int started;		/* did the thread start? */
+    pthread_mutex_t lock;
+#endif
+} ;
+
+/* a set of jobs being run by ___mkd_parallel()
+ */
+struct parallel {
+    void (*fn)(void *, int, int);	/* what to run */
+    void *ctx;				/* and what to run it on */
+    int count;				/* how many threads there are */
+    struct worker *w;
+} ;
+
+
+#if USE_THREADS
+# define LOCK(w)	pthread_mutex_lock(&(w)->lock)
+# define UNLOCK(w)	pthread_mutex_unlock(&(w)->lock)
+#else
+# define LOCK(w)	(void)0
+# define UNLOCK(w)	(void)0
+#endif
+
+
+/* take the next job from a thread's own run, or -1 if it's empty
+ */
+static int
+nextjob(struct worker *me)
+{
+    int job;
+
+    LOCK(me);
+    job = (me->lo < me->hi) ? me->lo++ : -1;
+    UNLOCK(me);
+    return job;
+}
+
+
+/* take the back half of some other thread's run, returning the first
+ * job of it (or -1 if there's nothing left anywhere)
+ */
+static int
+steal(struct worker *me)
+{
+    struct parallel *p = me->all;
+    struct worker *them;
+    int i, lo, hi;
+
+    for ( i=1; i < p->count; i++ ) {
+	them = &p->w[(me->id + i) % p->count];
+
+	LOCK(them);
+	hi = them->hi;
+	lo = them->hi -= (them->hi - them->lo + 1) / 2;
+	UNLOCK(them);
+
+	if ( lo < hi ) {
+	    LOCK(me);
+	    me->lo = lo+1;
+	    me->hi = hi;
+	    UNLOCK(me);
+	    return lo;
+	}
+    }
+    return -1;
+}
+
+
+static void *
+worker(void *arg)
+{
+    struct worker *me = arg;
+    int job;
+
+    while ( (job = nextjob(me)) >= 0 || (job = steal(me)) >= 0 )
+	(*me->all->fn)(me->all->ctx, job, me->id);
+    return 0;
+}
+
+
+/* run jobs 0 .. count-1 on up to `threads` threads (the caller is
+ * one of them) and wait for them all to finish.  `fn` is passed the
+ * job and which thread (0 .. threads-1) is running it, so it can keep
+ * things for each thread.  Each thread starts with an even share of
+ * the jobs and steals from the others when it runs out, so the jobs
+ * can finish in any order and can't write to anything they share.
+ * If threads can't be started (or the library was built without them)
+ * the caller does all of the work.
+ */
+void
+___mkd_parallel(int threads, int count, void (*fn)(void *, int, int), void *ctx)
+{
+    struct parallel p;
+    struct worker one, *w;
+    int i;
+
+    if ( count < 1 )
+	return;
+
+#if USE_THREADS
+    if ( threads > count )
+	threads = count;
+    if ( threads > MAX_THREADS )
+	threads = MAX_THREADS;
+#else
+    threads = 1;
+#endif
+
+    p.fn = fn;
+    p.ctx = ctx;
+    if ( (threads < 2) || !(p.w = calloc(threads, sizeof p.w[0])) ) {
+	threads = 1;
+	p.w = &one;
+    }
+    p.count = threads;
+
+    for ( i=0; i < threads; i++ ) {
+	w = &p.w[i];
+	w->id = i;
+	w->lo = (int)( ((long)count * i) / threads );
+	w->hi = (int)( ((long)count * (i+1)) / threads );
+	w->all = &p;
+#if USE_THREADS
+	pthread_mutex_init(&w->lock, 0);
+#endif
+    }
+
+#if USE_THREADS
+    /* if a thread can't be started, the ones that are running will
+     * steal its jobs
+     */
+    for ( i=1; i < threads; i++ )
+	p.w[i].started = (pthread_create(&p.w[i].tid, 0, worker, &p.w[i]) == 0);
+#endif
+
+    worker(&p.w[0]);
+
+#if USE_THREADS
+    for ( i=1; i < threads; i++ )
+	if ( p.w[i].started )
+	    pthread_join(p.w[i].tid, 0);
+    for ( i=0; i < threads; i++ )
+	pthread_mutex_destroy(&p.w[i].lock);
+#endif
+
+    if ( p.w != &one )
+	free(p.w);
+}
+
+
+/* let mkd_compile() and the html generators use up to `threads`
+ * threads on a large document (1 turns threading off.)  Returns EOF
+ * if the library was built without threads.
+ */
+int
+mkd_set_threads(Document *doc, int threads)
+{
+    if ( !doc || threads < 1 )
+	return EOF;
+
+#if USE_THREADS
+    doc->threads = (threads > MAX_THREADS) ? MAX_THREADS : threads;
+    return 0;
+#else
+    doc->threads = 1;
+    return (threads == 1) ? 0 : EOF;
+#endif
+}
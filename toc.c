@@ -20,15 +20,15 @@
 /* import from Csio.c */
 extern void Csreparse(Cstring *, char *, int, mkd_flag_t*);
 
-/* write an header index
+/* write an header index to a sink
  */
 int
-mkd_toc(Document *p, char **doc)
+mkd_sink_toc(Document *p, mkd_sink_t fn, void *ctx)
 {
     Paragraph *tp, *srcp;
     int last_hnumber = 0;
     Cstring res;
-    int size;
+    struct mkd_sink out;
     int first = 1;
 #if HAVE_NAMED_INITIALIZERS
     static mkd_flag_t islabel = { { [IS_LABEL] = 1 } };
@@ -40,12 +40,11 @@ mkd_toc(Document *p, char **doc)
 #endif
 
 
-    if ( !(doc && p && p->ctx) ) return -1;
-
-    *doc = 0;
+    if ( !(fn && p && p->ctx) ) return -1;
 
     if ( ! is_flag_set(&p->ctx->flags, MKD_TOC) ) return 0;
 
+    SINK_TO(out, fn, ctx);
     CREATE(res);
     RESERVE(res, 100);
 
@@ -81,6 +80,7 @@ mkd_toc(Document *p, char **doc)
 		    Csreparse(&res, T(srcp->text->text),
 				    S(srcp->text->text), &islabel);
 		    Csprintf(&res, "</a>");
+		    ___mkd_flush(&res, &out);
 
 		    first = 0;
 		}
@@ -93,8 +93,27 @@ mkd_toc(Document *p, char **doc)
 	Csprintf(&res, "</li>\n%*s</ul>\n%*s",
 		 last_hnumber, "", last_hnumber, "");
     }
+    ___mkd_flush(&res, &out);
+    DELETE(res);
+
+    return out.error ? EOF : out.written;
+}
+
+
+/* write an header index into a string
+ */
+int
+mkd_toc(Document *p, char **doc)
+{
+    Cstring res;
+    int size;
+
+    if ( !(doc && p && p->ctx) ) return -1;
+
+    *doc = 0;
 
-    if ( (size = S(res)) > 0 ) {
+    CREATE(res);
+    if ( (size = mkd_sink_toc(p, Cssink, &res)) > 0 ) {
 	/* null-terminate & strdup into a free()able memory chunk
 	 */
 	EXPAND(res) = 0;
@@ -206,14 +225,7 @@ ___mkd_uniquify(ParagraphRoot *pr, Paragraph *pp)
 int
 mkd_generatetoc(Document *p, FILE *out)
 {
-    char *buf = 0;
-    int sz = mkd_toc(p, &buf);
-    int ret = EOF;
-
-    if ( sz > 0 )
-	ret = fwrite(buf, 1, sz, out);
-
-    if ( buf ) free(buf);
+    int sz = mkd_sink_toc(p, ___mkd_fsink, out);
 
-    return (ret == sz) ? ret : EOF;
+    return (sz > 0) ? sz : EOF;
 }
@@ -0,0 +1,251 @@
+/*
+ * mkdclient: send documents to `markdown -serve` and print what comes
+ * back, or time it against running markdown once per document.
+ *
+ * usage: mkdclient [-s socket] [-m markdown] [-f flags] [-S] [-T]
+ *                  [-b count] [file...]
+ *
+ * Without -s, it starts its own `markdown -serve` (./markdown, or the
+ * program given with -m.)
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+char *pgm = "mkdclient";
+char *markdown = "./markdown";
+
+FILE *to, *from;		/* the server */
+
+
+void
+fail(char *why)
+{
+    fprintf(stderr, "%s: ", pgm);
+    perror(why);
+    exit(1);
+}
+
+
+/* read a whole file (or stdin) into memory
+ */
+char *
+slurp(char *file, int *size)
+{
+    FILE *f = file ? fopen(file, "r") : stdin;
+    char *text = 0;
+    int alloc = 0, c;
+
+    if ( !f )
+	fail(file);
+
+    for ( *size = 0; (c = getc(f)) != EOF; text[(*size)++] = c )
+	if ( *size >= alloc && !(text = realloc(text, alloc += 4096)) )
+	    fail("realloc");
+
+    if ( file )
+	fclose(f);
+    return text;
+}
+
+
+void
+connect_to(char *path)
+{
+    struct sockaddr_un addr;
+    int s;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+    if ( (s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+	    || connect(s, (struct sockaddr*)&addr, sizeof addr) < 0 )
+	fail(path);
+
+    if ( !(to = fdopen(s, "w")) || !(from = fdopen(dup(s), "r")) )
+	fail("fdopen");
+}
+
+
+void
+start_server()
+{
+    int request[2], reply[2];
+
+    if ( pipe(request) != 0 || pipe(reply) != 0 )
+	fail("pipe");
+
+    switch ( fork() ) {
+    case -1:
+	fail("fork");
+    case 0:
+	dup2(request[0], 0);
+	dup2(reply[1], 1);
+	close(request[0]); close(request[1]);
+	close(reply[0]); close(reply[1]);
+	execl(markdown, markdown, "-serve", (char*)0);
+	fail(markdown);
+    }
+    close(request[0]);
+    close(reply[1]);
+
+    if ( !(to = fdopen(request[1], "w")) || !(from = fdopen(reply[0], "r")) )
+	fail("fdopen");
+}
+
+
+/* send a document to the server and read back the css, toc, and html
+ * (one buffer, in that order.)  Returns the status from the server.
+ */
+int
+ask(char *flags, char *text, int size, int parts[3], char **reply)
+{
+    static char *bfr = 0;
+    static int alloc = 0;
+    int status, total;
+
+    fprintf(to, "%d %d\n", (int)strlen(flags), size);
+    fputs(flags, to);
+    fwrite(text, 1, size, to);
+    if ( fflush(to) == EOF )
+	fail("write");
+
+    if ( fscanf(from, "%d %d %d %d", &status, &parts[0], &parts[1], &parts[2]) != 4
+				    || getc(from) != '\n' ) {
+	fprintf(stderr, "%s: bad reply from the server\n", pgm);
+	exit(1);
+    }
+
+    total = parts[0] + parts[1] + parts[2];
+    if ( total > alloc && !(bfr = realloc(bfr, alloc = total)) )
+	fail("realloc");
+    if ( fread(bfr, 1, total, from) != total )
+	fail("read");
+
+    *reply = bfr;
+    return status;
+}
+
+
+double
+now()
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, 0);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+/* time `count` round trips through the server, then `count` runs of
+ * markdown on the same file
+ */
+void
+benchmark(int count, char *flags, char *file, char *text, int size)
+{
+    int parts[3], i, status;
+    char *reply;
+    double start, served, forked;
+    pid_t child;
+
+    start = now();
+    for ( i=0; i < count; i++ )
+	ask(flags, text, size, parts, &reply);
+    served = now() - start;
+
+    start = now();
+    for ( i=0; i < count; i++ ) {
+	if ( (child = fork()) == 0 ) {
+	    if ( !freopen(file, "r", stdin) || !freopen("/dev/null", "w", stdout) )
+		_exit(1);
+	    if ( *flags )
+		execl(markdown, markdown, "-f", flags, (char*)0);
+	    else
+		execl(markdown, markdown, (char*)0);
+	    _exit(1);
+	}
+	if ( child < 0 )
+	    fail("fork");
+	waitpid(child, &status, 0);
+    }
+    forked = now() - start;
+
+    printf("%d documents (%d bytes each)\n", count, size);
+    printf("  markdown -serve:   %10.1f usec/document\n", 1e6 * served / count);
+    printf("  fork per document: %10.1f usec/document\n", 1e6 * forked / count);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    char *path = 0;
+    char *flags = "";
+    int styles = 0, toc = 0, bench = 0;
+    int opt, i, size, status, rc = 0;
+    int parts[3];
+    char *text, *reply;
+
+    while ( (opt = getopt(argc, argv, "s:m:f:STb:")) != EOF ) {
+	switch (opt) {
+	case 's':   path = optarg;
+		    break;
+	case 'm':   markdown = optarg;
+		    break;
+	case 'f':   flags = optarg;
+		    break;
+	case 'S':   styles = 1;
+		    break;
+	case 'T':   toc = 1;
+		    break;
+	case 'b':   bench = atoi(optarg);
+		    break;
+	default:    fprintf(stderr, "usage: %s [-s socket] [-m markdown] "
+				    "[-f flags] [-S] [-T] [-b count] [file...]\n", pgm);
+		    exit(1);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if ( path )
+	connect_to(path);
+    else
+	start_server();
+
+    if ( bench > 0 ) {
+	if ( argc == 0 ) {
+	    fprintf(stderr, "%s: -b needs a file\n", pgm);
+	    exit(1);
+	}
+	text = slurp(argv[0], &size);
+	benchmark(bench, flags, argv[0], text, size);
+	exit(0);
+    }
+
+    i = 0;
+    do {
+	text = slurp(argc ? argv[i] : 0, &size);
+	status = ask(flags, text, size, parts, &reply);
+	free(text);
+
+	if ( status != 0 ) {
+	    fprintf(stderr, "%s: %.*s\n", pgm, parts[2], reply+parts[0]+parts[1]);
+	    rc = 1;
+	    continue;
+	}
+	if ( styles )
+	    fwrite(reply, 1, parts[0], stdout);
+	if ( toc )
+	    fwrite(reply+parts[0], 1, parts[1], stdout);
+	fwrite(reply+parts[0]+parts[1], 1, parts[2], stdout);
+    } while ( ++i < argc );
+
+    exit(rc);
+}
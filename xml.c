@@ -35,23 +35,71 @@ mkd_xmlchar(unsigned char c)
 }
 
 
-/* write output in XML format
+/* how much xml to build up before passing it along to a sink
+ */
+#define XMLCHUNK	4096
+
+/* write output in XML format to a sink
  */
 int
-mkd_generatexml(char *p, int size, FILE *out)
+mkd_sink_xml(char *p, int size, mkd_sink_t fn, void *ctx)
 {
     unsigned char c;
     char *entity;
+    int run;
+    Cstring f;
+    struct mkd_sink out;
+
+    SINK_TO(out, fn, ctx);
+    CREATE(f);
+    RESERVE(f, XMLCHUNK+10);
 
-    while ( size-- > 0 ) {
-	c = *p++;
+    while ( size > 0 ) {
+	/* copy out the characters that don't need escaping a chunk
+	 * at a time
+	 */
+	run = ___mkd_clean(p, (size < XMLCHUNK) ? size : XMLCHUNK, ESC_XML);
+	if ( run ) {
+	    Cswrite(&f, p, run);
+	    p += run;
+	    size -= run;
+	}
+	else {
+	    c = *p++;
+	    --size;
+	    if ( entity = mkd_xmlchar(c) )
+		Cswrite(&f, entity, strlen(entity));
+	    else
+		Csputc(c, &f);
+	}
 
-	if ( entity = mkd_xmlchar(c) )
-	    DO_OR_DIE( fputs(entity, out) );
-	else
-	    DO_OR_DIE( fputc(c, out) );
+	if ( (S(f) >= XMLCHUNK) && (___mkd_flush(&f, &out) == EOF) )
+	    break;
     }
-    return 0;
+    ___mkd_flush(&f, &out);
+    DELETE(f);
+    return out.error ? EOF : 0;
+}
+
+
+/* a sink that xml-encodes what's written to it, then passes it
+ * along to another sink
+ */
+int
+___mkd_xmlsink(const char *p, const int size, void *next)
+{
+    struct mkd_sink *to = next;
+
+    return (mkd_sink_xml((char*)p, size, to->fn, to->ctx) == EOF) ? EOF : size;
+}
+
+
+/* write output in XML format
+ */
+int
+mkd_generatexml(char *p, int size, FILE *out)
+{
+    return mkd_sink_xml(p, size, ___mkd_fsink, out);
 }
 
 
@@ -60,24 +108,19 @@ mkd_generatexml(char *p, int size, FILE *out)
 int
 mkd_xml(char *p, int size, char **res)
 {
-    unsigned char c;
-    char *entity;
     Cstring f;
 
     CREATE(f);
     RESERVE(f, 100);
 
-    while ( size-- > 0 ) {
-	c = *p++;
-	if ( entity = mkd_xmlchar(c) )
-	    Cswrite(&f, entity, strlen(entity));
-	else
-	    Csputc(c, &f);
-    }
+    mkd_sink_xml(p, size, Cssink, &f);
+
     /* null terminate, strdup() into a free()able memory block,
      * and return the size of everything except the null terminator
      */
     EXPAND(f) = 0;
     *res = strdup(T(f));
-    return S(f)-1;
+    size = S(f)-1;
+    DELETE(f);
+    return size;
 }
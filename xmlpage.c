@@ -7,6 +7,7 @@
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <markdown.h>
 
 extern char *mkd_doc_title(Document *);
@@ -19,35 +20,58 @@ extern char* mkd_h1_title(Document *);
 #define DOCUMENT_TITLE(x) mkd_doc_title(x)
 #endif
 
+static int
+sinkputs(char *s, mkd_sink_t fn, void *ctx)
+{
+    return (*fn)(s, strlen(s), ctx);
+}
+
+
 int
-mkd_xhtmlpage(Document *p, mkd_flag_t* flags, FILE *out)
+mkd_sink_xhtmlpage(Document *p, mkd_flag_t* flags, mkd_sink_t fn, void *ctx)
 {
     char *title;
+    Cstring head;
+    struct mkd_sink out;
+    int ret;
 
     if ( mkd_compile(p, flags) ) {
-	DO_OR_DIE( fprintf(out, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
-				"<!DOCTYPE html "
-				" PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""
-				" \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">\n"
-				"<html xmlns=\"http://www.w3.org/1999/xhtml\" xml:lang=\"en\" lang=\"en\">\n") );
+	CREATE(head);
+	Csprintf(&head, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<!DOCTYPE html "
+			" PUBLIC \"-//W3C//DTD XHTML 1.0 Strict//EN\""
+			" \"http://www.w3.org/TR/xhtml1/DTD/xhtml1-strict.dtd\">\n"
+			"<html xmlns=\"http://www.w3.org/1999/xhtml\" xml:lang=\"en\" lang=\"en\">\n");
 
-	DO_OR_DIE( fprintf(out, "<head>\n") );
+	Csprintf(&head, "<head>\n");
 	
 	
 	title = DOCUMENT_TITLE(p);
 	
-	DO_OR_DIE( fprintf(out, "<title>%s</title>", title ? title : "") );
-	
-	DO_OR_DIE( mkd_generatecss(p, out) );
+	Csprintf(&head, "<title>%s</title>", title ? title : "");
+
+	SINK_TO(out, fn, ctx);
+	ret = ___mkd_flush(&head, &out);
+	DELETE(head);
+	DO_OR_DIE( ret );
+
+	DO_OR_DIE( mkd_sink_css(p, fn, ctx) );
 	
-	DO_OR_DIE( fprintf(out, "</head>\n"
-				"<body>\n") );
+	DO_OR_DIE( sinkputs("</head>\n"
+			    "<body>\n", fn, ctx) );
 	
-	DO_OR_DIE( mkd_generatehtml(p, out) );
-	DO_OR_DIE( fprintf(out, "</body>\n"
-				"</html>\n") );
+	DO_OR_DIE( mkd_sink_html(p, fn, ctx) );
+	DO_OR_DIE( sinkputs("</body>\n"
+			    "</html>\n", fn, ctx) );
 
 	return 0;
     }
     return EOF;
 }
+
+
+int
+mkd_xhtmlpage(Document *p, mkd_flag_t* flags, FILE *out)
+{
+    return mkd_sink_xhtmlpage(p, flags, ___mkd_fsink, out);
+}